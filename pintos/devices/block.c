@@ -1,9 +1,18 @@
 #include "devices/block.h"
 #include <list.h>
+#include <round.h>
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef FILESYS
+#include "filesys/cache.h"
+#endif
 
 /* A block device. */
 struct block
@@ -19,6 +28,61 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+    unsigned long long read_req_cnt;    /* Number of read requests. */
+    unsigned long long write_req_cnt;   /* Number of write requests. */
+
+    struct request_queue *queue;        /* Request queue, if any. */
+    struct block *disk;                 /* Disk, if this is a partition. */
+    block_sector_t start;               /* First sector on DISK. */
+  };
+
+/* Request queues.
+
+   A device whose driver calls block_start_queue() gets a request
+   queue and an I/O thread that alone issues its commands.
+   block_submit() adds a request to the queue and returns, and
+   the I/O thread completes the request once it has carried it
+   out.  While the device is busy, requests pile up in the queue,
+   where the I/O thread sorts them by sector and merges requests
+   that are adjacent on disk into a single command.  Requests to
+   a partition go to its disk's queue.
+
+   The I/O thread picks requests in C-LOOK order: the lowest
+   sector at or past the end of the previous command, or else
+   the lowest sector queued.  So that a stream of requests in
+   one part of the disk cannot starve the rest, a request that
+   has waited past its deadline goes first.  Reads, which a
+   thread is usually waiting for, have shorter deadlines than
+   writes.
+
+   The I/O thread cannot reach buffers in a user process's
+   address space, so requests for those bypass the queue. */
+
+/* Deadlines, in timer ticks after a request is queued. */
+#define READ_DEADLINE (TIMER_FREQ / 10)
+#define WRITE_DEADLINE (TIMER_FREQ / 2)
+
+/* Maximum number of sectors merged into one command. */
+#define MERGE_SECTORS 32
+
+/* Pages in the buffer that merged requests are copied through
+   when their buffers are not adjacent in memory. */
+#define MERGE_PAGES DIV_ROUND_UP (MERGE_SECTORS * BLOCK_SECTOR_SIZE, PGSIZE)
+
+/* A device's request queue. */
+struct request_queue
+  {
+    struct lock lock;                   /* Protects lists and HEAD. */
+    struct condition ready;             /* Signaled when a request arrives. */
+    struct list sorted;                 /* Requests in sector order. */
+    struct list fifo[2];                /* Reads, writes in arrival order. */
+    block_sector_t head;                /* Sector after the last command. */
+    void *merge_buf;                    /* MERGE_PAGES pages, or null. */
+
+    unsigned long long req_cnt;         /* Requests queued. */
+    unsigned long long cmd_cnt;         /* Commands issued for them. */
+    unsigned long long expired_cnt;     /* Requests served past deadline. */
+    unsigned long long bypass_cnt;      /* Requests that bypassed queue. */
   };
 
 /* List of all block devices. */
@@ -28,6 +92,16 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static void transfer (struct block *, block_sector_t, size_t cnt,
+                      void *buffer, bool write);
+static void issue (struct block *, block_sector_t, size_t cnt,
+                   void *buffer, bool write);
+static void complete (struct block_request *);
+static thread_func io_thread NO_RETURN;
+static void take_batch (struct request_queue *, struct list *batch);
+static struct block_request *next_request (struct request_queue *);
+static void dispatch (struct block *, struct list *batch);
+static list_less_func request_less;
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -120,9 +194,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  transfer (block, sector, 1, buffer, false);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +205,125 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  transfer (block, sector, 1, (void *) buffer, true);
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR from BLOCK
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Drivers that can do so transfer all of them with as
+   few commands as possible.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                     void *buffer)
+{
+  if (cnt > 0)
+    transfer (block, sector, cnt, buffer, false);
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to BLOCK
+   from BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the block device has acknowledged receiving all
+   of the data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      size_t cnt, const void *buffer)
+{
+  if (cnt > 0)
+    transfer (block, sector, cnt, (void *) buffer, true);
+}
+
+/* Submits request R.  If R's device has a request queue, returns
+   at once, and R completes later in the device's I/O thread.
+   Otherwise, or if R's buffer is in a user process's memory,
+   carries out R and completes it before returning.
+
+   Completing R calls its COMPLETE function, if it has one, and
+   then counts R done in its GROUP, if it has one.  After that,
+   the block layer no longer touches R.  COMPLETE must not wait
+   for other block requests, because it may run in an I/O thread
+   that would have to carry them out. */
+void
+block_submit (struct block_request *r)
+{
+  struct block *block = r->block;
+  struct block *disk = block;
+  struct request_queue *q;
+
+  ASSERT (r->cnt > 0);
+  check_sector (block, r->sector);
+  check_sector (block, r->sector + r->cnt - 1);
+  if (r->write)
+    {
+      ASSERT (block->type != BLOCK_FOREIGN);
+      block->write_cnt += r->cnt;
+      block->write_req_cnt++;
+    }
+  else
+    {
+      block->read_cnt += r->cnt;
+      block->read_req_cnt++;
+    }
+
+  if (r->group != NULL)
+    {
+      lock_acquire (&r->group->lock);
+      r->group->pending++;
+      lock_release (&r->group->lock);
+    }
+
+  /* Send a partition's requests straight to its disk. */
+  r->disk_sector = r->sector;
+  if (block->disk != NULL)
+    {
+      disk = block->disk;
+      r->disk_sector += block->start;
+    }
+
+  q = disk->queue;
+  if (q == NULL || !is_kernel_vaddr (r->buffer))
+    {
+      if (q != NULL)
+        {
+          lock_acquire (&q->lock);
+          q->bypass_cnt++;
+          lock_release (&q->lock);
+        }
+      issue (disk, r->disk_sector, r->cnt, r->buffer, r->write);
+      complete (r);
+      return;
+    }
+
+  r->deadline = timer_ticks () + (r->write ? WRITE_DEADLINE : READ_DEADLINE);
+  lock_acquire (&q->lock);
+  list_insert_ordered (&q->sorted, &r->sort_elem, request_less, NULL);
+  list_push_back (&q->fifo[r->write], &r->fifo_elem);
+  q->req_cnt++;
+  cond_signal (&q->ready, &q->lock);
+  lock_release (&q->lock);
+}
+
+/* Initializes G as an empty group of block requests. */
+void
+block_group_init (struct block_group *g)
+{
+  lock_init (&g->lock);
+  cond_init (&g->done);
+  g->pending = 0;
+}
+
+/* Waits until every request submitted in group G has
+   completed. */
+void
+block_group_wait (struct block_group *g)
+{
+  lock_acquire (&g->lock);
+  while (g->pending > 0)
+    cond_wait (&g->done, &g->lock);
+  lock_release (&g->lock);
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,10 +347,12 @@ block_type (struct block *block)
   return block->type;
 }
 
-/* Prints statistics for each block device used for a Pintos role. */
+/* Prints statistics for each block device used for a Pintos role
+   and for each request queue. */
 void
 block_print_stats (void)
 {
+  struct list_elem *e;
   int i;
 
   for (i = 0; i < BLOCK_ROLE_CNT; i++)
@@ -171,11 +360,27 @@ block_print_stats (void)
       struct block *block = block_by_role[i];
       if (block != NULL)
         {
-          printf ("%s (%s): %llu reads, %llu writes\n",
+          printf ("%s (%s): %llu reads, %llu writes "
+                  "(%llu read requests, %llu write requests)\n",
                   block->name, block_type_name (block->type),
-                  block->read_cnt, block->write_cnt);
+                  block->read_cnt, block->write_cnt,
+                  block->read_req_cnt, block->write_req_cnt);
         }
     }
+  for (e = list_begin (&all_blocks); e != list_end (&all_blocks);
+       e = list_next (e))
+    {
+      struct block *block = list_entry (e, struct block, list_elem);
+      struct request_queue *q = block->queue;
+      if (q != NULL)
+        printf ("%s queue: %llu requests in %llu commands, "
+                "%llu past deadline, %llu bypassed\n",
+                block->name, q->req_cnt, q->cmd_cnt, q->expired_cnt,
+                q->bypass_cnt);
+    }
+#ifdef FILESYS
+  cache_print_stats ();
+#endif
 }
 
 /* Registers a new block device with the given NAME.  If
@@ -200,6 +405,11 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  block->read_req_cnt = 0;
+  block->write_req_cnt = 0;
+  block->queue = NULL;
+  block->disk = NULL;
+  block->start = 0;
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -211,6 +421,54 @@ block_register (const char *name, enum block_type type,
   return block;
 }
 
+/* Gives BLOCK a request queue and an I/O thread that carries out
+   the requests in it.  Drivers for disks that pay for seeks call
+   this after block_register().  Partitions, which pass their
+   requests on to their disk's queue, do not.  The I/O thread
+   runs at PRI_MAX, like the high-priority workqueue, so that
+   CPU-bound threads cannot keep the disk idle. */
+void
+block_start_queue (struct block *block)
+{
+  struct request_queue *q;
+  char name[sizeof block->name + 3];
+
+  ASSERT (block->queue == NULL);
+
+  q = malloc (sizeof *q);
+  if (q == NULL)
+    PANIC ("Failed to allocate request queue for %s", block->name);
+  lock_init (&q->lock);
+  cond_init (&q->ready);
+  list_init (&q->sorted);
+  list_init (&q->fifo[0]);
+  list_init (&q->fifo[1]);
+  q->head = 0;
+  q->merge_buf = palloc_get_multiple (0, MERGE_PAGES);
+  q->req_cnt = q->cmd_cnt = q->expired_cnt = q->bypass_cnt = 0;
+  block->queue = q;
+
+  snprintf (name, sizeof name, "%s-io", block->name);
+  if (thread_create (name, PRI_MAX, io_thread, block) == TID_ERROR)
+    PANIC ("Failed to start I/O thread for %s", block->name);
+}
+
+/* Makes BLOCK a partition of DISK that begins at sector START,
+   so that block_submit() sends BLOCK's requests directly to
+   DISK's request queue. */
+void
+block_set_partition (struct block *block, struct block *disk,
+                     block_sector_t start)
+{
+  if (disk->disk != NULL)
+    {
+      start += disk->start;
+      disk = disk->disk;
+    }
+  block->disk = disk;
+  block->start = start;
+}
+
 /* Returns the block device corresponding to LIST_ELEM, or a null
    pointer if LIST_ELEM is the list end of all_blocks. */
 static struct block *
@@ -221,3 +479,264 @@ list_elem_to_block (struct list_elem *list_elem)
           : NULL);
 }
 
+
+/* Transfers CNT sectors between BLOCK, starting at SECTOR, and
+   BUFFER, to BLOCK if WRITE is true and from it otherwise, and
+   returns when the transfer is complete. */
+static void
+transfer (struct block *block, block_sector_t sector, size_t cnt,
+          void *buffer, bool write)
+{
+  struct block_request r;
+  struct block_group g;
+
+  block_group_init (&g);
+  r.block = block;
+  r.sector = sector;
+  r.cnt = cnt;
+  r.buffer = buffer;
+  r.write = write;
+  r.group = &g;
+  r.complete = NULL;
+  block_submit (&r);
+  block_group_wait (&g);
+}
+
+/* Has BLOCK's driver transfer CNT sectors between BLOCK,
+   starting at SECTOR, and BUFFER, to BLOCK if WRITE is true and
+   from it otherwise. */
+static void
+issue (struct block *block, block_sector_t sector, size_t cnt,
+       void *buffer_, bool write)
+{
+  const struct block_operations *ops = block->ops;
+  uint8_t *buffer = buffer_;
+  size_t i;
+
+  if (write)
+    {
+      if (cnt > 1 && ops->write_multiple != NULL)
+        ops->write_multiple (block->aux, sector, cnt, buffer);
+      else
+        for (i = 0; i < cnt; i++)
+          ops->write (block->aux, sector + i,
+                      buffer + i * BLOCK_SECTOR_SIZE);
+    }
+  else
+    {
+      if (cnt > 1 && ops->read_multiple != NULL)
+        ops->read_multiple (block->aux, sector, cnt, buffer);
+      else
+        for (i = 0; i < cnt; i++)
+          ops->read (block->aux, sector + i,
+                     buffer + i * BLOCK_SECTOR_SIZE);
+    }
+}
+
+/* Completes request R, which has been carried out. */
+static void
+complete (struct block_request *r)
+{
+  /* R may be freed or reused as soon as COMPLETE or the group's
+     waiter sees it done. */
+  struct block_group *g = r->group;
+
+  if (r->complete != NULL)
+    r->complete (r);
+  if (g != NULL)
+    {
+      lock_acquire (&g->lock);
+      if (--g->pending == 0)
+        cond_broadcast (&g->done, &g->lock);
+      lock_release (&g->lock);
+    }
+}
+
+/* I/O thread for BLOCK_, a block device with a request queue.
+   Carries out queued requests, a batch at a time, and completes
+   them. */
+static void
+io_thread (void *block_)
+{
+  struct block *block = block_;
+  struct request_queue *q = block->queue;
+
+  for (;;)
+    {
+      struct list batch;
+
+      lock_acquire (&q->lock);
+      while (list_empty (&q->sorted))
+        cond_wait (&q->ready, &q->lock);
+      take_batch (q, &batch);
+      lock_release (&q->lock);
+
+      dispatch (block, &batch);
+
+      /* A request may be freed once complete, so it must leave
+         BATCH first. */
+      while (!list_empty (&batch))
+        complete (list_entry (list_pop_front (&batch),
+                              struct block_request, sort_elem));
+    }
+}
+
+/* Removes the next request to carry out from Q, along with the
+   requests in the same direction that are adjacent to it on
+   disk, up to MERGE_SECTORS in all, and puts them into BATCH in
+   sector order.  Q's lock must be held. */
+static void
+take_batch (struct request_queue *q, struct list *batch)
+{
+  struct block_request *first, *last;
+  struct list_elem *e;
+  size_t cnt;
+
+  first = last = next_request (q);
+  cnt = first->cnt;
+
+  /* Merge the requests just before and just after on disk. */
+  for (e = list_prev (&first->sort_elem); e != list_head (&q->sorted);
+       e = list_prev (e))
+    {
+      struct block_request *r
+        = list_entry (e, struct block_request, sort_elem);
+      if (r->write != first->write
+          || r->disk_sector + r->cnt != first->disk_sector
+          || cnt + r->cnt > MERGE_SECTORS)
+        break;
+      first = r;
+      cnt += r->cnt;
+    }
+  for (e = list_next (&last->sort_elem); e != list_end (&q->sorted);
+       e = list_next (e))
+    {
+      struct block_request *r
+        = list_entry (e, struct block_request, sort_elem);
+      if (r->write != last->write
+          || r->disk_sector != last->disk_sector + last->cnt
+          || cnt + r->cnt > MERGE_SECTORS)
+        break;
+      last = r;
+      cnt += r->cnt;
+    }
+  q->head = last->disk_sector + last->cnt;
+
+  list_init (batch);
+  list_splice (list_end (batch), &first->sort_elem,
+               list_next (&last->sort_elem));
+  for (e = list_begin (batch); e != list_end (batch); e = list_next (e))
+    list_remove (&list_entry (e, struct block_request, sort_elem)->fifo_elem);
+}
+
+/* Returns the request in Q to carry out next: the oldest request
+   past its deadline, reads first, if there is one, and otherwise
+   the next request in C-LOOK order.  Q must not be empty and its
+   lock must be held. */
+static struct block_request *
+next_request (struct request_queue *q)
+{
+  int64_t now = timer_ticks ();
+  struct list_elem *e;
+  int i;
+
+  for (i = 0; i < 2; i++)
+    if (!list_empty (&q->fifo[i]))
+      {
+        struct block_request *r = list_entry (list_front (&q->fifo[i]),
+                                        struct block_request, fifo_elem);
+        if (now >= r->deadline)
+          {
+            q->expired_cnt++;
+            return r;
+          }
+      }
+
+  for (e = list_begin (&q->sorted); e != list_end (&q->sorted);
+       e = list_next (e))
+    {
+      struct block_request *r
+        = list_entry (e, struct block_request, sort_elem);
+      if (r->disk_sector >= q->head)
+        return r;
+    }
+  return list_entry (list_front (&q->sorted), struct block_request, sort_elem);
+}
+
+/* Carries out the requests in BATCH, which are adjacent on disk
+   and in sector order, with a single command if possible. */
+static void
+dispatch (struct block *block, struct list *batch)
+{
+  struct request_queue *q = block->queue;
+  struct block_request *first = list_entry (list_front (batch),
+                                      struct block_request, sort_elem);
+  struct list_elem *e;
+  bool adjacent = true;
+  size_t cnt = 0;
+  uint8_t *p;
+
+  for (e = list_begin (batch); e != list_end (batch); e = list_next (e))
+    {
+      struct block_request *r
+        = list_entry (e, struct block_request, sort_elem);
+      if ((uint8_t *) r->buffer
+          != (uint8_t *) first->buffer + cnt * BLOCK_SECTOR_SIZE)
+        adjacent = false;
+      cnt += r->cnt;
+    }
+
+  if (adjacent)
+    {
+      /* The buffers form one buffer. */
+      issue (block, first->disk_sector, cnt, first->buffer, first->write);
+      q->cmd_cnt++;
+    }
+  else if (q->merge_buf != NULL)
+    {
+      /* Copy through the merge buffer. */
+      ASSERT (cnt <= MERGE_SECTORS);
+      if (first->write)
+        for (e = list_begin (batch), p = q->merge_buf;
+             e != list_end (batch); e = list_next (e))
+          {
+            struct block_request *r
+              = list_entry (e, struct block_request, sort_elem);
+            memcpy (p, r->buffer, r->cnt * BLOCK_SECTOR_SIZE);
+            p += r->cnt * BLOCK_SECTOR_SIZE;
+          }
+      issue (block, first->disk_sector, cnt, q->merge_buf, first->write);
+      q->cmd_cnt++;
+      if (!first->write)
+        for (e = list_begin (batch), p = q->merge_buf;
+             e != list_end (batch); e = list_next (e))
+          {
+            struct block_request *r
+              = list_entry (e, struct block_request, sort_elem);
+            memcpy (r->buffer, p, r->cnt * BLOCK_SECTOR_SIZE);
+            p += r->cnt * BLOCK_SECTOR_SIZE;
+          }
+    }
+  else
+    for (e = list_begin (batch); e != list_end (batch); e = list_next (e))
+      {
+        struct block_request *r
+          = list_entry (e, struct block_request, sort_elem);
+        issue (block, r->disk_sector, r->cnt, r->buffer, r->write);
+        q->cmd_cnt++;
+      }
+}
+
+/* Returns true if request A starts at a lower sector than
+   request B. */
+static bool
+request_less (const struct list_elem *a_, const struct list_elem *b_,
+              void *aux UNUSED)
+{
+  const struct block_request *a
+    = list_entry (a_, struct block_request, sort_elem);
+  const struct block_request *b
+    = list_entry (b_, struct block_request, sort_elem);
+
+  return a->disk_sector < b->disk_sector;
+}
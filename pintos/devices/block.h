@@ -3,6 +3,8 @@
 
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
+#include "threads/synch.h"
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,9 +55,48 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, size_t cnt, void *);
+void block_write_multiple (struct block *, block_sector_t, size_t cnt,
+                           const void *);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/* Asynchronous block requests. */
+
+/* A set of requests that a thread can wait for together. */
+struct block_group
+  {
+    struct lock lock;                   /* Protects PENDING. */
+    struct condition done;              /* Signaled when PENDING is 0. */
+    unsigned pending;                   /* Requests not yet complete. */
+  };
+
+/* A request to transfer sectors between a block device and
+   memory.  The submitter fills in the members up to AUX, then
+   must not modify the request or touch BUFFER until the request
+   completes. */
+struct block_request
+  {
+    struct block *block;                /* Device. */
+    block_sector_t sector;              /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+    void *buffer;                       /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    bool write;                         /* Write to BLOCK, or read? */
+    struct block_group *group;          /* Group to count toward, or null. */
+    void (*complete) (struct block_request *); /* Called when done, or null. */
+    void *aux;                          /* For COMPLETE's use. */
+
+    /* Owned by the block layer. */
+    struct list_elem sort_elem;         /* In a request queue. */
+    struct list_elem fifo_elem;         /* In a request queue. */
+    block_sector_t disk_sector;         /* SECTOR on the queue's device. */
+    int64_t deadline;                   /* Serve by this timer tick. */
+  };
+
+void block_submit (struct block_request *);
+void block_group_init (struct block_group *);
+void block_group_wait (struct block_group *);
+
 /* Statistics. */
 void block_print_stats (void);
 
@@ -65,10 +106,20 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Transfer CNT consecutive sectors.  Optional: if null, the
+       block layer calls READ or WRITE once per sector. */
+    void (*read_multiple) (void *aux, block_sector_t, size_t cnt,
+                           void *buffer);
+    void (*write_multiple) (void *aux, block_sector_t, size_t cnt,
+                            const void *buffer);
   };
 
 struct block *block_register (const char *name, enum block_type,
                               const char *extra_info, block_sector_t size,
                               const struct block_operations *, void *aux);
+void block_start_queue (struct block *);
+void block_set_partition (struct block *, struct block *disk,
+                          block_sector_t start);
 
 #endif /* devices/block.h */
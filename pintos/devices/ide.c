@@ -3,15 +3,27 @@
 #include <debug.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 #include "devices/block.h"
 #include "devices/partition.h"
+#include "devices/pci.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].
+
+   If a PCI bus-master IDE controller, such as the PIIX that
+   QEMU and Bochs emulate, drives the legacy channels, data moves
+   by DMA: the controller copies it to or from memory described
+   by a table of physical regions while the CPU does other work,
+   and the completion interrupt arrives once per command.
+   Otherwise, or with the "-pio" kernel option, the CPU copies
+   every word through the data register (PIO). */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -34,6 +46,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +62,43 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Bus master IDE registers, relative to a channel's bm_base. */
+#define BM_COMMAND 0            /* Command (8 bits). */
+#define BM_STATUS 2             /* Status (8 bits). */
+#define BM_PRDT 4               /* PRD table physical address (32 bits). */
+
+/* Bus master command register bits. */
+#define BMC_START 0x01          /* Start transferring. */
+#define BMC_READ 0x08           /* Transfer from disk to memory. */
+
+/* Bus master status register bits.  Writing 1 clears ERR and
+   INTR. */
+#define BMS_ERR 0x02            /* Transfer failed. */
+#define BMS_INTR 0x04           /* Disk raised its interrupt. */
+
+/* A physical region descriptor: one piece of a DMA buffer.  A
+   region must not cross a 64 kB boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address, even. */
+    uint16_t size;              /* Size in bytes, 0 for 64 kB. */
+    uint16_t flags;             /* PRD_EOT in the last descriptor. */
+  };
+#define PRD_EOT 0x8000          /* End of table. */
+
+/* Number of descriptors in a PRD table, which takes one page so
+   that it does not cross a 64 kB boundary. */
+#define PRD_CNT (PGSIZE / sizeof (struct prd))
+
+/* Maximum number of sectors transferred by one command.  A
+   sector count register value of 0 means 256. */
+#define MAX_COMMAND_SECTORS 256
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +107,9 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    int multiple;               /* Sectors per interrupt in READ/WRITE
+                                   MULTIPLE, or 0 if not supported. */
+    bool dma;                   /* Transfer by DMA? */
   };
 
 /* An ATA channel (aka controller).
@@ -70,7 +123,11 @@ struct channel
     struct lock lock;           /* Must acquire to access the controller. */
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
                                    any interrupt would be spurious. */
-    struct semaphore completion_wait;   /* Up'd by interrupt handler. */
+    bool completed;             /* Interrupt seen, waiter not yet woken. */
+    struct semaphore completion_wait;   /* Up'd by block softirq. */
+
+    uint16_t bm_base;           /* Bus master registers, 0 if none. */
+    struct prd *prdt;           /* PRD table, if BM_BASE is nonzero. */
 
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
@@ -81,14 +138,28 @@ static struct channel channels[CHANNEL_CNT];
 
 static struct block_operations ide_operations;
 
+/* -pio: Never use DMA? */
+bool ide_pio_only;
+
+/* Statistics. */
+static long long dma_cnt;       /* # of sectors moved by DMA. */
+static long long pio_cnt;       /* # of sectors moved by PIO. */
+
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
+static void set_multiple_mode (struct ata_disk *, int cnt);
+
+static void find_bus_master (void);
+static bool dma_transfer (struct ata_disk *, block_sector_t, size_t cnt,
+                          void *buffer, bool read);
+static bool build_prdt (struct channel *, void *buffer, size_t size,
+                        bool read);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void select_sectors (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
-static void input_sector (struct channel *, void *);
-static void output_sector (struct channel *, const void *);
+static void input_sectors (struct channel *, void *, size_t cnt);
+static void output_sectors (struct channel *, const void *, size_t cnt);
 
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
@@ -96,6 +167,7 @@ static void select_device (const struct ata_disk *);
 static void select_device_wait (const struct ata_disk *);
 
 static void interrupt_handler (struct intr_frame *);
+static softirq_func completion_softirq;
 
 /* Initialize the disk subsystem and detect disks. */
 void
@@ -103,6 +175,9 @@ ide_init (void)
 {
   size_t chan_no;
 
+  intr_register_softirq (SOFTIRQ_BLOCK, completion_softirq);
+  if (!ide_pio_only)
+    find_bus_master ();
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
     {
       struct channel *c = &channels[chan_no];
@@ -125,6 +200,7 @@ ide_init (void)
         }
       lock_init (&c->lock);
       c->expecting_interrupt = false;
+      c->completed = false;
       sema_init (&c->completion_wait, 0);
  
       /* Initialize devices. */
@@ -136,6 +212,8 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->multiple = 0;
+          d->dma = false;
         }
 
       /* Register interrupt handler. */
@@ -154,6 +232,14 @@ ide_init (void)
           identify_ata_device (&c->devices[dev_no]);
     }
 }
+
+/* Prints IDE transfer statistics. */
+void
+ide_print_stats (void) 
+{
+  printf ("IDE: %lld sectors by DMA, %lld sectors by PIO\n",
+          dma_cnt, pio_cnt);
+}
 
 /* Disk detection and identification. */
 
@@ -191,9 +277,9 @@ reset_channel (struct channel *c)
   /* Issue soft reset sequence, which selects device 0 as a side effect.
      Also enable interrupts. */
   outb (reg_ctl (c), 0);
-  timer_usleep (10);
+  timer_udelay (10);
   outb (reg_ctl (c), CTL_SRST);
-  timer_usleep (10);
+  timer_udelay (10);
   outb (reg_ctl (c), 0);
 
   timer_msleep (150);
@@ -279,7 +365,7 @@ identify_ata_device (struct ata_disk *d)
       d->is_ata = false;
       return;
     }
-  input_sector (c, id);
+  input_sectors (c, id, 1);
 
   /* Calculate capacity.
      Read model name and serial number. */
@@ -303,12 +389,42 @@ identify_ata_device (struct ata_disk *d)
       return;
     }
 
+  /* Use DMA if the channel has a bus master and the disk
+     supports DMA (word 49, bit 8). */
+  d->dma = c->bm_base != 0 && (id[49 * 2 + 1] & 0x01) != 0;
+  if (d->dma)
+    snprintf (extra_info + strlen (extra_info),
+              sizeof extra_info - strlen (extra_info), ", DMA");
+
+  /* Transfer as many sectors per interrupt as the disk allows
+     in READ/WRITE MULTIPLE. */
+  if ((id[47 * 2] & 0xff) > 1)
+    set_multiple_mode (d, id[47 * 2] & 0xff);
+
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
+  block_start_queue (block);
   partition_scan (block);
 }
 
+/* Tells disk D to transfer CNT sectors per interrupt in READ
+   MULTIPLE and WRITE MULTIPLE commands.  If the disk refuses,
+   D goes on using single-sector transfers. */
+static void
+set_multiple_mode (struct ata_disk *d, int cnt) 
+{
+  struct channel *c = d->channel;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), cnt);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if (!(inb (reg_alt_status (c)) & STA_ERR))
+    d->multiple = cnt;
+}
+
 /* Translates STRING, which consists of SIZE bytes in a funky
    format, into a null-terminated string in-place.  Drops
    trailing whitespace and null bytes.  Returns STRING.  */
@@ -337,63 +453,150 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
+/* Reads CNT sectors starting at SEC_NO from disk D into BUFFER,
+   which must have room for CNT * BLOCK_SECTOR_SIZE bytes.  Issues
+   one command per MAX_COMMAND_SECTORS sectors.  By DMA, each
+   command raises a single interrupt.  By PIO, READ MULTIPLE
+   raises one interrupt per D->multiple sectors rather than one
+   per sector.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_read_multiple (void *d_, block_sector_t sec_no, size_t cnt,
+                   void *buffer_)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  uint8_t *buffer = buffer_;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
+  while (cnt > 0)
+    {
+      size_t n = cnt < MAX_COMMAND_SECTORS ? cnt : MAX_COMMAND_SECTORS;
+      bool multiple = d->multiple > 0 && n > 1;
+      size_t per_irq = multiple ? (size_t) d->multiple : 1;
+      size_t done;
+
+      if (dma_transfer (d, sec_no, n, buffer, true))
+        {
+          buffer += n * BLOCK_SECTOR_SIZE;
+          sec_no += n;
+          cnt -= n;
+          continue;
+        }
+
+      pio_cnt += n;
+      select_sectors (d, sec_no, n);
+      issue_pio_command (c, (multiple ? CMD_READ_MULTIPLE
+                             : CMD_READ_SECTOR_RETRY));
+      for (done = 0; done < n; done += per_irq)
+        {
+          size_t block_cnt = n - done < per_irq ? n - done : per_irq;
+
+          sema_down (&c->completion_wait);
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk read failed, sector=%"PRDSNu,
+                   d->name, (block_sector_t) (sec_no + done));
+          input_sectors (c, buffer, block_cnt);
+          buffer += block_cnt * BLOCK_SECTOR_SIZE;
+        }
+      sec_no += n;
+      cnt -= n;
+    }
   lock_release (&c->lock);
 }
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+/* Writes CNT sectors starting at SEC_NO to disk D from BUFFER,
+   which must contain CNT * BLOCK_SECTOR_SIZE bytes, as
+   ide_read_multiple() reads them.  Returns after the disk has
    acknowledged receiving the data.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+ide_write_multiple (void *d_, block_sector_t sec_no, size_t cnt,
+                    const void *buffer_)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  const uint8_t *buffer = buffer_;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
+  while (cnt > 0)
+    {
+      size_t n = cnt < MAX_COMMAND_SECTORS ? cnt : MAX_COMMAND_SECTORS;
+      bool multiple = d->multiple > 0 && n > 1;
+      size_t per_irq = multiple ? (size_t) d->multiple : 1;
+      size_t done;
+
+      /* The bus master reads BUFFER but never writes it. */
+      if (dma_transfer (d, sec_no, n, (void *) buffer, false))
+        {
+          buffer += n * BLOCK_SECTOR_SIZE;
+          sec_no += n;
+          cnt -= n;
+          continue;
+        }
+
+      pio_cnt += n;
+      select_sectors (d, sec_no, n);
+      issue_pio_command (c, (multiple ? CMD_WRITE_MULTIPLE
+                             : CMD_WRITE_SECTOR_RETRY));
+      for (done = 0; done < n; done += per_irq)
+        {
+          size_t block_cnt = n - done < per_irq ? n - done : per_irq;
+
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                   d->name, (block_sector_t) (sec_no + done));
+          output_sectors (c, buffer, block_cnt);
+          buffer += block_cnt * BLOCK_SECTOR_SIZE;
+          sema_down (&c->completion_wait);
+        }
+      sec_no += n;
+      cnt -= n;
+    }
   lock_release (&c->lock);
 }
 
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes. */
+static void
+ide_read (void *d, block_sector_t sec_no, void *buffer)
+{
+  ide_read_multiple (d, sec_no, 1, buffer);
+}
+
+/* Write sector SEC_NO to disk D from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+   acknowledged receiving the data. */
+static void
+ide_write (void *d, block_sector_t sec_no, const void *buffer)
+{
+  ide_write_multiple (d, sec_no, 1, buffer);
+}
+
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multiple,
+    ide_write_multiple
   };
-
+
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and CNT, which must be between 1 and
+   MAX_COMMAND_SECTORS, to the disk's sector selection
+   registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sectors (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt >= 1 && cnt <= MAX_COMMAND_SECTORS);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt % MAX_COMMAND_SECTORS);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -401,8 +604,125 @@ select_sector (struct ata_disk *d, block_sector_t sec_no)
         DEV_MBS | DEV_LBA | (d->dev_no == 1 ? DEV_DEV : 0) | (sec_no >> 24));
 }
 
-/* Writes COMMAND to channel C and prepares for receiving a
-   completion interrupt. */
+/* Bus-master DMA. */
+
+/* Finds the PCI bus-master IDE controller that drives the legacy
+   channels, if any, and prepares its channels for DMA. */
+static void
+find_bus_master (void) 
+{
+  const struct pci_dev *dev;
+  size_t chan_no;
+  uint16_t base;
+
+  /* Programming interface bit 7 means a bus master. */
+  for (dev = pci_find_class (0x01, 0x01, NULL); dev != NULL;
+       dev = pci_find_class (0x01, 0x01, dev))
+    if (dev->prog_if & 0x80)
+      break;
+  if (dev == NULL)
+    return;
+
+  /* Base address register 4 holds the bus master registers of
+     both channels, 8 ports each. */
+  base = pci_bar (dev, 4);
+  if (base == 0)
+    return;
+  pci_enable (dev, PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+
+  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
+    {
+      struct channel *c = &channels[chan_no];
+
+      c->prdt = palloc_get_page (0);
+      if (c->prdt == NULL)
+        continue;
+      c->bm_base = base + chan_no * 8;
+    }
+}
+
+/* Transfers CNT sectors, at most MAX_COMMAND_SECTORS, between
+   disk D, starting at SEC_NO, and BUFFER by DMA, from the disk to
+   BUFFER if READ is true and the other way if it is false.
+   Returns false without starting a transfer if D cannot use DMA
+   or BUFFER cannot be described to the bus master, in which case
+   the caller should use PIO.  D's channel's lock must be held. */
+static bool
+dma_transfer (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+              void *buffer, bool read) 
+{
+  struct channel *c = d->channel;
+  uint8_t direction = read ? BMC_READ : 0;
+  uint8_t bm_status, status;
+
+  if (!d->dma || !build_prdt (c, buffer, cnt * BLOCK_SECTOR_SIZE, read))
+    return false;
+
+  /* Point the bus master at the PRD table and clear its
+     status. */
+  outl (c->bm_base + BM_PRDT, vtop (c->prdt));
+  outb (c->bm_base + BM_COMMAND, direction);
+  outb (c->bm_base + BM_STATUS,
+        inb (c->bm_base + BM_STATUS) | BMS_ERR | BMS_INTR);
+
+  /* Issue the command, start the bus master, and wait for the
+     completion interrupt. */
+  select_sectors (d, sec_no, cnt);
+  issue_pio_command (c, read ? CMD_READ_DMA : CMD_WRITE_DMA);
+  outb (c->bm_base + BM_COMMAND, direction | BMC_START);
+  sema_down (&c->completion_wait);
+
+  /* Stop the bus master and check for errors. */
+  outb (c->bm_base + BM_COMMAND, direction);
+  bm_status = inb (c->bm_base + BM_STATUS);
+  outb (c->bm_base + BM_STATUS, bm_status | BMS_ERR | BMS_INTR);
+  status = inb (reg_alt_status (c));
+  if ((bm_status & BMS_ERR) || (status & (STA_BSY | STA_ERR)))
+    PANIC ("%s: DMA %s failed, sector=%"PRDSNu, d->name,
+           read ? "read" : "write", sec_no);
+
+  dma_cnt += cnt;
+  return true;
+}
+
+/* Describes the SIZE bytes at BUFFER in channel C's PRD table,
+   one descriptor per page or part of a page, for a transfer into
+   BUFFER if READ is true and out of it otherwise.  Returns false
+   if part of BUFFER is not mapped, is read-only and READ is true,
+   is not at an even address, or would need too many
+   descriptors. */
+static bool
+build_prdt (struct channel *c, void *buffer, size_t size, bool read) 
+{
+  uint8_t *p = buffer;
+  size_t i;
+
+  ASSERT (size > 0);
+
+  for (i = 0; size > 0; i++)
+    {
+      size_t chunk = PGSIZE - pg_ofs (p);
+      uint32_t phys;
+
+      if (chunk > size)
+        chunk = size;
+      if (i >= PRD_CNT || !pci_dma_address (p, read, &phys) || (phys & 1))
+        return false;
+
+      /* A chunk within one page never crosses 64 kB. */
+      c->prdt[i].addr = phys;
+      c->prdt[i].size = chunk;
+      c->prdt[i].flags = 0;
+
+      p += chunk;
+      size -= chunk;
+    }
+  c->prdt[i - 1].flags = PRD_EOT;
+  return true;
+}
+
+/* Writes COMMAND, a PIO or DMA command, to channel C and
+   prepares for receiving a completion interrupt. */
 static void
 issue_pio_command (struct channel *c, uint8_t command) 
 {
@@ -414,20 +734,22 @@ issue_pio_command (struct channel *c, uint8_t command)
   outb (reg_command (c), command);
 }
 
-/* Reads a sector from channel C's data register in PIO mode into
-   SECTOR, which must have room for BLOCK_SECTOR_SIZE bytes. */
+/* Reads CNT sectors from channel C's data register in PIO mode
+   into SECTORS, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes. */
 static void
-input_sector (struct channel *c, void *sector) 
+input_sectors (struct channel *c, void *sectors, size_t cnt) 
 {
-  insw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
+  insw (reg_data (c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
 }
 
-/* Writes SECTOR to channel C's data register in PIO mode.
-   SECTOR must contain BLOCK_SECTOR_SIZE bytes. */
+/* Writes CNT sectors from SECTORS to channel C's data register
+   in PIO mode.  SECTORS must contain CNT * BLOCK_SECTOR_SIZE
+   bytes. */
 static void
-output_sector (struct channel *c, const void *sector) 
+output_sectors (struct channel *c, const void *sectors, size_t cnt) 
 {
-  outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
+  outsw (reg_data (c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
 }
 
 /* Low-level ATA primitives. */
@@ -446,7 +768,7 @@ wait_until_idle (const struct ata_disk *d)
     {
       if ((inb (reg_status (d->channel)) & (STA_BSY | STA_DRQ)) == 0)
         return;
-      timer_usleep (10);
+      timer_udelay (10);
     }
 
   printf ("%s: idle timeout\n", d->name);
@@ -489,7 +811,7 @@ select_device (const struct ata_disk *d)
     dev |= DEV_DEV;
   outb (reg_device (c), dev);
   inb (reg_alt_status (c));
-  timer_nsleep (400);
+  timer_ndelay (400);
 }
 
 /* Select disk D in its channel, as select_device(), but wait for
@@ -502,7 +824,8 @@ select_device_wait (const struct ata_disk *d)
   wait_until_idle (d);
 }
 
-/* ATA interrupt handler. */
+/* ATA interrupt handler.  Acknowledges the interrupt and leaves
+   waking the waiter to the block softirq. */
 static void
 interrupt_handler (struct intr_frame *f) 
 {
@@ -514,7 +837,8 @@ interrupt_handler (struct intr_frame *f)
         if (c->expecting_interrupt) 
           {
             inb (reg_status (c));               /* Acknowledge interrupt. */
-            sema_up (&c->completion_wait);      /* Wake up waiter. */
+            c->completed = true;
+            intr_raise_softirq (SOFTIRQ_BLOCK);
           }
         else
           printf ("%s: unexpected interrupt\n", c->name);
@@ -524,4 +848,23 @@ interrupt_handler (struct intr_frame *f)
   NOT_REACHED ();
 }
 
+/* Block softirq: wakes up the threads waiting for the commands
+   that interrupt_handler() saw complete. */
+static void
+completion_softirq (void) 
+{
+  struct channel *c;
+
+  for (c = channels; c < channels + CHANNEL_CNT; c++)
+    {
+      enum intr_level old_level = intr_disable ();
+      bool completed = c->completed;
+      c->completed = false;
+      intr_set_level (old_level);
+
+      if (completed)
+        sema_up (&c->completion_wait);
+    }
+}
+
 
@@ -1,6 +1,12 @@
 #ifndef DEVICES_IDE_H
 #define DEVICES_IDE_H
 
+#include <stdbool.h>
+
+/* -pio: Never use DMA? */
+extern bool ide_pio_only;
+
 void ide_init (void);
+void ide_print_stats (void);
 
 #endif /* devices/ide.h */
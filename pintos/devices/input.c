@@ -41,6 +41,36 @@ input_getc (void)
   return key;
 }
 
+/* Retrieves a key from the input buffer, like input_getc(), but
+   gives up and returns -1 if CANCEL returns true while the
+   buffer is empty.  input_kick() makes a waiting caller check
+   CANCEL again. */
+int
+input_getc_unless (bool (*cancel) (void)) 
+{
+  enum intr_level old_level;
+  int key;
+
+  old_level = intr_disable ();
+  key = intq_getc_unless (&buffer, cancel);
+  serial_notify ();
+  intr_set_level (old_level);
+
+  return key;
+}
+
+/* Wakes the thread waiting in input_getc_unless() for a key, if
+   any, so that it checks whether to give up. */
+void
+input_kick (void) 
+{
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  intq_kick (&buffer);
+  intr_set_level (old_level);
+}
+
 /* Returns true if the input buffer is full,
    false otherwise.
    Interrupts must be off. */
@@ -54,6 +54,46 @@ intq_getc (struct intq *q)
   return byte;
 }
 
+/* Like intq_getc(), but if CANCEL returns true while Q is empty,
+   returns -1 instead of sleeping.  CANCEL is called with Q's lock
+   held and interrupts off, so intq_kick() cannot slip in between
+   it and the sleep.  Must not be called from an interrupt
+   handler. */
+int
+intq_getc_unless (struct intq *q, bool (*cancel) (void)) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (!intr_context ());
+  while (intq_empty (q)) 
+    {
+      bool stop;
+
+      lock_acquire (&q->lock);
+      stop = cancel ();
+      if (!stop && intq_empty (q))
+        wait (q, &q->not_empty);
+      lock_release (&q->lock);
+      if (stop)
+        return -1;
+    }
+  return intq_getc (q);
+}
+
+/* Wakes the thread waiting for Q to become nonempty, if any, so
+   that a caller of intq_getc_unless() calls its CANCEL function
+   again.  Interrupts must be off. */
+void
+intq_kick (struct intq *q) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (q->not_empty != NULL) 
+    {
+      thread_unblock (q->not_empty);
+      q->not_empty = NULL;
+    }
+}
+
 /* Adds BYTE to the end of Q.
    If Q is full, sleeps until a byte is removed.
    When called from an interrupt handler, Q must not be full. */
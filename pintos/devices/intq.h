@@ -38,6 +38,8 @@ void intq_init (struct intq *);
 bool intq_empty (const struct intq *);
 bool intq_full (const struct intq *);
 uint8_t intq_getc (struct intq *);
+int intq_getc_unless (struct intq *, bool (*cancel) (void));
+void intq_kick (struct intq *);
 void intq_putc (struct intq *, uint8_t);
 
 #endif /* devices/intq.h */
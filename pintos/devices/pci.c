@@ -0,0 +1,245 @@
+#include "devices/pci.h"
+#include <debug.h>
+#include <stdio.h>
+#include "threads/io.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef USERPROG
+#include "userprog/pagedir.h"
+#endif
+
+/* The code in this file finds the devices on the PCI bus and
+   reads and writes their configuration space, using
+   configuration mechanism #1, which every PC chipset since the
+   PCI 2.0 days (and every emulator) supports. */
+
+/* Configuration mechanism #1 ports. */
+#define PCI_CONFIG_ADDRESS 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+/* Configuration space registers used only in this file. */
+#define PCI_VENDOR_ID 0x00      /* Vendor ID (16 bits). */
+#define PCI_DEVICE_ID 0x02      /* Device ID (16 bits). */
+#define PCI_PROG_IF 0x09        /* Programming interface (8 bits). */
+#define PCI_SUBCLASS 0x0a       /* Subclass (8 bits). */
+#define PCI_CLASS 0x0b          /* Base class (8 bits). */
+#define PCI_HEADER_TYPE 0x0e    /* Header type (8 bits). */
+
+/* Header type bit for devices with more than one function. */
+#define PCI_HEADER_MULTIFUNCTION 0x80
+
+/* Functions found by pci_init(). */
+#define PCI_MAX_DEVS 32
+static struct pci_dev devs[PCI_MAX_DEVS];
+static size_t dev_cnt;
+
+static uint32_t config_address (uint8_t bus, uint8_t slot, uint8_t func,
+                                uint8_t reg);
+static uint32_t read_config (uint8_t bus, uint8_t slot, uint8_t func,
+                             uint8_t reg);
+static void add_function (uint8_t bus, uint8_t slot, uint8_t func);
+
+/* Finds the functions on every PCI bus. */
+void
+pci_init (void) 
+{
+  int bus, slot;
+
+  for (bus = 0; bus < 256; bus++)
+    for (slot = 0; slot < 32; slot++)
+      {
+        uint32_t header;
+        int func;
+
+        if ((read_config (bus, slot, 0, PCI_VENDOR_ID) & 0xffff) == 0xffff)
+          continue;
+        add_function (bus, slot, 0);
+
+        header = read_config (bus, slot, 0, PCI_HEADER_TYPE & ~3);
+        if (header >> ((PCI_HEADER_TYPE & 3) * 8) & PCI_HEADER_MULTIFUNCTION)
+          for (func = 1; func < 8; func++)
+            if ((read_config (bus, slot, func, PCI_VENDOR_ID) & 0xffff)
+                != 0xffff)
+              add_function (bus, slot, func);
+      }
+}
+
+/* Returns the first PCI function after PREV, or the first one
+   of all if PREV is null, with the given CLASS and SUBCLASS.
+   Returns a null pointer if there is none. */
+const struct pci_dev *
+pci_find_class (uint8_t class, uint8_t subclass, const struct pci_dev *prev)
+{
+  const struct pci_dev *d;
+
+  for (d = prev != NULL ? prev + 1 : devs; d < devs + dev_cnt; d++)
+    if (d->class == class && d->subclass == subclass)
+      return d;
+  return NULL;
+}
+
+/* Returns the first PCI function after PREV, or the first one
+   of all if PREV is null, with the given VENDOR_ID and
+   DEVICE_ID.  Returns a null pointer if there is none. */
+const struct pci_dev *
+pci_find_device (uint16_t vendor_id, uint16_t device_id,
+                 const struct pci_dev *prev)
+{
+  const struct pci_dev *d;
+
+  for (d = prev != NULL ? prev + 1 : devs; d < devs + dev_cnt; d++)
+    if (d->vendor_id == vendor_id && d->device_id == device_id)
+      return d;
+  return NULL;
+}
+
+/* Returns the 32-bit configuration register of D at REG, which
+   must be a multiple of 4. */
+uint32_t
+pci_read_config (const struct pci_dev *d, uint8_t reg) 
+{
+  ASSERT (reg % 4 == 0);
+  return read_config (d->bus, d->slot, d->func, reg);
+}
+
+/* Returns the 16-bit configuration register of D at REG, which
+   must be even. */
+uint16_t
+pci_read_config16 (const struct pci_dev *d, uint8_t reg) 
+{
+  ASSERT (reg % 2 == 0);
+  return pci_read_config (d, reg & ~3) >> ((reg & 3) * 8);
+}
+
+/* Returns the 8-bit configuration register of D at REG. */
+uint8_t
+pci_read_config8 (const struct pci_dev *d, uint8_t reg) 
+{
+  return pci_read_config (d, reg & ~3) >> ((reg & 3) * 8);
+}
+
+/* Sets the 32-bit configuration register of D at REG, which must
+   be a multiple of 4, to VALUE. */
+void
+pci_write_config (const struct pci_dev *d, uint8_t reg, uint32_t value) 
+{
+  ASSERT (reg % 4 == 0);
+  outl (PCI_CONFIG_ADDRESS, config_address (d->bus, d->slot, d->func, reg));
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Sets the 16-bit configuration register of D at REG, which must
+   be even, to VALUE. */
+void
+pci_write_config16 (const struct pci_dev *d, uint8_t reg, uint16_t value) 
+{
+  ASSERT (reg % 2 == 0);
+  outl (PCI_CONFIG_ADDRESS, config_address (d->bus, d->slot, d->func, reg));
+  outw (PCI_CONFIG_DATA + (reg & 3), value);
+}
+
+/* Returns the address in base address register BAR of D, without
+   the type bits: an I/O port number for an I/O space BAR, a
+   physical address for a memory space BAR. */
+uint32_t
+pci_bar (const struct pci_dev *d, int bar) 
+{
+  uint32_t value;
+
+  ASSERT (bar >= 0 && bar < 6);
+  value = pci_read_config (d, PCI_BAR0 + bar * 4);
+  return value & 1 ? value & ~3u : value & ~15u;
+}
+
+/* Sets COMMAND_BITS, a set of PCI_COMMAND_* bits, in D's command
+   register, e.g. to let D master the bus. */
+void
+pci_enable (const struct pci_dev *d, uint16_t command_bits) 
+{
+  pci_write_config16 (d, PCI_COMMAND,
+                      pci_read_config16 (d, PCI_COMMAND) | command_bits);
+}
+
+/* Stores in *ADDR the address at which a bus master reaches the
+   byte at VADDR, and returns true.  DEV_WRITES is true if the
+   device will write to memory there, false if it will only read.
+   Returns false if VADDR is a user address that the running
+   process has not mapped, or, if DEV_WRITES, has mapped
+   read-only, since the device does not heed page protections.
+   A user buffer must stay mapped until the device is done with
+   it, as the system calls ensure by pinning its pages.  The
+   address is good only up to the end of VADDR's page. */
+bool
+pci_dma_address (const void *vaddr, bool dev_writes UNUSED,
+                 uint32_t *addr) 
+{
+  if (is_kernel_vaddr (vaddr))
+    {
+      *addr = vtop (vaddr);
+      return true;
+    }
+#ifdef USERPROG
+  else
+    {
+      uint32_t *pd = thread_current ()->pagedir;
+      void *kaddr = pd != NULL ? pagedir_get_page (pd, vaddr) : NULL;
+
+      if (kaddr != NULL
+          && (!dev_writes || pagedir_is_writable (pd, vaddr)))
+        {
+          /* The CPU will not see the device's writes, so mark the
+             page dirty for it, lest eviction discard them. */
+          if (dev_writes)
+            pagedir_set_dirty (pd, vaddr, true);
+          *addr = vtop (kaddr);
+          return true;
+        }
+    }
+#endif
+  return false;
+}
+
+/* Returns the value to write to PCI_CONFIG_ADDRESS to access
+   register REG of function FUNC of device SLOT on BUS. */
+static uint32_t
+config_address (uint8_t bus, uint8_t slot, uint8_t func, uint8_t reg) 
+{
+  return (0x80000000u | (uint32_t) bus << 16 | (uint32_t) slot << 11
+          | (uint32_t) func << 8 | (reg & 0xfc));
+}
+
+/* Returns the 32-bit configuration register at REG, a multiple
+   of 4, of function FUNC of device SLOT on BUS. */
+static uint32_t
+read_config (uint8_t bus, uint8_t slot, uint8_t func, uint8_t reg) 
+{
+  outl (PCI_CONFIG_ADDRESS, config_address (bus, slot, func, reg));
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Records function FUNC of device SLOT on BUS. */
+static void
+add_function (uint8_t bus, uint8_t slot, uint8_t func) 
+{
+  struct pci_dev *d;
+  uint32_t id, class;
+
+  if (dev_cnt >= PCI_MAX_DEVS)
+    {
+      printf ("pci: too many devices, ignoring %02x:%02x.%x\n",
+              bus, slot, func);
+      return;
+    }
+
+  id = read_config (bus, slot, func, PCI_VENDOR_ID);
+  class = read_config (bus, slot, func, PCI_PROG_IF & ~3);
+  d = &devs[dev_cnt++];
+  d->bus = bus;
+  d->slot = slot;
+  d->func = func;
+  d->vendor_id = id & 0xffff;
+  d->device_id = id >> 16;
+  d->prog_if = class >> ((PCI_PROG_IF & 3) * 8);
+  d->subclass = class >> ((PCI_SUBCLASS & 3) * 8);
+  d->class = class >> ((PCI_CLASS & 3) * 8);
+}
@@ -0,0 +1,49 @@
+#ifndef DEVICES_PCI_H
+#define DEVICES_PCI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* A PCI function. */
+struct pci_dev
+  {
+    uint8_t bus;                /* Bus number. */
+    uint8_t slot;               /* Device number on the bus. */
+    uint8_t func;               /* Function number in the device. */
+    uint16_t vendor_id;         /* Vendor. */
+    uint16_t device_id;         /* Device, as numbered by the vendor. */
+    uint8_t class;              /* Base class, e.g. 0x01 for storage. */
+    uint8_t subclass;           /* Subclass, e.g. 0x01 for IDE. */
+    uint8_t prog_if;            /* Programming interface. */
+  };
+
+/* Configuration space registers. */
+#define PCI_COMMAND 0x04        /* Command (16 bits). */
+#define PCI_BAR0 0x10           /* Base address registers (32 bits each). */
+#define PCI_INTERRUPT_LINE 0x3c /* IRQ line (8 bits). */
+
+/* Command register bits. */
+#define PCI_COMMAND_IO 0x0001       /* Respond to I/O space accesses. */
+#define PCI_COMMAND_MEMORY 0x0002   /* Respond to memory space accesses. */
+#define PCI_COMMAND_MASTER 0x0004   /* Enable bus mastering. */
+
+void pci_init (void);
+
+const struct pci_dev *pci_find_class (uint8_t class, uint8_t subclass,
+                                      const struct pci_dev *prev);
+const struct pci_dev *pci_find_device (uint16_t vendor_id,
+                                       uint16_t device_id,
+                                       const struct pci_dev *prev);
+
+uint32_t pci_read_config (const struct pci_dev *, uint8_t reg);
+uint16_t pci_read_config16 (const struct pci_dev *, uint8_t reg);
+uint8_t pci_read_config8 (const struct pci_dev *, uint8_t reg);
+void pci_write_config (const struct pci_dev *, uint8_t reg, uint32_t);
+void pci_write_config16 (const struct pci_dev *, uint8_t reg, uint16_t);
+
+uint32_t pci_bar (const struct pci_dev *, int bar);
+void pci_enable (const struct pci_dev *, uint16_t command_bits);
+
+bool pci_dma_address (const void *, bool dev_writes, uint32_t *);
+
+#endif /* devices/pci.h */
@@ -11,9 +11,6 @@
 #define PIT_PORT_CONTROL          0x43                /* Control port. */
 #define PIT_PORT_COUNTER(CHANNEL) (0x40 + (CHANNEL))  /* Counter port. */
 
-/* PIT cycles per second. */
-#define PIT_HZ 1193180
-
 /* Configure the given CHANNEL in the PIT.  In a PC, the PIT's
    three output channels are hooked up like this:
 
@@ -81,3 +78,51 @@ pit_configure_channel (int channel, int mode, int frequency)
   outb (PIT_PORT_COUNTER (channel), count >> 8);
   intr_set_level (old_level);
 }
+
+/* Starts the given CHANNEL counting down COUNT PIT cycles in
+   mode 0, "interrupt on terminal count": the channel's output
+   goes low immediately and rises, raising the channel's
+   interrupt, once COUNT cycles have elapsed.  The channel does
+   not reload, so it fires only once until it is programmed
+   again.  A COUNT of 0 is treated as 65536. */
+void
+pit_start_oneshot (int channel, uint16_t count)
+{
+  enum intr_level old_level;
+
+  ASSERT (channel == 0 || channel == 2);
+
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, (channel << 6) | 0x30);
+  outb (PIT_PORT_COUNTER (channel), count);
+  outb (PIT_PORT_COUNTER (channel), count >> 8);
+  intr_set_level (old_level);
+}
+
+/* Latches and returns the current count of the given CHANNEL,
+   that is, the number of PIT cycles left before the channel's
+   output next changes.  If OUTPUT is nonnull, stores the state
+   of the channel's output pin in *OUTPUT, which for a channel in
+   mode 0 tells whether it has reached its terminal count. */
+uint16_t
+pit_read_count (int channel, bool *output)
+{
+  enum intr_level old_level;
+  uint8_t status, lo, hi;
+
+  ASSERT (channel == 0 || channel == 2);
+
+  /* Use the read-back command to latch the status and the count
+     of CHANNEL together, so that they describe the same
+     instant. */
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, 0xc0 | (2 << channel));
+  status = inb (PIT_PORT_COUNTER (channel));
+  lo = inb (PIT_PORT_COUNTER (channel));
+  hi = inb (PIT_PORT_COUNTER (channel));
+  intr_set_level (old_level);
+
+  if (output != NULL)
+    *output = (status & 0x80) != 0;
+  return lo | (hi << 8);
+}
@@ -5,13 +5,21 @@
 #include "devices/serial.h"
 #include "devices/timer.h"
 #include "threads/io.h"
+#include "threads/profile.h"
+#include "threads/sched-trace.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
+#include "threads/workqueue.h"
 #ifdef USERPROG
 #include "userprog/exception.h"
+#include "userprog/process.h"
 #endif
 #ifdef FILESYS
 #include "devices/block.h"
+#include "devices/ide.h"
+#include "filesys/directory.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 #endif
 
 /* Keyboard control register port. */
@@ -130,12 +138,22 @@ print_stats (void)
 {
   timer_print_stats ();
   thread_print_stats ();
+  workqueue_print_stats ();
+  sched_trace_print_stats ();
+  profile_print_stats ();
+#ifdef LOCK_PROFILE
+  lock_print_stats ();
+#endif
 #ifdef FILESYS
   block_print_stats ();
+  ide_print_stats ();
+  inode_print_stats ();
+  dir_print_stats ();
 #endif
   console_print_stats ();
   kbd_print_stats ();
 #ifdef USERPROG
   exception_print_stats ();
+  process_print_stats ();
 #endif
 }
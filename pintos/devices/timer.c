@@ -1,10 +1,13 @@
 #include "devices/timer.h"
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stdio.h>
 #include "devices/pit.h"
+#include "devices/tsc.h"
 #include "threads/interrupt.h"
+#include "threads/profile.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
   
@@ -20,6 +23,37 @@
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* Nanoseconds in one timer tick. */
+#define NS_PER_TICK (1000000000 / TIMER_FREQ)
+
+/* Reference point for timer_ns(): the TSC reading at the start
+   of tick number NS_BASE / NS_PER_TICK.  Set by timer_calibrate()
+   if the CPU has a usable TSC. */
+static uint64_t tsc_base;
+static int64_t ns_base;
+
+/* PIT cycles in one timer tick, as programmed by timer_init(). */
+#define CYCLES_PER_TICK ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+
+/* Threads sleeping in timer_sleep(), in order of increasing
+   wakeup_tick. */
+static struct list sleep_list;
+
+/* If false (kernel command-line option "-periodic"), the timer
+   always interrupts TIMER_FREQ times per second.
+   If true (default), the idle thread stops the periodic tick
+   while it waits for the next sleeping thread to wake up; see
+   timer_idle_enter(). */
+bool timer_tickless = true;
+
+/* Tickless idle state.  All of these are accessed only with
+   interrupts off. */
+static unsigned oneshot_cycles;   /* Programmed one-shot count, or 0. */
+static unsigned oneshot_phase;    /* Cycles since last tick at start. */
+static unsigned carry_cycles;     /* Unaccounted cycles from last exit. */
+static long long tickless_cnt;    /* # of one-shot intervals. */
+static long long skipped_ticks;   /* # of ticks without an interrupt. */
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
@@ -29,14 +63,22 @@ static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
 static void real_time_delay (int64_t num, int32_t denom);
+static bool wakeup_less (const struct list_elem *, const struct list_elem *,
+                         void *aux);
+static bool sleeper_due (void);
+static bool wake_sleeper (void);
+static void wake_sleepers (void);
+static softirq_func timer_softirq;
 
 /* Sets up the timer to interrupt TIMER_FREQ times per second,
    and registers the corresponding interrupt. */
 void
 timer_init (void) 
 {
+  list_init (&sleep_list);
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
+  intr_register_softirq (SOFTIRQ_TIMER, timer_softirq);
 }
 
 /* Calibrates loops_per_tick, used to implement brief delays. */
@@ -64,6 +106,24 @@ timer_calibrate (void)
       loops_per_tick |= test_bit;
 
   printf ("%'"PRIu64" loops/s.\n", (uint64_t) loops_per_tick * TIMER_FREQ);
+
+  /* Tie the high-resolution clock to the start of a tick, so that
+     timer_ns() never runs backward, then calibrate it.  In that
+     order, because timer_ns() uses TSC_BASE and NS_BASE as soon
+     as tsc_calibrate() has measured the TSC's rate. */
+  if (tsc_present ()) 
+    {
+      enum intr_level old_level;
+      int64_t start = ticks;
+
+      while (ticks == start)
+        barrier ();
+      old_level = intr_disable ();
+      tsc_base = tsc_read ();
+      ns_base = ticks * NS_PER_TICK;
+      intr_set_level (old_level);
+    }
+  tsc_calibrate ();
 }
 
 /* Returns the number of timer ticks since the OS booted. */
@@ -84,16 +144,37 @@ timer_elapsed (int64_t then)
   return timer_ticks () - then;
 }
 
+/* Returns the number of nanoseconds since the OS booted.  The
+   result never decreases.  Once timer_calibrate() has run, it is
+   based on the TSC and has a resolution far better than a timer
+   tick; before that, or on a CPU without a TSC, it advances one
+   tick at a time. */
+int64_t
+timer_ns (void) 
+{
+  if (tsc_calibrated ())
+    return ns_base + tsc_to_ns (tsc_read () - tsc_base);
+  else
+    return timer_ticks () * NS_PER_TICK;
+}
+
 /* Sleeps for approximately TICKS timer ticks.  Interrupts must
    be turned on. */
 void
 timer_sleep (int64_t ticks) 
 {
-  int64_t start = timer_ticks ();
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
 
   ASSERT (intr_get_level () == INTR_ON);
-  while (timer_elapsed (start) < ticks) 
-    thread_yield ();
+  if (ticks <= 0)
+    return;
+
+  old_level = intr_disable ();
+  cur->wakeup_tick = timer_ticks () + ticks;
+  list_insert_ordered (&sleep_list, &cur->elem, wakeup_less, NULL);
+  thread_block ();
+  intr_set_level (old_level);
 }
 
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
@@ -163,15 +244,175 @@ timer_ndelay (int64_t ns)
 void
 timer_print_stats (void) 
 {
-  printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
+  printf ("Timer: %"PRId64" ticks, %lld skipped in %lld tickless intervals\n",
+          timer_ticks (), skipped_ticks, tickless_cnt);
+}
+
+/* Called by the idle thread, with interrupts off, just before it
+   halts the CPU.  If tickless mode is enabled, stops the
+   periodic timer interrupt and instead programs the PIT to
+   interrupt once, at the tick when the first sleeping thread is
+   due to wake up or the first throttled EDF thread gets its
+   budget back.  Nothing else needs the tick while the CPU is
+   idle: there is no time slice to enforce and no run queue to
+   balance.
+
+   The PIT's 16-bit counter limits a one-shot interval to about
+   55 ms, so a CPU with no sleepers at all still wakes up every
+   few ticks.  Ticks that pass without an interrupt are accounted
+   by timer_idle_exit(). */
+void
+timer_idle_enter (void) 
+{
+  int64_t next = INT64_MAX;
+  unsigned remaining, max_skip, cycles;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (oneshot_cycles == 0);
+
+  if (!timer_tickless)
+    return;
+
+  if (!list_empty (&sleep_list))
+    next = list_entry (list_front (&sleep_list),
+                       struct thread, elem)->wakeup_tick;
+  if (thread_next_release () < next)
+    next = thread_next_release ();
+  if (next - ticks <= 1)
+    return;
+
+  /* End the interval on a tick boundary, so that the tick that
+     wakes the sleeper falls where it would in periodic mode. */
+  remaining = pit_read_count (0, NULL);
+  if (remaining == 0 || remaining > CYCLES_PER_TICK)
+    return;
+  max_skip = (UINT16_MAX - remaining) / CYCLES_PER_TICK;
+  if (max_skip == 0)
+    return;
+  if (next - ticks - 1 < max_skip)
+    max_skip = next - ticks - 1;
+  cycles = remaining + max_skip * CYCLES_PER_TICK;
+
+  oneshot_cycles = cycles;
+  oneshot_phase = CYCLES_PER_TICK - remaining + carry_cycles;
+  tickless_cnt++;
+  pit_start_oneshot (0, cycles);
+}
+
+/* Leaves tickless mode, if the CPU is in it: accounts for the
+   timer ticks that passed while the PIT was in one-shot mode,
+   wakes any threads whose sleep ended during them (or, in the
+   timer interrupt, leaves that to its softirq), and restarts the
+   periodic tick.  Called with interrupts off, both by the
+   timer interrupt handler and by the idle thread when some other
+   interrupt woke the CPU early.
+
+   Restarting the periodic tick discards the part of the current
+   tick that has already elapsed, so that part is carried over
+   into the next tickless interval to keep the tick count from
+   drifting behind real time. */
+void
+timer_idle_exit (void) 
+{
+  unsigned elapsed, skipped;
+  uint16_t count;
+  bool fired;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (oneshot_cycles == 0)
+    return;
+
+  /* Once the one-shot count expires, the channel's output stays
+     high and its interrupt is either being handled or pending,
+     and that interrupt accounts for the final tick itself. */
+  count = pit_read_count (0, &fired);
+  elapsed = oneshot_phase + (fired ? oneshot_cycles : oneshot_cycles - count);
+  skipped = elapsed / CYCLES_PER_TICK;
+  if (fired)
+    skipped--;
+  carry_cycles = elapsed % CYCLES_PER_TICK;
+  oneshot_cycles = 0;
+
+  pit_configure_channel (0, 2, TIMER_FREQ);
+  ticks += skipped;
+  skipped_ticks += skipped;
+  thread_account_idle (skipped);
+  if (!intr_context ())
+    wake_sleepers ();
 }
 
 /* Timer interrupt handler. */
 static void
-timer_interrupt (struct intr_frame *args UNUSED)
+timer_interrupt (struct intr_frame *args)
 {
+  timer_idle_exit ();
   ticks++;
   thread_tick ();
+  if (profile_interval != 0)
+    profile_tick (args);
+  if (sleeper_due ())
+    intr_raise_softirq (SOFTIRQ_TIMER);
+}
+
+/* Timer softirq: wakes the threads whose sleep has ended, with
+   interrupts enabled between one wakeup and the next. */
+static void
+timer_softirq (void)
+{
+  bool woke;
+
+  do
+    {
+      enum intr_level old_level = intr_disable ();
+      woke = wake_sleeper ();
+      intr_set_level (old_level);
+    }
+  while (woke);
+}
+
+/* Returns true if the thread containing A_ is due to wake up
+   before the one containing B_. */
+static bool
+wakeup_less (const struct list_elem *a_, const struct list_elem *b_,
+             void *aux UNUSED) 
+{
+  const struct thread *a = list_entry (a_, struct thread, elem);
+  const struct thread *b = list_entry (b_, struct thread, elem);
+
+  return a->wakeup_tick < b->wakeup_tick;
+}
+
+/* Returns true if the first sleeping thread's wakeup tick has
+   come.  Must be called with interrupts off. */
+static bool
+sleeper_due (void) 
+{
+  return (!list_empty (&sleep_list)
+          && list_entry (list_front (&sleep_list),
+                         struct thread, elem)->wakeup_tick <= ticks);
+}
+
+/* Unblocks the first sleeping thread, if its wakeup tick has
+   come, and returns true; otherwise returns false.  Must be
+   called with interrupts off. */
+static bool
+wake_sleeper (void) 
+{
+  if (!sleeper_due ())
+    return false;
+  thread_unblock (list_entry (list_pop_front (&sleep_list),
+                              struct thread, elem));
+  return true;
+}
+
+/* Unblocks every sleeping thread whose wakeup tick has come.
+   Must be called with interrupts off. */
+static void
+wake_sleepers (void) 
+{
+  while (wake_sleeper ())
+    continue;
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
@@ -207,7 +448,10 @@ busy_wait (int64_t loops)
     barrier ();
 }
 
-/* Sleep for approximately NUM/DENOM seconds. */
+/* Sleep for approximately NUM/DENOM seconds, rounded up to a
+   whole number of timer ticks.  Callers that need a delay
+   shorter than a tick should busy-wait with timer_udelay() or
+   timer_ndelay() instead. */
 static void
 real_time_sleep (int64_t num, int32_t denom) 
 {
@@ -220,19 +464,15 @@ real_time_sleep (int64_t num, int32_t denom)
   int64_t ticks = num * TIMER_FREQ / denom;
 
   ASSERT (intr_get_level () == INTR_ON);
-  if (ticks > 0)
-    {
-      /* We're waiting for at least one full timer tick.  Use
-         timer_sleep() because it will yield the CPU to other
-         processes. */                
-      timer_sleep (ticks); 
-    }
-  else 
+  if (ticks * denom < num * TIMER_FREQ)
     {
-      /* Otherwise, use a busy-wait loop for more accurate
-         sub-tick timing. */
-      real_time_delay (num, denom); 
+      /* Round a partial tick up to a whole one rather than
+         busy-waiting for it, so that even sub-tick sleeps give
+         the CPU to other threads.  The sleep ends at the first
+         timer tick at or after the requested time. */
+      ticks++;
     }
+  timer_sleep (ticks);
 }
 
 /* Busy-wait for approximately NUM/DENOM seconds. */
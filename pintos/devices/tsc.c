@@ -0,0 +1,98 @@
+#include "devices/tsc.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+
+/* Time-stamp counter clocksource.
+
+   The TSC counts CPU cycles, so it has a resolution of a
+   nanosecond or better, but its rate is not known in advance.
+   tsc_calibrate() measures it against the timer interrupt, which
+   the 8254 PIT drives at a known rate. */
+
+/* Number of timer ticks to measure the TSC over.  Longer
+   measurements are more accurate but slow down booting. */
+#define CALIBRATE_TICKS 10
+
+/* TSC cycles per second, or 0 if the TSC is not usable. */
+static uint64_t cycles_per_sec;
+
+/* Measures the rate of the TSC, if the CPU has one.  Once this
+   returns, tsc_calibrated() is true and clients may start using
+   the TSC, so they must have set up anything that they base on
+   it first.  Interrupts must be turned on. */
+void
+tsc_calibrate (void) 
+{
+  enum intr_level old_level;
+  int64_t start;
+  uint64_t tsc_start, tsc_end;
+
+  ASSERT (intr_get_level () == INTR_ON);
+  if (!tsc_present ())
+    {
+      printf ("No time-stamp counter, using timer ticks for timing.\n");
+      return;
+    }
+
+  /* Start and stop counting at the edge of a timer tick. */
+  start = timer_ticks ();
+  while (timer_ticks () == start)
+    barrier ();
+  tsc_start = tsc_read ();
+  start++;
+  while (timer_ticks () < start + CALIBRATE_TICKS)
+    barrier ();
+  tsc_end = tsc_read ();
+
+  /* Storing a 64-bit value takes two instructions, so keep an
+     interrupt handler from seeing half of it. */
+  old_level = intr_disable ();
+  cycles_per_sec = (tsc_end - tsc_start) * TIMER_FREQ / CALIBRATE_TICKS;
+  intr_set_level (old_level);
+  printf ("Time-stamp counter runs at %'"PRIu64" Hz.\n", cycles_per_sec);
+}
+
+/* Returns true if tsc_calibrate() found a usable TSC. */
+bool
+tsc_calibrated (void) 
+{
+  return cycles_per_sec != 0;
+}
+
+/* Returns the number of TSC cycles per second, or 0 if the TSC
+   has not been calibrated. */
+uint64_t
+tsc_hz (void) 
+{
+  return cycles_per_sec;
+}
+
+/* Converts CYCLES, a difference between two TSC readings, into
+   nanoseconds.  The TSC must have been calibrated. */
+uint64_t
+tsc_to_ns (uint64_t cycles) 
+{
+  /* Split CYCLES into whole seconds and a remainder, so that
+     multiplying by 10**9 cannot overflow for any plausible CPU
+     clock rate. */
+  uint64_t secs = cycles / cycles_per_sec;
+  uint64_t rem = cycles % cycles_per_sec;
+
+  ASSERT (cycles_per_sec != 0);
+  return secs * 1000000000 + rem * 1000000000 / cycles_per_sec;
+}
+
+/* Returns true if the CPU has a time-stamp counter, according to
+   CPUID.  See [IA32-v2a] "CPUID". */
+bool
+tsc_present (void) 
+{
+  uint32_t eax, ebx, ecx, edx;
+
+  asm ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (1));
+  return (edx & (1u << 4)) != 0;
+}
@@ -0,0 +1,23 @@
+#ifndef DEVICES_TSC_H
+#define DEVICES_TSC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Reads the CPU's time-stamp counter, which counts processor
+   cycles since reset.  See [IA32-v2b] "RDTSC". */
+static inline uint64_t
+tsc_read (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+bool tsc_present (void);
+void tsc_calibrate (void);
+bool tsc_calibrated (void);
+uint64_t tsc_hz (void);
+uint64_t tsc_to_ns (uint64_t cycles);
+
+#endif /* devices/tsc.h */
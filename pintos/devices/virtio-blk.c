@@ -0,0 +1,588 @@
+#include "devices/virtio-blk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "devices/partition.h"
+#include "devices/pci.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* The code in this file is a driver for legacy (virtio 0.9.5)
+   PCI block devices, which QEMU attaches with "-drive
+   if=virtio".  Each request is a chain of descriptors in a
+   virtqueue shared with the device: a header naming the
+   operation and sector, the data, and a status byte that the
+   device fills in.  Several requests may be in the queue at
+   once.  The device interrupts when it has finished some, and
+   a softirq wakes the threads waiting for them. */
+
+/* PCI IDs of a legacy or transitional virtio block device. */
+#define VIRTIO_VENDOR_ID 0x1af4
+#define VIRTIO_BLK_DEVICE_ID 0x1001
+
+/* Legacy virtio registers, relative to the I/O BAR. */
+#define VIRTIO_DEVICE_FEATURES 0x00     /* Device features (32 bits). */
+#define VIRTIO_GUEST_FEATURES 0x04      /* Driver features (32 bits). */
+#define VIRTIO_QUEUE_PFN 0x08           /* Queue page number (32 bits). */
+#define VIRTIO_QUEUE_SIZE 0x0c          /* Queue size (16 bits). */
+#define VIRTIO_QUEUE_SELECT 0x0e        /* Queue selector (16 bits). */
+#define VIRTIO_QUEUE_NOTIFY 0x10        /* Queue notifier (16 bits). */
+#define VIRTIO_STATUS 0x12              /* Device status (8 bits). */
+#define VIRTIO_ISR 0x13                 /* ISR status, read clears (8 bits). */
+#define VIRTIO_BLK_CAPACITY 0x14        /* Sectors (64 bits). */
+
+/* Device status bits. */
+#define STATUS_ACKNOWLEDGE 0x01         /* Driver found the device. */
+#define STATUS_DRIVER 0x02              /* Driver can drive it. */
+#define STATUS_DRIVER_OK 0x04           /* Driver is ready. */
+#define STATUS_FAILED 0x80              /* Driver gave up. */
+
+/* ISR status bit: the device used some buffers. */
+#define ISR_QUEUE 0x01
+
+/* Legacy virtqueues are aligned to this many bytes. */
+#define VRING_ALIGN 4096
+
+/* A descriptor: one buffer of a request. */
+struct vring_desc
+  {
+    uint64_t addr;              /* Physical address. */
+    uint32_t len;               /* Length in bytes. */
+    uint16_t flags;             /* VRING_DESC_F_*. */
+    uint16_t next;              /* Next descriptor, if F_NEXT. */
+  };
+#define VRING_DESC_F_NEXT 0x01  /* NEXT is valid. */
+#define VRING_DESC_F_WRITE 0x02 /* Device writes the buffer. */
+
+/* Ring of requests made available to the device. */
+struct vring_avail
+  {
+    uint16_t flags;             /* Zero: interrupt when used. */
+    uint16_t idx;               /* Next RING element to fill. */
+    uint16_t ring[];            /* First descriptors of requests. */
+  };
+
+/* A request the device has finished with. */
+struct vring_used_elem
+  {
+    uint32_t id;                /* Request's first descriptor. */
+    uint32_t len;               /* Bytes the device wrote. */
+  };
+
+/* Ring of requests the device has finished with. */
+struct vring_used
+  {
+    uint16_t flags;             /* Set by device. */
+    uint16_t idx;               /* Next RING element the device fills. */
+    struct vring_used_elem ring[];
+  };
+
+/* Header of a block request. */
+struct virtio_blk_header
+  {
+    uint32_t type;              /* VIRTIO_BLK_T_*. */
+    uint32_t reserved;          /* Zero. */
+    uint64_t sector;            /* First sector. */
+  };
+#define VIRTIO_BLK_T_IN 0       /* Read. */
+#define VIRTIO_BLK_T_OUT 1      /* Write. */
+#define VIRTIO_BLK_S_OK 0       /* Status of a successful request. */
+
+/* Maximum number of sectors in one request.  The data then
+   spans at most REQUEST_SEGS pages. */
+#define REQUEST_SECTORS 64
+#define REQUEST_SEGS (REQUEST_SECTORS * BLOCK_SECTOR_SIZE / PGSIZE + 1)
+
+/* Descriptors per request: header, data segments, status.  A
+   request in slot N uses descriptors N * DESCS_PER_REQUEST
+   through (N + 1) * DESCS_PER_REQUEST - 1. */
+#define DESCS_PER_REQUEST (REQUEST_SEGS + 2)
+
+/* Maximum number of requests in the queue at once. */
+#define SLOT_MAX 16
+
+/* Parts of a request slot that the device reads or writes. */
+struct slot_dma
+  {
+    struct virtio_blk_header header;
+    uint8_t status;
+  };
+
+/* A request slot. */
+struct slot
+  {
+    bool busy;                  /* In use?  Protected by LOCK. */
+    struct semaphore done;      /* Up'd when the device finishes. */
+  };
+
+/* A virtio block device. */
+struct virtio_blk
+  {
+    char name[8];               /* Name, e.g. "vda". */
+    uint16_t base;              /* Base I/O port. */
+    uint8_t irq;                /* Interrupt vector. */
+
+    /* Virtqueue, in pages that the device shares. */
+    void *queue;                /* Pages holding the virtqueue. */
+    size_t queue_pages;         /* Number of pages at QUEUE. */
+    uint16_t queue_size;        /* Number of descriptors. */
+    struct vring_desc *desc;    /* Descriptor table. */
+    struct vring_avail *avail;  /* Available ring. */
+    struct vring_used *used;    /* Used ring. */
+    uint16_t last_used;         /* Next used ring element to reap. */
+
+    /* Request slots. */
+    struct lock lock;           /* Protects AVAIL and slots' BUSY. */
+    struct semaphore free_slots; /* Counts slots not busy. */
+    size_t slot_cnt;            /* Number of slots. */
+    struct slot slots[SLOT_MAX];
+    struct slot_dma *dma;       /* Page of SLOT_CNT headers and statuses. */
+
+    /* For buffers that a bus master cannot reach. */
+    struct lock bounce_lock;    /* Protects BOUNCE. */
+    void *bounce;               /* One page. */
+  };
+
+/* Virtio block devices found. */
+#define VIRTIO_BLK_MAX 4
+static struct virtio_blk *devs[VIRTIO_BLK_MAX];
+static size_t dev_cnt;
+
+static struct block_operations virtio_blk_operations;
+
+static struct virtio_blk *setup_device (const struct pci_dev *);
+static bool setup_queue (struct virtio_blk *);
+static void transfer (struct virtio_blk *, block_sector_t, size_t cnt,
+                      void *buffer, bool write);
+static void bounce_transfer (struct virtio_blk *, block_sector_t,
+                             size_t cnt, void *buffer, bool write);
+static int submit (struct virtio_blk *, block_sector_t, size_t cnt,
+                   void *buffer, bool write);
+static void finish (struct virtio_blk *, int slot);
+static void release_slot (struct virtio_blk *, int slot);
+
+static void interrupt_handler (struct intr_frame *);
+static softirq_func completion_softirq;
+
+/* Finds the virtio block devices on the PCI bus and registers
+   them with the block layer. */
+void
+virtio_blk_init (void)
+{
+  const struct pci_dev *pci;
+
+  intr_register_softirq (SOFTIRQ_VIRTIO, completion_softirq);
+  for (pci = pci_find_device (VIRTIO_VENDOR_ID, VIRTIO_BLK_DEVICE_ID, NULL);
+       pci != NULL;
+       pci = pci_find_device (VIRTIO_VENDOR_ID, VIRTIO_BLK_DEVICE_ID, pci))
+    {
+      struct virtio_blk *vb;
+      block_sector_t capacity;
+      char extra_info[32];
+      struct block *block;
+      size_t i;
+
+      if (dev_cnt >= VIRTIO_BLK_MAX)
+        {
+          printf ("virtio-blk: too many devices\n");
+          break;
+        }
+      vb = setup_device (pci);
+      if (vb == NULL)
+        continue;
+
+      /* Devices may share an interrupt line, so register the
+         handler once per vector. */
+      for (i = 0; i < dev_cnt; i++)
+        if (devs[i]->irq == vb->irq)
+          break;
+      if (i == dev_cnt)
+        intr_register_ext (vb->irq, interrupt_handler, "virtio-blk");
+      devs[dev_cnt++] = vb;
+
+      /* Register. */
+      capacity = inl (vb->base + VIRTIO_BLK_CAPACITY);
+      snprintf (extra_info, sizeof extra_info, "virtio, %u requests",
+                (unsigned) vb->slot_cnt);
+      block = block_register (vb->name, BLOCK_RAW, extra_info, capacity,
+                              &virtio_blk_operations, vb);
+      partition_scan (block);
+    }
+}
+
+/* Initializes the device at PCI and returns it, or returns a
+   null pointer and leaves the device failed if it is not
+   usable. */
+static struct virtio_blk *
+setup_device (const struct pci_dev *pci)
+{
+  struct virtio_blk *vb;
+  uint8_t line;
+
+  line = pci_read_config8 (pci, PCI_INTERRUPT_LINE);
+  if (line >= 16 || (pci_bar (pci, 0) & 0xffff) == 0)
+    return NULL;
+
+  vb = calloc (1, sizeof *vb);
+  if (vb == NULL)
+    return NULL;
+  snprintf (vb->name, sizeof vb->name, "vd%c", 'a' + (int) dev_cnt);
+  vb->base = pci_bar (pci, 0);
+  vb->irq = 0x20 + line;
+  lock_init (&vb->lock);
+  lock_init (&vb->bounce_lock);
+  pci_enable (pci, PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+
+  /* Reset the device, then tell it we will drive it.  We use
+     none of the optional features. */
+  outb (vb->base + VIRTIO_STATUS, 0);
+  outb (vb->base + VIRTIO_STATUS, STATUS_ACKNOWLEDGE);
+  outb (vb->base + VIRTIO_STATUS, STATUS_ACKNOWLEDGE | STATUS_DRIVER);
+  outl (vb->base + VIRTIO_GUEST_FEATURES, 0);
+
+  vb->dma = palloc_get_page (PAL_ZERO);
+  vb->bounce = palloc_get_page (0);
+  if (vb->dma == NULL || vb->bounce == NULL || !setup_queue (vb))
+    {
+      printf ("%s: cannot set up device\n", vb->name);
+      outb (vb->base + VIRTIO_STATUS, STATUS_FAILED);
+      palloc_free_page (vb->dma);
+      palloc_free_page (vb->bounce);
+      free (vb);
+      return NULL;
+    }
+
+  outb (vb->base + VIRTIO_STATUS,
+        STATUS_ACKNOWLEDGE | STATUS_DRIVER | STATUS_DRIVER_OK);
+  return vb;
+}
+
+/* Allocates VB's virtqueue, gives it to the device, and divides
+   its descriptors into request slots.  Returns true if
+   successful. */
+static bool
+setup_queue (struct virtio_blk *vb)
+{
+  size_t avail_end, used_ofs, size, i;
+
+  outw (vb->base + VIRTIO_QUEUE_SELECT, 0);
+  vb->queue_size = inw (vb->base + VIRTIO_QUEUE_SIZE);
+  vb->slot_cnt = vb->queue_size / DESCS_PER_REQUEST;
+  if (vb->slot_cnt == 0)
+    return false;
+  if (vb->slot_cnt > SLOT_MAX)
+    vb->slot_cnt = SLOT_MAX;
+
+  /* The used ring starts at the first VRING_ALIGN boundary
+     after the descriptors and the available ring. */
+  avail_end = (sizeof (struct vring_desc) * vb->queue_size
+               + sizeof (struct vring_avail)
+               + sizeof (uint16_t) * (vb->queue_size + 1));
+  used_ofs = ROUND_UP (avail_end, VRING_ALIGN);
+  size = used_ofs + (sizeof (struct vring_used)
+                     + sizeof (struct vring_used_elem) * vb->queue_size
+                     + sizeof (uint16_t));
+  vb->queue_pages = DIV_ROUND_UP (size, PGSIZE);
+
+  /* Pages from the kernel pool are physically contiguous. */
+  vb->queue = palloc_get_multiple (PAL_ZERO, vb->queue_pages);
+  if (vb->queue == NULL)
+    return false;
+  vb->desc = vb->queue;
+  vb->avail = (struct vring_avail *) ((uint8_t *) vb->queue
+                                      + sizeof (struct vring_desc)
+                                        * vb->queue_size);
+  vb->used = (struct vring_used *) ((uint8_t *) vb->queue + used_ofs);
+  vb->last_used = 0;
+
+  sema_init (&vb->free_slots, vb->slot_cnt);
+  for (i = 0; i < vb->slot_cnt; i++)
+    {
+      vb->slots[i].busy = false;
+      sema_init (&vb->slots[i].done, 0);
+    }
+
+  outl (vb->base + VIRTIO_QUEUE_PFN, vtop (vb->queue) / PGSIZE);
+  return true;
+}
+
+/* Reads sector SECTOR from device VB into BUFFER. */
+static void
+virtio_blk_read (void *vb, block_sector_t sector, void *buffer)
+{
+  transfer (vb, sector, 1, buffer, false);
+}
+
+/* Writes sector SECTOR to device VB from BUFFER.  Returns after
+   the device has acknowledged receiving the data. */
+static void
+virtio_blk_write (void *vb, block_sector_t sector, const void *buffer)
+{
+  transfer (vb, sector, 1, (void *) buffer, true);
+}
+
+/* Reads CNT sectors starting at SECTOR from device VB into
+   BUFFER. */
+static void
+virtio_blk_read_multiple (void *vb, block_sector_t sector, size_t cnt,
+                          void *buffer)
+{
+  transfer (vb, sector, cnt, buffer, false);
+}
+
+/* Writes CNT sectors starting at SECTOR to device VB from
+   BUFFER.  Returns after the device has acknowledged receiving
+   all of the data. */
+static void
+virtio_blk_write_multiple (void *vb, block_sector_t sector, size_t cnt,
+                           const void *buffer)
+{
+  transfer (vb, sector, cnt, (void *) buffer, true);
+}
+
+static struct block_operations virtio_blk_operations =
+  {
+    virtio_blk_read,
+    virtio_blk_write,
+    virtio_blk_read_multiple,
+    virtio_blk_write_multiple
+  };
+
+/* Transfers CNT sectors between device VB, starting at SECTOR,
+   and BUFFER, to the device if WRITE is true and from it
+   otherwise.  Splits the transfer into requests of at most
+   REQUEST_SECTORS sectors and queues as many of them at once as
+   there are free slots.  Returns when all of them are done.
+   Internally synchronizes accesses to the device, so external
+   locking is unneeded.
+
+   A transfer never sleeps waiting for a slot while it holds
+   others: two transfers could then each wait for the slots the
+   other holds.  It finishes its own oldest request instead. */
+static void
+transfer (struct virtio_blk *vb, block_sector_t sector, size_t cnt,
+          void *buffer_, bool write)
+{
+  uint8_t *buffer = buffer_;
+  int queued[SLOT_MAX];         /* Slots not yet finished, oldest first. */
+  size_t head = 0, tail = 0;
+
+  while (cnt > 0)
+    {
+      size_t n = cnt < REQUEST_SECTORS ? cnt : REQUEST_SECTORS;
+      int slot;
+
+      while (!sema_try_down (&vb->free_slots))
+        {
+          if (head == tail)
+            {
+              sema_down (&vb->free_slots);
+              break;
+            }
+          finish (vb, queued[head++ % SLOT_MAX]);
+        }
+
+      slot = submit (vb, sector, n, buffer, write);
+      if (slot >= 0)
+        queued[tail++ % SLOT_MAX] = slot;
+      else
+        {
+          /* The bounce buffer waits for slots, so hold none. */
+          while (head != tail)
+            finish (vb, queued[head++ % SLOT_MAX]);
+          bounce_transfer (vb, sector, n, buffer, write);
+        }
+
+      sector += n;
+      buffer += n * BLOCK_SECTOR_SIZE;
+      cnt -= n;
+    }
+  while (head != tail)
+    finish (vb, queued[head++ % SLOT_MAX]);
+}
+
+/* Transfers CNT sectors between device VB, starting at SECTOR,
+   and BUFFER, as transfer() does, but copies the data through
+   VB's bounce page, for a BUFFER that the device cannot reach
+   directly.  Copying may fault in BUFFER's pages.  The caller
+   must not hold any of VB's slots. */
+static void
+bounce_transfer (struct virtio_blk *vb, block_sector_t sector, size_t cnt,
+                 void *buffer_, bool write)
+{
+  uint8_t *buffer = buffer_;
+
+  lock_acquire (&vb->bounce_lock);
+  while (cnt > 0)
+    {
+      size_t n = PGSIZE / BLOCK_SECTOR_SIZE;
+      if (n > cnt)
+        n = cnt;
+
+      if (write)
+        memcpy (vb->bounce, buffer, n * BLOCK_SECTOR_SIZE);
+      sema_down (&vb->free_slots);
+      finish (vb, submit (vb, sector, n, vb->bounce, write));
+      if (!write)
+        memcpy (buffer, vb->bounce, n * BLOCK_SECTOR_SIZE);
+
+      sector += n;
+      buffer += n * BLOCK_SECTOR_SIZE;
+      cnt -= n;
+    }
+  lock_release (&vb->bounce_lock);
+}
+
+/* Queues a request to transfer CNT sectors, at most
+   REQUEST_SECTORS, between device VB, starting at SECTOR, and
+   BUFFER, and returns its slot, which the caller must pass to
+   finish().  The caller must already have reserved a slot by
+   downing VB's FREE_SLOTS.  Returns -1, and gives the slot back,
+   without queuing anything if part of BUFFER has no physical
+   address, or is read-only and the device would write to it
+   because WRITE is false. */
+static int
+submit (struct virtio_blk *vb, block_sector_t sector, size_t cnt,
+        void *buffer, bool write)
+{
+  uint8_t *p = buffer;
+  size_t size = cnt * BLOCK_SECTOR_SIZE;
+  struct vring_desc *desc;
+  struct slot_dma *dma;
+  uint16_t first;
+  int slot;
+  size_t i;
+
+  ASSERT (cnt > 0 && cnt <= REQUEST_SECTORS);
+
+  /* Take the free slot reserved by the caller. */
+  lock_acquire (&vb->lock);
+  for (slot = 0; vb->slots[slot].busy; slot++)
+    ASSERT ((size_t) slot < vb->slot_cnt);
+  vb->slots[slot].busy = true;
+  lock_release (&vb->lock);
+
+  first = slot * DESCS_PER_REQUEST;
+  desc = &vb->desc[first];
+  dma = &vb->dma[slot];
+
+  /* Header. */
+  dma->header.type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+  dma->header.reserved = 0;
+  dma->header.sector = sector;
+  desc[0].addr = vtop (&dma->header);
+  desc[0].len = sizeof dma->header;
+  desc[0].flags = VRING_DESC_F_NEXT;
+  desc[0].next = first + 1;
+
+  /* Data, one descriptor per page or part of a page. */
+  for (i = 1; size > 0; i++)
+    {
+      size_t chunk = PGSIZE - pg_ofs (p);
+      uint32_t addr;
+
+      ASSERT (i <= REQUEST_SEGS);
+      if (chunk > size)
+        chunk = size;
+      if (!pci_dma_address (p, !write, &addr))
+        {
+          release_slot (vb, slot);
+          return -1;
+        }
+      desc[i].addr = addr;
+      desc[i].len = chunk;
+      desc[i].flags = VRING_DESC_F_NEXT | (write ? 0 : VRING_DESC_F_WRITE);
+      desc[i].next = first + i + 1;
+
+      p += chunk;
+      size -= chunk;
+    }
+
+  /* Status. */
+  dma->status = 0xff;
+  desc[i].addr = vtop (&dma->status);
+  desc[i].len = sizeof dma->status;
+  desc[i].flags = VRING_DESC_F_WRITE;
+  desc[i].next = 0;
+
+  /* Make the request available, then tell the device.  The
+     device must see the ring entry before the new index. */
+  lock_acquire (&vb->lock);
+  vb->avail->ring[vb->avail->idx % vb->queue_size] = first;
+  barrier ();
+  vb->avail->idx++;
+  barrier ();
+  outw (vb->base + VIRTIO_QUEUE_NOTIFY, 0);
+  lock_release (&vb->lock);
+
+  return slot;
+}
+
+/* Waits for the request in SLOT of device VB to finish, checks
+   its status, and frees the slot. */
+static void
+finish (struct virtio_blk *vb, int slot)
+{
+  struct slot_dma *dma = &vb->dma[slot];
+
+  sema_down (&vb->slots[slot].done);
+  if (dma->status != VIRTIO_BLK_S_OK)
+    PANIC ("%s: %s failed, sector=%llu, status=%d", vb->name,
+           dma->header.type == VIRTIO_BLK_T_OUT ? "write" : "read",
+           dma->header.sector, dma->status);
+  release_slot (vb, slot);
+}
+
+/* Returns SLOT of device VB to the free slots. */
+static void
+release_slot (struct virtio_blk *vb, int slot)
+{
+  lock_acquire (&vb->lock);
+  vb->slots[slot].busy = false;
+  lock_release (&vb->lock);
+  sema_up (&vb->free_slots);
+}
+
+/* Virtio interrupt handler.  Acknowledges the interrupt for
+   every device on the line, which also lowers the line, and
+   leaves reaping finished requests to the virtio softirq. */
+static void
+interrupt_handler (struct intr_frame *f)
+{
+  size_t i;
+
+  for (i = 0; i < dev_cnt; i++)
+    if (devs[i]->irq == f->vec_no
+        && (inb (devs[i]->base + VIRTIO_ISR) & ISR_QUEUE))
+      intr_raise_softirq (SOFTIRQ_VIRTIO);
+}
+
+/* Virtio softirq: wakes up the threads whose requests the
+   devices have finished. */
+static void
+completion_softirq (void)
+{
+  size_t i;
+
+  for (i = 0; i < dev_cnt; i++)
+    {
+      struct virtio_blk *vb = devs[i];
+
+      while (vb->last_used != vb->used->idx)
+        {
+          struct vring_used_elem *e;
+
+          /* Read the element only after seeing the index. */
+          barrier ();
+          e = &vb->used->ring[vb->last_used % vb->queue_size];
+          vb->last_used++;
+          sema_up (&vb->slots[e->id / DESCS_PER_REQUEST].done);
+        }
+    }
+}
@@ -0,0 +1,80 @@
+/* pmatmult.c
+
+   Matrix multiplication, like matmult, but split across several
+   threads of one process, each computing a band of rows of the
+   result.  Prints how long the multiplication took, so that it
+   can be compared with different thread counts:
+
+        pmatmult [THREADS] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+
+#define DIM 128
+#define MAX_THREADS 16
+
+int A[DIM][DIM];
+int B[DIM][DIM];
+int C[DIM][DIM];
+
+static int thread_cnt;
+
+/* Computes the band of rows of C numbered BAND_. */
+static void
+multiply_band (void *band_)
+{
+  int band = (int) band_;
+  int first = band * DIM / thread_cnt;
+  int last = (band + 1) * DIM / thread_cnt;
+  int i, j, k;
+
+  for (i = first; i < last; i++)
+    for (j = 0; j < DIM; j++)
+      for (k = 0; k < DIM; k++)
+	C[i][j] += A[i][k] * B[k][j];
+}
+
+int
+main (int argc, char *argv[])
+{
+  tid_t tids[MAX_THREADS];
+  int64_t start;
+  int i, j;
+
+  thread_cnt = argc > 1 ? atoi (argv[1]) : 4;
+  if (thread_cnt < 1 || thread_cnt > MAX_THREADS)
+    {
+      printf ("pmatmult: thread count must be 1 to %d\n", MAX_THREADS);
+      return EXIT_FAILURE;
+    }
+
+  /* Initialize the matrices. */
+  for (i = 0; i < DIM; i++)
+    for (j = 0; j < DIM; j++)
+      {
+	A[i][j] = i;
+	B[i][j] = j;
+	C[i][j] = 0;
+      }
+
+  /* Multiply matrices.  The main thread takes band 0. */
+  start = clock_ns ();
+  for (i = 1; i < thread_cnt; i++)
+    {
+      tids[i] = thread_create (multiply_band, (void *) i);
+      if (tids[i] == TID_ERROR)
+        {
+          printf ("pmatmult: thread_create failed\n");
+          return EXIT_FAILURE;
+        }
+    }
+  multiply_band ((void *) 0);
+  for (i = 1; i < thread_cnt; i++)
+    thread_join (tids[i]);
+  printf ("pmatmult: %d threads: %lld us\n",
+          thread_cnt, (clock_ns () - start) / 1000);
+
+  /* Done. */
+  exit (C[DIM - 1][DIM - 1]);
+}
@@ -0,0 +1,521 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Buffer cache.
+
+   Holds CACHE_SIZE sectors of the file system device, so that
+   the file system reads and writes memory rather than the disk
+   when it touches the same sectors again, as directory lookups
+   and small writes do.  Entries are replaced in clock order.
+
+   Writes only dirty the cached copy.  A flush thread writes
+   dirty sectors back every CACHE_FLUSH_TICKS, and
+   filesys_done() flushes the rest at shutdown.  A read-ahead
+   thread fetches sectors that cache_readahead() predicts will be
+   read next, so that sequential reads find them cached.  Both
+   threads submit their I/O asynchronously, several sectors at a
+   time, so that the block layer can sort and merge it.
+
+   CACHE_LOCK protects the mapping from sectors to entries, the
+   USERS counts and the clock hand.  Each entry's LOCK protects
+   its data and DIRTY flag, and is held across the disk I/O that
+   fills or cleans the entry.  An entry with USERS > 0 is never
+   evicted.
+
+   A dirty victim is written back after CACHE_LOCK is released,
+   under the victim's own lock only, so that the write does not
+   hold up lookups of other sectors.  Until the write finishes,
+   the entry is marked WRITING_BACK and its OLD_SECTOR counts as
+   cached, so no one reads that sector's stale contents from
+   disk meanwhile. */
+
+/* Number of sectors cached. */
+#define CACHE_SIZE 64
+
+/* Timer ticks between write-behind flushes. */
+#define CACHE_FLUSH_TICKS (5 * TIMER_FREQ)
+
+/* Maximum number of queued read-ahead requests. */
+#define READAHEAD_MAX 16
+
+/* Maximum number of write-backs cache_flush() keeps in flight. */
+#define FLUSH_BATCH 16
+
+/* A cached sector. */
+struct cache_entry
+  {
+    block_sector_t sector;      /* Sector cached here. */
+    bool valid;                 /* Holds a sector? */
+    bool accessed;              /* Used since the clock hand passed? */
+    int users;                  /* Threads using the entry. */
+    struct lock lock;           /* Protects DATA and DIRTY. */
+    bool dirty;                 /* DATA newer than the disk? */
+    bool writing_back;          /* Writing OLD_SECTOR back? */
+    block_sector_t old_sector;  /* Previous sector, if WRITING_BACK. */
+    struct block_request req;   /* For asynchronous reads and writes. */
+    uint8_t data[BLOCK_SECTOR_SIZE]; /* Sector contents. */
+  };
+
+static struct cache_entry cache[CACHE_SIZE];
+static struct lock cache_lock;
+static struct condition entry_released; /* Signaled when USERS drops. */
+static struct condition writeback_done; /* Signaled when WRITING_BACK ends. */
+static size_t clock_hand;
+
+/* Read-ahead requests, a ring buffer protected by
+   READAHEAD_LOCK.  READAHEAD_READY counts queued requests. */
+static block_sector_t readahead_queue[READAHEAD_MAX];
+static unsigned readahead_head;     /* # of requests ever queued. */
+static unsigned readahead_tail;     /* # of requests ever taken. */
+static struct lock readahead_lock;
+static struct semaphore readahead_ready;
+
+/* Statistics. */
+static long long hit_cnt;           /* # of lookups found in cache. */
+static long long miss_cnt;          /* # of lookups that went to disk. */
+static long long readahead_cnt;     /* # of sectors read ahead. */
+static long long direct_cnt;        /* # of sectors read bypassing cache. */
+static long long writeback_cnt;     /* # of dirty sectors written. */
+
+static struct cache_entry *cache_get (block_sector_t, bool read_in,
+                                      bool count);
+static void cache_put (struct cache_entry *);
+static struct cache_entry *lookup (block_sector_t);
+static bool being_written_back (block_sector_t);
+static struct cache_entry *evict (void);
+static struct cache_entry *claim (block_sector_t);
+static void reassign (struct cache_entry *, block_sector_t);
+static void finish_reassign (struct cache_entry *);
+static void submit (struct cache_entry *, bool write, struct block_group *);
+static thread_func flush_thread NO_RETURN;
+static thread_func readahead_thread NO_RETURN;
+
+/* Initializes the buffer cache and starts its flush and
+   read-ahead threads.  Must be called after fs_device is set. */
+void
+cache_init (void)
+{
+  struct cache_entry *e;
+
+  for (e = cache; e < cache + CACHE_SIZE; e++)
+    {
+      e->valid = false;
+      e->writing_back = false;
+      e->users = 0;
+      lock_init (&e->lock);
+    }
+  lock_init (&cache_lock);
+  cond_init (&entry_released);
+  cond_init (&writeback_done);
+  lock_init (&readahead_lock);
+  sema_init (&readahead_ready, 0);
+
+  if (thread_create ("cache-flush", PRI_DEFAULT, flush_thread, NULL)
+      == TID_ERROR
+      || thread_create ("read-ahead", PRI_DEFAULT, readahead_thread, NULL)
+      == TID_ERROR)
+    PANIC ("cache_init: cannot start cache threads");
+}
+
+/* Reads SIZE bytes at offset OFS within SECTOR into BUFFER. */
+void
+cache_read (block_sector_t sector, void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, true, true);
+  memcpy (buffer, e->data + ofs, size);
+  cache_put (e);
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR into BUFFER.
+   Cached sectors are copied from the cache.  Each run of two or
+   more sectors that are not cached is read straight from disk
+   into BUFFER, in a single request, without caching it, so that
+   large reads neither wait for one command per sector nor push
+   everything else out of the cache.  The caller must ensure that
+   no one writes these sectors meanwhile. */
+void
+cache_read_run (block_sector_t sector, size_t cnt, void *buffer_)
+{
+  uint8_t *buffer = buffer_;
+
+  while (cnt > 0)
+    {
+      size_t run;
+
+      /* A sector that is neither cached nor being written back
+         from an evicted entry is up to date on disk. */
+      lock_acquire (&cache_lock);
+      for (run = 0;
+           (run < cnt && lookup (sector + run) == NULL
+            && !being_written_back (sector + run));
+           run++)
+        continue;
+      lock_release (&cache_lock);
+
+      if (run >= 2)
+        {
+          block_read_multiple (fs_device, sector, run, buffer);
+          direct_cnt += run;
+        }
+      else
+        {
+          run = 1;
+          cache_read (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+        }
+      sector += run;
+      buffer += run * BLOCK_SECTOR_SIZE;
+      cnt -= run;
+    }
+}
+
+/* Writes SIZE bytes from BUFFER at offset OFS within SECTOR.
+   The write reaches the disk later, when the sector is evicted
+   or flushed. */
+void
+cache_write (block_sector_t sector, const void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  /* Only a partial write needs the rest of the sector. */
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE, true);
+  memcpy (e->data + ofs, buffer, size);
+  e->dirty = true;
+  cache_put (e);
+}
+
+/* Asks the read-ahead thread to bring SECTOR into the cache.
+   Does not wait.  The request is dropped if too many are
+   already queued. */
+void
+cache_readahead (block_sector_t sector)
+{
+  lock_acquire (&readahead_lock);
+  if (readahead_head - readahead_tail < READAHEAD_MAX)
+    {
+      readahead_queue[readahead_head++ % READAHEAD_MAX] = sector;
+      sema_up (&readahead_ready);
+    }
+  lock_release (&readahead_lock);
+}
+
+/* Writes every dirty cached sector to disk, with up to
+   FLUSH_BATCH writes in flight at once. */
+void
+cache_flush (void)
+{
+  struct cache_entry *e = cache;
+
+  while (e < cache + CACHE_SIZE)
+    {
+      struct cache_entry *batch[FLUSH_BATCH];
+      struct block_group group;
+      size_t n = 0;
+      size_t i;
+
+      block_group_init (&group);
+      for (; e < cache + CACHE_SIZE && n < FLUSH_BATCH; e++)
+        {
+          lock_acquire (&cache_lock);
+          if (!e->valid)
+            {
+              lock_release (&cache_lock);
+              continue;
+            }
+          e->users++;
+          lock_release (&cache_lock);
+
+          lock_acquire (&e->lock);
+          if (e->dirty)
+            {
+              submit (e, true, &group);
+              batch[n++] = e;
+            }
+          else
+            cache_put (e);
+        }
+
+      block_group_wait (&group);
+      for (i = 0; i < n; i++)
+        {
+          batch[i]->dirty = false;
+          writeback_cnt++;
+          cache_put (batch[i]);
+        }
+    }
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void)
+{
+  long long lookups = hit_cnt + miss_cnt;
+
+  printf ("Cache: %lld hits, %lld misses (%lld%% hit rate), "
+          "%lld read ahead, %lld read directly, %lld written back\n",
+          hit_cnt, miss_cnt, lookups > 0 ? hit_cnt * 100 / lookups : 0,
+          readahead_cnt, direct_cnt, writeback_cnt);
+}
+
+/* Returns the locked cache entry for SECTOR, reading the sector
+   from disk if it is not cached and READ_IN is true.  If COUNT
+   is true, the lookup counts toward the hit rate.  The caller
+   must release the entry with cache_put(). */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool read_in, bool count)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      e = lookup (sector);
+      if (e != NULL)
+        {
+          if (count)
+            hit_cnt++;
+          e->accessed = true;
+          e->users++;
+          lock_release (&cache_lock);
+
+          /* Waits for the thread filling the entry, if any. */
+          lock_acquire (&e->lock);
+          return e;
+        }
+
+      /* SECTOR's latest contents are on their way to disk from an
+         evicted entry.  Read them only once they get there. */
+      if (being_written_back (sector))
+        {
+          cond_wait (&writeback_done, &cache_lock);
+          continue;
+        }
+
+      e = evict ();
+      if (e != NULL)
+        break;
+
+      /* Every entry is in use.  Another thread may cache SECTOR
+         while we wait, so look it up again afterward. */
+      cond_wait (&entry_released, &cache_lock);
+    }
+  if (count)
+    miss_cnt++;
+  reassign (e, sector);
+  lock_release (&cache_lock);
+  finish_reassign (e);
+
+  /* Other threads that want SECTOR now find the entry and wait
+     on its lock until it is filled. */
+  if (read_in)
+    block_read (fs_device, sector, e->data);
+  else
+    memset (e->data, 0, BLOCK_SECTOR_SIZE);
+  return e;
+}
+
+/* Unlocks entry E, obtained from cache_get(), and lets it be
+   evicted again. */
+static void
+cache_put (struct cache_entry *e)
+{
+  lock_release (&e->lock);
+
+  lock_acquire (&cache_lock);
+  ASSERT (e->users > 0);
+  if (--e->users == 0)
+    cond_signal (&entry_released, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Returns the entry caching SECTOR, or a null pointer.
+   CACHE_LOCK must be held. */
+static struct cache_entry *
+lookup (block_sector_t sector)
+{
+  struct cache_entry *e;
+
+  for (e = cache; e < cache + CACHE_SIZE; e++)
+    if (e->valid && e->sector == sector)
+      return e;
+  return NULL;
+}
+
+/* Returns true if an entry that now caches another sector is
+   still writing SECTOR's contents back.  CACHE_LOCK must be
+   held. */
+static bool
+being_written_back (block_sector_t sector)
+{
+  struct cache_entry *e;
+
+  for (e = cache; e < cache + CACHE_SIZE; e++)
+    if (e->writing_back && e->old_sector == sector)
+      return true;
+  return false;
+}
+
+/* Chooses an entry to replace by the clock algorithm: entries
+   not accessed since the hand last passed them go first.
+   Returns a null pointer if every entry is in use.  CACHE_LOCK
+   must be held. */
+static struct cache_entry *
+evict (void)
+{
+  size_t i;
+
+  for (i = 0; i < 2 * CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[clock_hand];
+      clock_hand = (clock_hand + 1) % CACHE_SIZE;
+
+      if (e->users > 0)
+        continue;
+      if (!e->valid || !e->accessed)
+        return e;
+      e->accessed = false;
+    }
+  return NULL;
+}
+
+/* Returns a locked entry for SECTOR, which the caller must fill,
+   or a null pointer if SECTOR is already cached or every entry
+   is in use.  The caller must release the entry with
+   cache_put(). */
+static struct cache_entry *
+claim (block_sector_t sector)
+{
+  struct cache_entry *e = NULL;
+
+  lock_acquire (&cache_lock);
+  if (lookup (sector) == NULL && !being_written_back (sector))
+    {
+      e = evict ();
+      if (e != NULL)
+        reassign (e, sector);
+    }
+  lock_release (&cache_lock);
+  if (e != NULL)
+    finish_reassign (e);
+  return e;
+}
+
+/* Gives entry E, chosen by evict(), to SECTOR and locks it for
+   the caller, its only user.  Nobody uses E, so its lock is
+   free.  If E is dirty, marks it WRITING_BACK its old sector.
+   CACHE_LOCK must be held.  After releasing CACHE_LOCK, the
+   caller must call finish_reassign() before using E. */
+static void
+reassign (struct cache_entry *e, block_sector_t sector)
+{
+  lock_acquire (&e->lock);
+  if (e->valid && e->dirty)
+    {
+      e->writing_back = true;
+      e->old_sector = e->sector;
+    }
+  e->sector = sector;
+  e->valid = true;
+  e->accessed = true;
+  e->users = 1;
+}
+
+/* Writes back the old sector of entry E, just given a new
+   sector by reassign(), if it was dirty.  E's lock must be held
+   and CACHE_LOCK must not be. */
+static void
+finish_reassign (struct cache_entry *e)
+{
+  if (!e->writing_back)
+    return;
+
+  block_write (fs_device, e->old_sector, e->data);
+  e->dirty = false;
+  writeback_cnt++;
+
+  lock_acquire (&cache_lock);
+  e->writing_back = false;
+  cond_broadcast (&writeback_done, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Submits a request to write entry E to disk, if WRITE is true,
+   or to read it from disk, counting toward GROUP.  E's lock must
+   be held until the request completes. */
+static void
+submit (struct cache_entry *e, bool write, struct block_group *group)
+{
+  e->req.block = fs_device;
+  e->req.sector = e->sector;
+  e->req.cnt = 1;
+  e->req.buffer = e->data;
+  e->req.write = write;
+  e->req.group = group;
+  e->req.complete = NULL;
+  block_submit (&e->req);
+}
+
+/* Write-behind thread.  Flushes dirty sectors periodically, so
+   that a crash loses at most CACHE_FLUSH_TICKS of writes. */
+static void
+flush_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (CACHE_FLUSH_TICKS);
+      cache_flush ();
+    }
+}
+
+/* Read-ahead thread.  Brings the sectors queued by
+   cache_readahead() into the cache, reading all of the sectors
+   queued at once together.  Drops a request if the sector is
+   already cached or if every entry is in use. */
+static void
+readahead_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      struct cache_entry *batch[READAHEAD_MAX];
+      struct block_group group;
+      size_t taken = 0;
+      size_t n = 0;
+      size_t i;
+
+      block_group_init (&group);
+      sema_down (&readahead_ready);
+      do
+        {
+          block_sector_t sector;
+          struct cache_entry *e;
+
+          lock_acquire (&readahead_lock);
+          sector = readahead_queue[readahead_tail++ % READAHEAD_MAX];
+          lock_release (&readahead_lock);
+
+          e = claim (sector);
+          if (e != NULL)
+            {
+              submit (e, false, &group);
+              batch[n++] = e;
+            }
+        }
+      while (++taken < READAHEAD_MAX && sema_try_down (&readahead_ready));
+
+      block_group_wait (&group);
+      for (i = 0; i < n; i++)
+        cache_put (batch[i]);
+      readahead_cnt += n;
+    }
+}
@@ -2,15 +2,19 @@
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include <hash.h>
+#include <round.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* A directory. */
 struct dir 
   {
     struct inode *inode;                /* Backing store. */
-    off_t pos;                          /* Current position. */
+    off_t pos;                          /* Current entry slot. */
+    uint32_t bucket_cnt;                /* Hash buckets, 0 if linear. */
   };
 
 /* A single directory entry. */
@@ -21,12 +25,193 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* Directory formats.
+
+   A linear directory is an array of entries, searched from the
+   start, so that finding a name takes time linear in the size
+   of the directory.
+
+   A hashed directory is an array of sector-sized buckets.  A
+   name's entry is in the chain of buckets that starts at bucket
+   number hash_string(NAME) % BUCKET_CNT.  Bucket 0 also records
+   BUCKET_CNT and DIR_HASH_MAGIC, which tells the two formats
+   apart.  Buckets are allocated only when first written, so an
+   empty hashed directory costs a single data sector.  When a
+   chain is full, a new overflow bucket is appended at the end of
+   the directory and linked into it. */
+
+/* Identifies bucket 0 of a hashed directory. */
+#define DIR_HASH_MAGIC 0x44495248
+
+/* Minimum number of hash buckets in a hashed directory. */
+#define DIR_HASH_BUCKETS 64
+
+/* Number of entries in a bucket. */
+#define BUCKET_ENTRIES ((BLOCK_SECTOR_SIZE - 3 * sizeof (uint32_t)) \
+                        / sizeof (struct dir_entry))
+
+/* A hashed directory's bucket.  Exactly BLOCK_SECTOR_SIZE bytes
+   long. */
+struct dir_bucket
+  {
+    uint32_t magic;                     /* DIR_HASH_MAGIC in bucket 0. */
+    uint32_t bucket_cnt;                /* Number of chains, in bucket 0. */
+    uint32_t next;                      /* Next bucket in chain, or 0. */
+    struct dir_entry entries[BUCKET_ENTRIES];
+  };
+
+/* Number of entries a linear directory search reads at once. */
+#define LINEAR_CHUNK (BLOCK_SECTOR_SIZE / sizeof (struct dir_entry))
+
+/* Directory entry cache.
+
+   Remembers the results of recent lookups by (directory inode
+   sector, name), including names that were not found, so that
+   repeated opens and creates of the same names do not search
+   the directory again.  dir_add() and dir_remove() keep the
+   cached entries of the directory they change up to date, and
+   dir_create() forgets the entries of any directory that used
+   its sector before.  Entries are replaced in LRU order. */
+#define DCACHE_SIZE 128         /* Number of cached names. */
+#define DCACHE_BUCKETS 64       /* Number of hash buckets. */
+
+/* A cached lookup result. */
+struct dcache_entry
+  {
+    struct list_elem hash_elem;         /* Element in dcache bucket. */
+    struct list_elem lru_elem;          /* Element in dcache_lru. */
+    bool valid;                         /* In a bucket? */
+    block_sector_t dir_sector;          /* Directory searched. */
+    char name[NAME_MAX + 1];            /* Name searched for. */
+    bool present;                       /* Was the name found? */
+    block_sector_t inode_sector;        /* If PRESENT, the file's inode. */
+    off_t ofs;                          /* If PRESENT, the entry's offset. */
+  };
+
+static struct dcache_entry dcache[DCACHE_SIZE];
+static struct list dcache_buckets[DCACHE_BUCKETS];
+static struct list dcache_lru;          /* Most recently used first. */
+
+/* Statistics. */
+static long long dcache_hits;           /* # of lookups found cached. */
+static long long dcache_negative_hits;  /* # of those for absent names. */
+static long long dcache_misses;         /* # of lookups that searched. */
+
+/* Format of directories created by dir_create(). */
+static enum dir_format format = DIR_LINEAR;
+
+/* Serializes lookups and updates of directory entries, so that
+   checking for a name and adding it happen atomically.  It is
+   held only while entries are searched or changed, never during
+   file I/O, which is synchronized per inode instead.  Also
+   protects the directory entry cache and the buffers below. */
+static struct lock dir_lock;
+
+/* Buffers for reading directories, protected by dir_lock, so
+   that searches need not allocate memory. */
+static struct dir_entry chunk[LINEAR_CHUNK];
+static struct dir_bucket bucket;
+
+static bool lookup_linear (const struct dir *, const char *name,
+                           struct dir_entry *, off_t *);
+static bool lookup_hashed (const struct dir *, const char *name,
+                           struct dir_entry *, off_t *);
+static bool add_linear (struct dir *, const struct dir_entry *, off_t *);
+static bool add_hashed (struct dir *, const struct dir_entry *, off_t *);
+static off_t slot_ofs (const struct dir *, off_t slot);
+static struct dcache_entry *dcache_find (block_sector_t dir_sector,
+                                         const char *name);
+static void dcache_insert (block_sector_t dir_sector, const char *name,
+                           bool present, block_sector_t inode_sector,
+                           off_t ofs);
+static void dcache_purge (block_sector_t dir_sector);
+static struct list *dcache_bucket (block_sector_t dir_sector,
+                                   const char *name);
+
+/* Initializes the directory module. */
+void
+dir_init (void) 
+{
+  size_t i;
+
+  ASSERT (sizeof (struct dir_bucket) == BLOCK_SECTOR_SIZE);
+
+  lock_init (&dir_lock);
+  list_init (&dcache_lru);
+  for (i = 0; i < DCACHE_BUCKETS; i++)
+    list_init (&dcache_buckets[i]);
+  for (i = 0; i < DCACHE_SIZE; i++)
+    {
+      dcache[i].valid = false;
+      list_push_back (&dcache_lru, &dcache[i].lru_elem);
+    }
+}
+
+/* Makes dir_create() create directories in FORMAT. */
+void
+dir_set_format (enum dir_format new_format)
+{
+  format = new_format;
+}
+
+/* Returns the format of DIR. */
+enum dir_format
+dir_get_format (const struct dir *dir)
+{
+  return dir->bucket_cnt > 0 ? DIR_HASHED : DIR_LINEAR;
+}
+
+/* Prints directory entry cache statistics. */
+void
+dir_print_stats (void)
+{
+  printf ("Directories: %s format, %lld cached lookups "
+          "(%lld negative), %lld searches\n",
+          format == DIR_HASHED ? "hashed" : "linear",
+          dcache_hits, dcache_negative_hits, dcache_misses);
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+   given SECTOR, in the format last passed to dir_set_format().
+   Returns true if successful, false on failure. */
 bool
 dir_create (block_sector_t sector, size_t entry_cnt)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  bool success;
+
+  /* Forget whatever was cached about a directory that used to
+     be in SECTOR. */
+  lock_acquire (&dir_lock);
+  dcache_purge (sector);
+  lock_release (&dir_lock);
+
+  if (format == DIR_HASHED)
+    {
+      struct dir_bucket *b;
+      struct inode *inode;
+      size_t bucket_cnt = DIV_ROUND_UP (entry_cnt, BUCKET_ENTRIES);
+
+      if (bucket_cnt < DIR_HASH_BUCKETS)
+        bucket_cnt = DIR_HASH_BUCKETS;
+      if (!inode_create (sector, bucket_cnt * BLOCK_SECTOR_SIZE))
+        return false;
+
+      /* Write bucket 0, which identifies the format. */
+      b = calloc (1, sizeof *b);
+      inode = inode_open (sector);
+      success = b != NULL && inode != NULL;
+      if (success)
+        {
+          b->magic = DIR_HASH_MAGIC;
+          b->bucket_cnt = bucket_cnt;
+          success = inode_write_at (inode, b, sizeof *b, 0) == sizeof *b;
+        }
+      inode_close (inode);
+      free (b);
+      return success;
+    }
+  else
+    return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -37,8 +222,13 @@ dir_open (struct inode *inode)
   struct dir *dir = calloc (1, sizeof *dir);
   if (inode != NULL && dir != NULL)
     {
+      uint32_t header[2];
+
       dir->inode = inode;
       dir->pos = 0;
+      if (inode_read_at (inode, header, sizeof header, 0) == sizeof header
+          && header[0] == DIR_HASH_MAGIC)
+        dir->bucket_cnt = header[1];
       return dir;
     }
   else
@@ -87,28 +277,119 @@ dir_get_inode (struct dir *dir)
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
    directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+   otherwise, returns false and ignores EP and OFSP.
+   Consults the directory entry cache before searching DIR.
+   dir_lock must be held. */
 static bool
 lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp) 
 {
+  block_sector_t dir_sector;
+  struct dcache_entry *d;
   struct dir_entry e;
-  size_t ofs;
+  off_t ofs = 0;
+  bool found;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
-  return false;
+  /* No entry has a longer name. */
+  if (strlen (name) > NAME_MAX)
+    return false;
+
+  dir_sector = inode_get_inumber (dir->inode);
+  d = dcache_find (dir_sector, name);
+  if (d != NULL)
+    {
+      dcache_hits++;
+      if (!d->present)
+        {
+          dcache_negative_hits++;
+          return false;
+        }
+      e.inode_sector = d->inode_sector;
+      strlcpy (e.name, name, sizeof e.name);
+      e.in_use = true;
+      ofs = d->ofs;
+      found = true;
+    }
+  else
+    {
+      dcache_misses++;
+      found = (dir->bucket_cnt > 0
+               ? lookup_hashed (dir, name, &e, &ofs)
+               : lookup_linear (dir, name, &e, &ofs));
+      dcache_insert (dir_sector, name, found,
+                     found ? e.inode_sector : 0, ofs);
+    }
+
+  if (found)
+    {
+      if (ep != NULL)
+        *ep = e;
+      if (ofsp != NULL)
+        *ofsp = ofs;
+    }
+  return found;
+}
+
+/* Searches linear directory DIR for NAME, reading LINEAR_CHUNK
+   entries at a time.  Returns true and sets *EP and *OFSP if
+   found, otherwise returns false. */
+static bool
+lookup_linear (const struct dir *dir, const char *name,
+               struct dir_entry *ep, off_t *ofsp)
+{
+  off_t ofs = 0;
+
+  for (;;)
+    {
+      size_t cnt = (inode_read_at (dir->inode, chunk, sizeof chunk, ofs)
+                    / sizeof *chunk);
+      size_t i;
+
+      for (i = 0; i < cnt; i++)
+        if (chunk[i].in_use && !strcmp (name, chunk[i].name))
+          {
+            *ep = chunk[i];
+            *ofsp = ofs + i * sizeof *chunk;
+            return true;
+          }
+      if (cnt < LINEAR_CHUNK)
+        return false;
+      ofs += sizeof chunk;
+    }
+}
+
+/* Searches hashed directory DIR for NAME, reading only the chain
+   of buckets that NAME hashes to.  Returns true and sets *EP and
+   *OFSP if found, otherwise returns false. */
+static bool
+lookup_hashed (const struct dir *dir, const char *name,
+               struct dir_entry *ep, off_t *ofsp)
+{
+  uint32_t b = hash_string (name) % dir->bucket_cnt;
+
+  for (;;)
+    {
+      off_t bucket_ofs = (off_t) b * BLOCK_SECTOR_SIZE;
+      size_t i;
+
+      if (inode_read_at (dir->inode, &bucket, sizeof bucket, bucket_ofs)
+          != sizeof bucket)
+        return false;
+      for (i = 0; i < BUCKET_ENTRIES; i++)
+        if (bucket.entries[i].in_use && !strcmp (name, bucket.entries[i].name))
+          {
+            *ep = bucket.entries[i];
+            *ofsp = (bucket_ofs + offsetof (struct dir_bucket, entries)
+                     + i * sizeof (struct dir_entry));
+            return true;
+          }
+      if (bucket.next == 0)
+        return false;
+      b = bucket.next;
+    }
 }
 
 /* Searches DIR for a file with the given NAME
@@ -124,10 +405,12 @@ dir_lookup (const struct dir *dir, const char *name,
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  lock_acquire (&dir_lock);
   if (lookup (dir, name, &e, NULL))
     *inode = inode_open (e.inode_sector);
   else
     *inode = NULL;
+  lock_release (&dir_lock);
 
   return *inode != NULL;
 }
@@ -152,10 +435,35 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
+  lock_acquire (&dir_lock);
+
   /* Check that NAME is not in use. */
   if (lookup (dir, name, NULL, NULL))
     goto done;
 
+  /* Write slot. */
+  e.in_use = true;
+  strlcpy (e.name, name, sizeof e.name);
+  e.inode_sector = inode_sector;
+  success = (dir->bucket_cnt > 0
+             ? add_hashed (dir, &e, &ofs)
+             : add_linear (dir, &e, &ofs));
+  if (success)
+    dcache_insert (inode_get_inumber (dir->inode), name, true,
+                   inode_sector, ofs);
+
+ done:
+  lock_release (&dir_lock);
+  return success;
+}
+
+/* Writes entry E into a free slot of linear directory DIR and
+   stores its offset in *OFSP.  Returns true if successful. */
+static bool
+add_linear (struct dir *dir, const struct dir_entry *e, off_t *ofsp)
+{
+  off_t ofs = 0;
+
   /* Set OFS to offset of free slot.
      If there are no free slots, then it will be set to the
      current end-of-file.
@@ -163,19 +471,70 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
      inode_read_at() will only return a short read at end of file.
      Otherwise, we'd need to verify that we didn't get a short
      read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
+  for (;;)
+    {
+      size_t cnt = (inode_read_at (dir->inode, chunk, sizeof chunk, ofs)
+                    / sizeof *chunk);
+      size_t i;
 
-  /* Write slot. */
-  e.in_use = true;
-  strlcpy (e.name, name, sizeof e.name);
-  e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+      for (i = 0; i < cnt; i++)
+        if (!chunk[i].in_use)
+          break;
+      ofs += i * sizeof *chunk;
+      if (i < cnt || cnt < LINEAR_CHUNK)
+        break;
+    }
 
- done:
-  return success;
+  *ofsp = ofs;
+  return inode_write_at (dir->inode, e, sizeof *e, ofs) == sizeof *e;
+}
+
+/* Writes entry E into a free slot of the chain of buckets that
+   its name hashes to in hashed directory DIR, appending an
+   overflow bucket to the chain if it is full, and stores the
+   entry's offset in *OFSP.  Returns true if successful. */
+static bool
+add_hashed (struct dir *dir, const struct dir_entry *e, off_t *ofsp)
+{
+  uint32_t b = hash_string (e->name) % dir->bucket_cnt;
+  off_t bucket_ofs;
+  uint32_t overflow;
+
+  for (;;)
+    {
+      size_t i;
+
+      bucket_ofs = (off_t) b * BLOCK_SECTOR_SIZE;
+      if (inode_read_at (dir->inode, &bucket, sizeof bucket, bucket_ofs)
+          != sizeof bucket)
+        return false;
+      for (i = 0; i < BUCKET_ENTRIES; i++)
+        if (!bucket.entries[i].in_use)
+          {
+            *ofsp = (bucket_ofs + offsetof (struct dir_bucket, entries)
+                     + i * sizeof (struct dir_entry));
+            return inode_write_at (dir->inode, e, sizeof *e, *ofsp)
+                    == sizeof *e;
+          }
+      if (bucket.next == 0)
+        break;
+      b = bucket.next;
+    }
+
+  /* The chain is full.  Write a new bucket holding E at the end
+     of the directory, then link it after bucket B. */
+  overflow = inode_length (dir->inode) / BLOCK_SECTOR_SIZE;
+  memset (&bucket, 0, sizeof bucket);
+  bucket.entries[0] = *e;
+  if (inode_write_at (dir->inode, &bucket, sizeof bucket,
+                      (off_t) overflow * BLOCK_SECTOR_SIZE) != sizeof bucket
+      || inode_write_at (dir->inode, &overflow, sizeof overflow,
+                         bucket_ofs + offsetof (struct dir_bucket, next))
+         != sizeof overflow)
+    return false;
+  *ofsp = ((off_t) overflow * BLOCK_SECTOR_SIZE
+           + offsetof (struct dir_bucket, entries));
+  return true;
 }
 
 /* Removes any entry for NAME in DIR.
@@ -192,6 +551,8 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  lock_acquire (&dir_lock);
+
   /* Find directory entry. */
   if (!lookup (dir, name, &e, &ofs))
     goto done;
@@ -205,12 +566,14 @@ dir_remove (struct dir *dir, const char *name)
   e.in_use = false;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
+  dcache_insert (inode_get_inumber (dir->inode), name, false, 0, 0);
 
   /* Remove inode. */
   inode_remove (inode);
   success = true;
 
  done:
+  lock_release (&dir_lock);
   inode_close (inode);
   return success;
 }
@@ -222,15 +585,111 @@ bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
+  bool found = false;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  lock_acquire (&dir_lock);
+  while (inode_read_at (dir->inode, &e, sizeof e, slot_ofs (dir, dir->pos))
+         == sizeof e) 
     {
-      dir->pos += sizeof e;
+      dir->pos++;
       if (e.in_use)
         {
           strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
+          found = true;
+          break;
         } 
     }
-  return false;
+  lock_release (&dir_lock);
+  return found;
+}
+
+/* Returns the byte offset in DIR of entry slot number SLOT. */
+static off_t
+slot_ofs (const struct dir *dir, off_t slot)
+{
+  if (dir->bucket_cnt > 0)
+    return ((slot / BUCKET_ENTRIES) * BLOCK_SECTOR_SIZE
+            + offsetof (struct dir_bucket, entries)
+            + (slot % BUCKET_ENTRIES) * sizeof (struct dir_entry));
+  else
+    return slot * sizeof (struct dir_entry);
+}
+
+/* Returns the bucket of the directory entry cache for NAME in the
+   directory in DIR_SECTOR. */
+static struct list *
+dcache_bucket (block_sector_t dir_sector, const char *name)
+{
+  unsigned hash = hash_string (name) ^ hash_int (dir_sector);
+  return &dcache_buckets[hash % DCACHE_BUCKETS];
+}
+
+/* Returns the cached lookup of NAME in the directory in
+   DIR_SECTOR and marks it most recently used, or returns a null
+   pointer if there is none.  dir_lock must be held. */
+static struct dcache_entry *
+dcache_find (block_sector_t dir_sector, const char *name)
+{
+  struct list *b = dcache_bucket (dir_sector, name);
+  struct list_elem *e;
+
+  for (e = list_begin (b); e != list_end (b); e = list_next (e))
+    {
+      struct dcache_entry *d = list_entry (e, struct dcache_entry,
+                                           hash_elem);
+      if (d->dir_sector == dir_sector && !strcmp (d->name, name))
+        {
+          list_remove (&d->lru_elem);
+          list_push_front (&dcache_lru, &d->lru_elem);
+          return d;
+        }
+    }
+  return NULL;
+}
+
+/* Caches the result of looking up NAME in the directory in
+   DIR_SECTOR: whether it is PRESENT and, if so, the INODE_SECTOR
+   and offset OFS of its entry.  Replaces the least recently used
+   entry if NAME is not cached yet.  dir_lock must be held. */
+static void
+dcache_insert (block_sector_t dir_sector, const char *name, bool present,
+               block_sector_t inode_sector, off_t ofs)
+{
+  struct dcache_entry *d = dcache_find (dir_sector, name);
+
+  ASSERT (strlen (name) <= NAME_MAX);
+
+  if (d == NULL)
+    {
+      d = list_entry (list_back (&dcache_lru), struct dcache_entry,
+                      lru_elem);
+      if (d->valid)
+        list_remove (&d->hash_elem);
+      d->valid = true;
+      d->dir_sector = dir_sector;
+      strlcpy (d->name, name, sizeof d->name);
+      list_push_front (dcache_bucket (dir_sector, name), &d->hash_elem);
+      list_remove (&d->lru_elem);
+      list_push_front (&dcache_lru, &d->lru_elem);
+    }
+  d->present = present;
+  d->inode_sector = inode_sector;
+  d->ofs = ofs;
+}
+
+/* Forgets every cached lookup in the directory in DIR_SECTOR.
+   dir_lock must be held. */
+static void
+dcache_purge (block_sector_t dir_sector)
+{
+  struct dcache_entry *d;
+
+  for (d = dcache; d < dcache + DCACHE_SIZE; d++)
+    if (d->valid && d->dir_sector == dir_sector)
+      {
+        d->valid = false;
+        list_remove (&d->hash_elem);
+        list_remove (&d->lru_elem);
+        list_push_back (&dcache_lru, &d->lru_elem);
+      }
 }
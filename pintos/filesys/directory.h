@@ -12,6 +12,19 @@
 #define NAME_MAX 14
 
 struct inode;
+struct dir;
+
+/* Directory formats. */
+enum dir_format
+  {
+    DIR_LINEAR,                 /* Array of entries. */
+    DIR_HASHED                  /* Entries hashed by name into buckets. */
+  };
+
+void dir_init (void);
+void dir_set_format (enum dir_format);
+enum dir_format dir_get_format (const struct dir *);
+void dir_print_stats (void);
 
 /* Opening and closing directories. */
 bool dir_create (block_sector_t sector, size_t entry_cnt);
@@ -2,6 +2,7 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
@@ -13,19 +14,38 @@ struct block *fs_device;
 static void do_format (void);
 
 /* Initializes the file system module.
-   If FORMAT is true, reformats the file system. */
+   If FORMAT is true, reformats the file system, giving its files
+   the given LAYOUT and its directories the given DIR_FORMAT.
+   Otherwise, files and directories keep the layout and format
+   they were formatted with. */
 void
-filesys_init (bool format) 
+filesys_init (bool format, enum inode_layout layout,
+              enum dir_format dir_format) 
 {
   fs_device = block_get_role (BLOCK_FILESYS);
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  cache_init ();
   inode_init ();
+  dir_init ();
   free_map_init ();
 
   if (format) 
-    do_format ();
+    {
+      inode_set_layout (layout);
+      dir_set_format (dir_format);
+      do_format ();
+    }
+  else
+    {
+      struct dir *root = dir_open_root ();
+      if (root == NULL)
+        PANIC ("can't open root directory");
+      inode_set_layout (inode_get_layout (dir_get_inode (root)));
+      dir_set_format (dir_get_format (root));
+      dir_close (root);
+    }
 
   free_map_open ();
 }
@@ -36,6 +56,7 @@ void
 filesys_done (void) 
 {
   free_map_close ();
+  cache_flush ();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
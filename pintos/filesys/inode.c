@@ -1,79 +1,535 @@
 #include "filesys/inode.h"
 #include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
+#include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
-/* Identifies an inode. */
+/* Identifies an inode whose data is indexed by sector pointers. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Identifies an inode whose data is described by extents. */
+#define EXTENT_MAGIC 0x494e4f45
+
+/* Maximum number of whole sectors inode_read_at() reads from
+   disk in a single request. */
+#define READ_RUN_MAX 64
+
+/* Number of direct block pointers in an indexed inode. */
+#define DIRECT_CNT 124
+
+/* Number of block pointers in an index block. */
+#define PTRS_PER_SECTOR (BLOCK_SECTOR_SIZE / sizeof (block_sector_t))
+
+/* Maximum number of sectors in a file. */
+#define MAX_SECTORS (DIRECT_CNT + PTRS_PER_SECTOR                     \
+                     + PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+
+/* A run of CNT file sectors, starting at sector LOGICAL of the
+   file, that are stored in consecutive disk sectors starting at
+   START. */
+struct extent
+  {
+    uint32_t logical;                   /* First file sector. */
+    block_sector_t start;               /* First disk sector. */
+    uint32_t cnt;                       /* Number of sectors. */
+  };
+
+/* Number of extents stored in an extent inode itself. */
+#define INODE_EXTENT_CNT 41
+
+/* Number of extents in an extent leaf block. */
+#define EXTENTS_PER_SECTOR (BLOCK_SECTOR_SIZE / sizeof (struct extent))
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   The file system chooses one of two layouts for the data of
+   all its files when it is formatted, and MAGIC tells which one
+   an inode uses.
+
+   With INODE_MAGIC, the first DIRECT_CNT sectors of the file
+   are found through DIRECT, the next PTRS_PER_SECTOR through the
+   index block INDIRECT, and the rest through the two-level index
+   rooted at DOUBLY_INDIRECT, for a maximum file size of a little
+   over 8 MB.
+
+   With EXTENT_MAGIC, the file is a list of CNT extents, in the
+   order they were allocated.  The first INODE_EXTENT_CNT are in
+   the inode.  The rest are in leaf blocks of EXTENTS_PER_SECTOR
+   extents each, which the extent index block INDEX points to.  A
+   file written sequentially usually grows its last extent in
+   place, so it needs few extents and little metadata I/O.
+
+   In both layouts, a file's sectors are allocated only when first
+   written, so unwritten parts ("holes") read as zeros without
+   taking up disk space.  A pointer of 0 means that no sector is
+   allocated: sector 0 holds the free map's inode, so it is never
+   a data or index sector. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
+    union
+      {
+        struct
+          {
+            block_sector_t direct[DIRECT_CNT];  /* Direct data sectors. */
+            block_sector_t indirect;    /* Index block of data sectors. */
+            block_sector_t doubly_indirect; /* Index block of index blocks. */
+          }
+        indexed;
+        struct
+          {
+            uint32_t cnt;               /* Number of extents. */
+            block_sector_t index;       /* Index block of leaf blocks. */
+            struct extent extents[INODE_EXTENT_CNT]; /* First extents. */
+          }
+        extents;
+      }
+    u;
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
   };
 
-/* Returns the number of sectors to allocate for an inode SIZE
-   bytes long. */
-static inline size_t
-bytes_to_sectors (off_t size)
-{
-  return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
-}
+/* Number of recently used extents that an in-memory inode
+   remembers. */
+#define EXTENT_HINT_CNT 4
+
+/* In-memory inode.
 
-/* In-memory inode. */
+   ELEM, OPEN_CNT, REMOVED and LOADED are protected by
+   open_inodes_lock.
+   The file data and DENY_WRITE_CNT are protected by RWLOCK, so
+   that any number of threads may read an inode at once while
+   writers get exclusive access.  Operations on different inodes
+   never wait for each other.  HINTS, which readers update too,
+   have their own lock. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct list_elem elem;              /* Element in open_inodes bucket. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
+    bool loaded;                        /* DATA read from disk yet? */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    struct rwlock rwlock;               /* Readers-writer lock for data. */
     struct inode_disk data;             /* Inode content. */
+
+    /* Extent layout only. */
+    struct lock hint_lock;              /* Protects the members below. */
+    struct extent hints[EXTENT_HINT_CNT]; /* Recently used extents. */
+    int next_hint;                      /* Hint to replace next. */
   };
 
+/* Layout of inodes created by inode_create(). */
+static enum inode_layout layout = INODE_INDEXED;
+
+/* Statistics. */
+static long long meta_reads;    /* # of inode and index sector reads. */
+static long long meta_writes;   /* # of inode and index sector writes. */
+static long long open_cnt;      /* # of inode_open() calls. */
+static long long open_probes;   /* # of open inodes compared by them. */
+
+static block_sector_t index_to_sector (struct inode *, size_t idx,
+                                       bool create);
+static block_sector_t index_get (block_sector_t *index, size_t idx,
+                                 bool create, bool *changed);
+static void release_index (block_sector_t, int level);
+static block_sector_t extent_to_sector (struct inode *, size_t idx,
+                                        bool create);
+static block_sector_t extent_find (struct inode *, size_t idx);
+static block_sector_t extent_append (struct inode *, size_t idx);
+static bool extent_read (struct inode *, size_t i, struct extent *);
+static bool extent_write (struct inode *, size_t i, const struct extent *);
+static void extent_remember (struct inode *, const struct extent *);
+static void release_extents (struct inode *);
+static bool allocate_zeroed (block_sector_t *);
+static void meta_read (block_sector_t, void *, int ofs, int size);
+static void meta_write (block_sector_t, const void *, int ofs, int size);
+
 /* Returns the block device sector that contains byte offset POS
-   within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   within INODE, or 0 if no sector is allocated there.  If CREATE
+   is true, first allocates a zeroed sector, and any metadata
+   needed to reach it, if there is none; then 0 means that the
+   disk is full or POS is beyond the largest possible file.  With
+   CREATE, the caller must hold INODE's lock for writing. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos, bool create)
 {
   ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
+  ASSERT (pos >= 0);
+
+  if (inode->data.magic == EXTENT_MAGIC)
+    return extent_to_sector (inode, pos / BLOCK_SECTOR_SIZE, create);
   else
-    return -1;
+    return index_to_sector (inode, pos / BLOCK_SECTOR_SIZE, create);
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* byte_to_sector() for sector IDX of an indexed INODE. */
+static block_sector_t
+index_to_sector (struct inode *inode, size_t idx, bool create)
+{
+  struct inode_disk *d = &inode->data;
+  bool changed = false;
+  block_sector_t sector;
+
+  if (idx < DIRECT_CNT)
+    {
+      block_sector_t *direct = &d->u.indexed.direct[idx];
+      if (*direct == 0 && create && allocate_zeroed (direct))
+        changed = true;
+      sector = *direct;
+    }
+  else if ((idx -= DIRECT_CNT) < PTRS_PER_SECTOR)
+    sector = index_get (&d->u.indexed.indirect, idx, create, &changed);
+  else if ((idx -= PTRS_PER_SECTOR) < PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+    {
+      block_sector_t index = index_get (&d->u.indexed.doubly_indirect,
+                                        idx / PTRS_PER_SECTOR,
+                                        create, &changed);
+      sector = (index != 0
+                ? index_get (&index, idx % PTRS_PER_SECTOR, create, &changed)
+                : 0);
+    }
+  else
+    sector = 0;
+
+  if (changed)
+    meta_write (inode->sector, d, 0, BLOCK_SECTOR_SIZE);
+  return sector;
+}
+
+/* Returns entry IDX of the index block in sector *INDEX, or 0 if
+   that entry or the index block itself is not allocated.  If
+   CREATE is true, first allocates whatever is missing, zeroed.
+   If that includes the index block, stores its sector in *INDEX
+   and sets *CHANGED to true. */
+static block_sector_t
+index_get (block_sector_t *index, size_t idx, bool create, bool *changed)
+{
+  block_sector_t entry;
+
+  if (*index == 0)
+    {
+      if (!create || !allocate_zeroed (index))
+        return 0;
+      *changed = true;
+    }
+
+  meta_read (*index, &entry, idx * sizeof entry, sizeof entry);
+  if (entry == 0 && create && allocate_zeroed (&entry))
+    meta_write (*index, &entry, idx * sizeof entry, sizeof entry);
+  return entry;
+}
+
+/* Releases SECTOR, along with every sector it refers to if it is
+   an index block.  LEVEL is 0 for a data sector, 1 for an index
+   block of data sectors, and 2 for an index block of index
+   blocks.  Does nothing if SECTOR is 0. */
+static void
+release_index (block_sector_t sector, int level)
+{
+  if (sector == 0)
+    return;
+  if (level > 0)
+    {
+      size_t i;
+
+      for (i = 0; i < PTRS_PER_SECTOR; i++)
+        {
+          block_sector_t entry;
+
+          meta_read (sector, &entry, i * sizeof entry, sizeof entry);
+          release_index (entry, level - 1);
+        }
+    }
+  free_map_release (sector, 1);
+}
+
+/* byte_to_sector() for sector IDX of an extent INODE. */
+static block_sector_t
+extent_to_sector (struct inode *inode, size_t idx, bool create)
+{
+  block_sector_t sector;
+
+  if (idx >= MAX_SECTORS)
+    return 0;
+  sector = extent_find (inode, idx);
+  if (sector == 0 && create)
+    sector = extent_append (inode, idx);
+  return sector;
+}
+
+/* Returns the disk sector that holds sector IDX of extent INODE,
+   or 0 if none does.  Checks the recently used extents first,
+   and otherwise searches all of them. */
+static block_sector_t
+extent_find (struct inode *inode, size_t idx)
+{
+  struct extent e;
+  size_t i;
+
+  lock_acquire (&inode->hint_lock);
+  for (i = 0; i < EXTENT_HINT_CNT; i++)
+    {
+      const struct extent *h = &inode->hints[i];
+      if (idx >= h->logical && idx - h->logical < h->cnt)
+        {
+          block_sector_t sector = h->start + (idx - h->logical);
+          lock_release (&inode->hint_lock);
+          return sector;
+        }
+    }
+  lock_release (&inode->hint_lock);
+
+  for (i = 0; i < inode->data.u.extents.cnt; i++)
+    if (extent_read (inode, i, &e)
+        && idx >= e.logical && idx - e.logical < e.cnt)
+      {
+        extent_remember (inode, &e);
+        return e.start + (idx - e.logical);
+      }
+  return 0;
+}
+
+/* Allocates a zeroed sector for sector IDX of extent INODE,
+   which has none, and returns it, or 0 if the disk is full.
+   Extends the last extent in place if IDX follows it and the
+   disk sector after it is free, and otherwise adds an extent. */
+static block_sector_t
+extent_append (struct inode *inode, size_t idx)
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+  uint32_t cnt = inode->data.u.extents.cnt;
+  struct extent e;
+
+  if (cnt > 0 && extent_read (inode, cnt - 1, &e)
+      && e.logical + e.cnt == idx
+      && free_map_allocate_at (e.start + e.cnt, 1))
+    {
+      cache_write (e.start + e.cnt, zeros, 0, BLOCK_SECTOR_SIZE);
+      e.cnt++;
+      if (extent_write (inode, cnt - 1, &e))
+        {
+          extent_remember (inode, &e);
+          return e.start + e.cnt - 1;
+        }
+      free_map_release (e.start + e.cnt - 1, 1);
+      return 0;
+    }
+
+  e.logical = idx;
+  e.cnt = 1;
+  if (!allocate_zeroed (&e.start))
+    return 0;
+  if (!extent_write (inode, cnt, &e))
+    {
+      free_map_release (e.start, 1);
+      return 0;
+    }
+  inode->data.u.extents.cnt++;
+  meta_write (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+  extent_remember (inode, &e);
+  return e.start;
+}
+
+/* Reads extent I of extent INODE into *E.  Returns false if the
+   leaf block that should hold it is not allocated. */
+static bool
+extent_read (struct inode *inode, size_t i, struct extent *e)
+{
+  struct inode_disk *d = &inode->data;
+  block_sector_t leaf;
+
+  if (i < INODE_EXTENT_CNT)
+    {
+      *e = d->u.extents.extents[i];
+      return true;
+    }
+  i -= INODE_EXTENT_CNT;
+  if (d->u.extents.index == 0)
+    return false;
+  meta_read (d->u.extents.index, &leaf, i / EXTENTS_PER_SECTOR * sizeof leaf,
+             sizeof leaf);
+  if (leaf == 0)
+    return false;
+  meta_read (leaf, e, i % EXTENTS_PER_SECTOR * sizeof *e, sizeof *e);
+  return true;
+}
+
+/* Stores *E as extent I of extent INODE, allocating the extent
+   index block and leaf block if needed.  Writes the inode itself
+   back only if it allocates the index block.  Returns false if
+   the disk is full or I is too large. */
+static bool
+extent_write (struct inode *inode, size_t i, const struct extent *e)
+{
+  struct inode_disk *d = &inode->data;
+  bool changed = false;
+  block_sector_t leaf;
+
+  if (i < INODE_EXTENT_CNT)
+    {
+      d->u.extents.extents[i] = *e;
+      meta_write (inode->sector, d, 0, BLOCK_SECTOR_SIZE);
+      return true;
+    }
+  i -= INODE_EXTENT_CNT;
+  if (i / EXTENTS_PER_SECTOR >= PTRS_PER_SECTOR)
+    return false;
+  leaf = index_get (&d->u.extents.index, i / EXTENTS_PER_SECTOR, true,
+                    &changed);
+  if (changed)
+    meta_write (inode->sector, d, 0, BLOCK_SECTOR_SIZE);
+  if (leaf == 0)
+    return false;
+  meta_write (leaf, e, i % EXTENTS_PER_SECTOR * sizeof *e, sizeof *e);
+  return true;
+}
+
+/* Adds *E to extent INODE's recently used extents, replacing an
+   older copy of the same extent if there is one. */
+static void
+extent_remember (struct inode *inode, const struct extent *e)
+{
+  int i;
+
+  lock_acquire (&inode->hint_lock);
+  for (i = 0; i < EXTENT_HINT_CNT; i++)
+    if (inode->hints[i].cnt > 0 && inode->hints[i].logical == e->logical)
+      break;
+  if (i == EXTENT_HINT_CNT)
+    {
+      i = inode->next_hint;
+      inode->next_hint = (i + 1) % EXTENT_HINT_CNT;
+    }
+  inode->hints[i] = *e;
+  lock_release (&inode->hint_lock);
+}
+
+/* Releases the data sectors, leaf blocks and extent index block
+   of extent INODE. */
+static void
+release_extents (struct inode *inode)
+{
+  struct inode_disk *d = &inode->data;
+  size_t i;
+
+  for (i = 0; i < d->u.extents.cnt; i++)
+    {
+      struct extent e;
+      if (extent_read (inode, i, &e))
+        free_map_release (e.start, e.cnt);
+    }
+  release_index (d->u.extents.index, 1);
+}
+
+/* Allocates a sector, fills it with zeros, and stores it in
+   *SECTORP.  Returns false if the disk is full. */
+static bool
+allocate_zeroed (block_sector_t *sectorp)
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+
+  if (!free_map_allocate (1, sectorp))
+    return false;
+  cache_write (*sectorp, zeros, 0, BLOCK_SECTOR_SIZE);
+  return true;
+}
+
+/* Reads SIZE bytes at offset OFS within inode or index block
+   SECTOR into BUFFER, counting the access. */
+static void
+meta_read (block_sector_t sector, void *buffer, int ofs, int size)
+{
+  meta_reads++;
+  cache_read (sector, buffer, ofs, size);
+}
+
+/* Writes SIZE bytes from BUFFER at offset OFS within inode or
+   index block SECTOR, counting the access. */
+static void
+meta_write (block_sector_t sector, const void *buffer, int ofs, int size)
+{
+  meta_writes++;
+  cache_write (sector, buffer, ofs, size);
+}
+
+/* Open inodes, hashed by sector, so that opening a single inode
+   twice returns the same `struct inode' without scanning every
+   open inode. */
+#define OPEN_INODES_SIZE 256    /* Number of buckets. */
+static struct list open_inodes[OPEN_INODES_SIZE];
+
+/* Protects open_inodes and the open counts of its inodes. */
+static struct lock open_inodes_lock;
+
+/* Signaled when an inode's data has been read from disk. */
+static struct condition inode_loaded;
+
+static struct list *open_inodes_bucket (block_sector_t);
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  size_t i;
+
+  for (i = 0; i < OPEN_INODES_SIZE; i++)
+    list_init (&open_inodes[i]);
+  lock_init (&open_inodes_lock);
+  cond_init (&inode_loaded);
+}
+
+/* Returns the bucket of open_inodes that holds SECTOR's inode. */
+static struct list *
+open_inodes_bucket (block_sector_t sector)
+{
+  return &open_inodes[hash_int (sector) % OPEN_INODES_SIZE];
+}
+
+/* Makes inode_create() use LAYOUT for new inodes. */
+void
+inode_set_layout (enum inode_layout new_layout)
+{
+  layout = new_layout;
+}
+
+/* Returns the layout of INODE's data. */
+enum inode_layout
+inode_get_layout (const struct inode *inode)
+{
+  return inode->data.magic == EXTENT_MAGIC ? INODE_EXTENTS : INODE_INDEXED;
+}
+
+/* Prints inode statistics. */
+void
+inode_print_stats (void)
+{
+  printf ("Inodes: %s layout, %lld metadata reads, %lld metadata writes\n",
+          layout == INODE_EXTENTS ? "extent" : "indexed",
+          meta_reads, meta_writes);
+  printf ("Inodes: %lld opens, %lld open inodes probed\n",
+          open_cnt, open_probes);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device, in the layout last passed to inode_set_layout().  The
+   data starts out as a hole, so no data sectors are allocated
+   until they are written.
    Returns true if successful.
-   Returns false if memory or disk allocation fails. */
+   Returns false if memory allocation fails or if LENGTH is
+   larger than an inode can address. */
 bool
 inode_create (block_sector_t sector, off_t length)
 {
   struct inode_disk *disk_inode = NULL;
-  bool success = false;
 
   ASSERT (length >= 0);
 
@@ -81,28 +537,17 @@ inode_create (block_sector_t sector, off_t length)
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
+  if ((size_t) DIV_ROUND_UP (length, BLOCK_SECTOR_SIZE) > MAX_SECTORS)
+    return false;
+
   disk_inode = calloc (1, sizeof *disk_inode);
-  if (disk_inode != NULL)
-    {
-      size_t sectors = bytes_to_sectors (length);
-      disk_inode->length = length;
-      disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
-        {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
-          success = true; 
-        } 
-      free (disk_inode);
-    }
-  return success;
+  if (disk_inode == NULL)
+    return false;
+  disk_inode->length = length;
+  disk_inode->magic = layout == INODE_EXTENTS ? EXTENT_MAGIC : INODE_MAGIC;
+  meta_write (sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
+  free (disk_inode);
+  return true;
 }
 
 /* Reads an inode from SECTOR
@@ -111,17 +556,24 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
+  struct list *bucket = open_inodes_bucket (sector);
   struct list_elem *e;
   struct inode *inode;
 
+  lock_acquire (&open_inodes_lock);
+  open_cnt++;
+
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  for (e = list_begin (bucket); e != list_end (bucket); e = list_next (e)) 
     {
       inode = list_entry (e, struct inode, elem);
+      open_probes++;
       if (inode->sector == sector) 
         {
-          inode_reopen (inode);
+          inode->open_cnt++;
+          while (!inode->loaded)
+            cond_wait (&inode_loaded, &open_inodes_lock);
+          lock_release (&open_inodes_lock);
           return inode; 
         }
     }
@@ -129,15 +581,33 @@ inode_open (block_sector_t sector)
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize.  The inode is read from disk after releasing
+     open_inodes_lock, so that opens of other inodes need not
+     wait for the disk.  A concurrent opener of the same sector
+     waits for LOADED instead. */
+  list_push_front (bucket, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->loaded = false;
+  rwlock_init (&inode->rwlock);
+  lock_init (&inode->hint_lock);
+  memset (inode->hints, 0, sizeof inode->hints);
+  inode->next_hint = 0;
+  lock_release (&open_inodes_lock);
+
+  meta_read (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+
+  lock_acquire (&open_inodes_lock);
+  inode->loaded = true;
+  cond_broadcast (&inode_loaded, &open_inodes_lock);
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -146,7 +616,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -163,22 +637,38 @@ inode_get_inumber (const struct inode *inode)
 void
 inode_close (struct inode *inode) 
 {
+  bool last;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
-  /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  lock_acquire (&open_inodes_lock);
+  last = --inode->open_cnt == 0;
+  if (last)
+    list_remove (&inode->elem);
+  lock_release (&open_inodes_lock);
+
+  /* Release resources if this was the last opener.  No other
+     thread can reach INODE any longer. */
+  if (last)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
       /* Deallocate blocks if removed. */
       if (inode->removed) 
         {
+          struct inode_disk *d = &inode->data;
+          size_t i;
+
+          if (d->magic == EXTENT_MAGIC)
+            release_extents (inode);
+          else
+            {
+              for (i = 0; i < DIRECT_CNT; i++)
+                release_index (d->u.indexed.direct[i], 0);
+              release_index (d->u.indexed.indirect, 1);
+              release_index (d->u.indexed.doubly_indirect, 2);
+            }
           free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
         }
 
       free (inode); 
@@ -191,7 +681,9 @@ void
 inode_remove (struct inode *inode) 
 {
   ASSERT (inode != NULL);
+  lock_acquire (&open_inodes_lock);
   inode->removed = true;
+  lock_release (&open_inodes_lock);
 }
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
@@ -202,12 +694,13 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+  off_t next;
 
+  rwlock_acquire_read (&inode->rwlock);
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx = byte_to_sector (inode, offset, false);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -220,110 +713,112 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      if (sector_idx == 0)
         {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
+          /* A hole reads as zeros. */
+          memset (buffer + bytes_read, 0, chunk_size);
         }
-      else 
+      else if (chunk_size == BLOCK_SECTOR_SIZE)
         {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
+          /* Read the whole sectors that follow this one on disk
+             along with it. */
+          off_t run_left = size < inode_left ? size : inode_left;
+          size_t cnt = 1;
+
+          while (cnt < READ_RUN_MAX
+                 && (off_t) (cnt + 1) * BLOCK_SECTOR_SIZE <= run_left
+                 && (byte_to_sector (inode, offset + cnt * BLOCK_SECTOR_SIZE,
+                                     false)
+                     == sector_idx + cnt))
+            cnt++;
+          chunk_size = cnt * BLOCK_SECTOR_SIZE;
+          cache_read_run (sector_idx, cnt, buffer + bytes_read);
         }
+      else
+        cache_read (sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+
+  /* Fetch the next sector in the background, in case the caller
+     goes on reading sequentially. */
+  next = ROUND_UP (offset, BLOCK_SECTOR_SIZE);
+  if (bytes_read > 0 && next < inode_length (inode))
+    {
+      block_sector_t next_sector = byte_to_sector (inode, next, false);
+      if (next_sector != 0)
+        cache_readahead (next_sector);
+    }
+  rwlock_release_read (&inode->rwlock);
 
   return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
-   Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   A write past end of file extends the file, leaving a hole
+   between the old end and OFFSET.  Returns the number of bytes
+   actually written, which may be less than SIZE if the disk
+   fills up or the file reaches its maximum size. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
 
+  rwlock_acquire_write (&inode->rwlock);
   if (inode->deny_write_cnt)
-    return 0;
+    {
+      rwlock_release_write (&inode->rwlock);
+      return 0;
+    }
 
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx = byte_to_sector (inode, offset, true);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
-      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
-
       /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
+      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
+      int chunk_size = size < sector_left ? size : sector_left;
+      if (sector_idx == 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
-        }
+      /* The cache reads in the rest of a partial sector. */
+      cache_write (sector_idx, buffer + bytes_written, sector_ofs,
+                   chunk_size);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
+
+  /* Extend the file if we wrote past its end. */
+  if (bytes_written > 0 && offset > inode->data.length)
+    {
+      inode->data.length = offset;
+      meta_write (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+    }
+  rwlock_release_write (&inode->rwlock);
 
   return bytes_written;
 }
 
 /* Disables writes to INODE.
-   May be called at most once per inode opener. */
+   May be called at most once per inode opener.
+   Waits for writes already in progress to finish. */
 void
 inode_deny_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rwlock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_write (&inode->rwlock);
 }
 
 /* Re-enables writes to INODE.
@@ -332,9 +827,11 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rwlock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release_write (&inode->rwlock);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
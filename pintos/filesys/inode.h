@@ -6,8 +6,19 @@
 #include "devices/block.h"
 
 struct bitmap;
+struct inode;
+
+/* How an inode finds the sectors of its data. */
+enum inode_layout
+  {
+    INODE_INDEXED,              /* Direct and indirect sector pointers. */
+    INODE_EXTENTS               /* Runs of consecutive sectors. */
+  };
 
 void inode_init (void);
+void inode_set_layout (enum inode_layout);
+enum inode_layout inode_get_layout (const struct inode *);
+void inode_print_stats (void);
 bool inode_create (block_sector_t, off_t);
 struct inode *inode_open (block_sector_t);
 struct inode *inode_reopen (struct inode *);
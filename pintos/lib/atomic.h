@@ -0,0 +1,76 @@
+#ifndef __LIB_ATOMIC_H
+#define __LIB_ATOMIC_H
+
+#include <stdint.h>
+
+/* Atomic operations on 32-bit words, for the 80x86.  Used by
+   both the kernel and user programs.
+
+   Each read-modify-write operation uses a LOCK-prefixed
+   instruction, so it is atomic with respect to interrupts and to
+   other CPUs, and it is also a full memory barrier: the CPU does
+   not move loads or stores across it, and the "memory" clobber
+   keeps the compiler from doing so either.  See [IA32-v3a] 7.1.2
+   "Bus Locking" and 7.2 "Memory Ordering". */
+
+/* Atomically compares *P with OLD and, if they are equal, stores
+   NEW into *P.  Returns the value that *P had beforehand, which
+   equals OLD exactly if the store took place. */
+static inline uint32_t
+atomic_cmpxchg (volatile uint32_t *p, uint32_t old, uint32_t new)
+{
+  uint32_t prev;
+  asm volatile ("lock cmpxchgl %2, %1"
+                : "=a" (prev), "+m" (*p)
+                : "r" (new), "0" (old)
+                : "memory", "cc");
+  return prev;
+}
+
+/* Atomically adds DELTA to *P and returns the value that *P had
+   beforehand. */
+static inline uint32_t
+atomic_xadd (volatile uint32_t *p, uint32_t delta)
+{
+  asm volatile ("lock xaddl %0, %1"
+                : "+r" (delta), "+m" (*p)
+                :
+                : "memory", "cc");
+  return delta;
+}
+
+/* Atomically stores NEW into *P and returns the value that *P
+   had beforehand.  (XCHG with a memory operand is always
+   locked.) */
+static inline uint32_t
+atomic_xchg (volatile uint32_t *p, uint32_t new)
+{
+  asm volatile ("xchgl %0, %1"
+                : "+r" (new), "+m" (*p)
+                :
+                : "memory");
+  return new;
+}
+
+/* Reads *P.  An aligned 32-bit load is atomic by itself. */
+static inline uint32_t
+atomic_read (const volatile uint32_t *p)
+{
+  return *p;
+}
+
+/* Memory barriers.
+
+   mb() orders all earlier loads and stores before all later
+   ones.  Pintos targets CPUs that may predate SSE2's MFENCE, so
+   it uses a locked no-op on the stack, which is a full barrier
+   on every 80x86.
+
+   The 80x86 never reorders loads with other loads or stores
+   with other stores, so rmb() and wmb() need only keep the
+   compiler from reordering, like barrier() in threads/synch.h. */
+#define mb() asm volatile ("lock addl $0, (%%esp)" : : : "memory", "cc")
+#define rmb() asm volatile ("" : : : "memory")
+#define wmb() asm volatile ("" : : : "memory")
+
+#endif /* lib/atomic.h */
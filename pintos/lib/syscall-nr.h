@@ -28,7 +28,16 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Extensions. */
+    SYS_CLOCK_NS,               /* Nanoseconds since boot. */
+    SYS_FUTEX_WAIT,             /* Wait for a user word to change. */
+    SYS_FUTEX_WAKE,             /* Wake threads waiting on a user word. */
+    SYS_THREAD_CREATE,          /* Start a thread in this process. */
+    SYS_THREAD_JOIN,            /* Wait for a thread to exit. */
+    SYS_THREAD_EXIT,            /* End the calling thread. */
+    SYS_WAIT_ANY                /* Wait for any child process to die. */
   };
 
 #endif /* lib/syscall-nr.h */
@@ -0,0 +1,100 @@
+#include <synch.h>
+#include <atomic.h>
+#include <limits.h>
+#include <syscall.h>
+
+/* The mutex follows "mutex 2" in Ulrich Drepper, "Futexes Are
+   Tricky".  Its state is 0 when unlocked, 1 when locked with no
+   waiters, and 2 when locked with possible waiters.  Only a
+   thread that finds the mutex locked, or an unlock that finds
+   the state at 2, enters the kernel. */
+
+/* Initializes mutex M to unlocked. */
+void
+mutex_init (struct mutex *m) 
+{
+  m->state = 0;
+}
+
+/* Acquires mutex M, sleeping until it is available if
+   necessary. */
+void
+mutex_lock (struct mutex *m) 
+{
+  uint32_t state = atomic_cmpxchg (&m->state, 0, 1);
+  if (state == 0)
+    return;
+
+  /* Mark the mutex contended, then sleep until an unlock finds
+     it that way and wakes us. */
+  if (state != 2)
+    state = atomic_xchg (&m->state, 2);
+  while (state != 0) 
+    {
+      futex_wait (&m->state, 2);
+      state = atomic_xchg (&m->state, 2);
+    }
+}
+
+/* Acquires mutex M if it is unlocked and returns true, or
+   returns false without waiting if it is locked. */
+bool
+mutex_trylock (struct mutex *m) 
+{
+  return atomic_cmpxchg (&m->state, 0, 1) == 0;
+}
+
+/* Releases mutex M, which the caller must hold, and wakes a
+   thread waiting for it, if any. */
+void
+mutex_unlock (struct mutex *m) 
+{
+  if (atomic_xadd (&m->state, -1) != 1) 
+    {
+      m->state = 0;
+      futex_wake (&m->state, 1);
+    }
+}
+
+/* Initializes condition variable C. */
+void
+cond_init (struct condvar *c) 
+{
+  c->seq = 0;
+}
+
+/* Atomically releases mutex M and waits for C to be signaled,
+   then reacquires M before returning.  M must be held by the
+   caller.  May return without a signal. */
+void
+cond_wait (struct condvar *c, struct mutex *m) 
+{
+  uint32_t seq = atomic_read (&c->seq);
+
+  /* A signal between the unlock and the wait changes the
+     sequence number, so futex_wait() returns at once instead of
+     missing it. */
+  mutex_unlock (m);
+  futex_wait (&c->seq, seq);
+
+  /* Lock as contended, because other waiters may have been woken
+     along with us and be waiting for M. */
+  while (atomic_xchg (&m->state, 2) != 0)
+    futex_wait (&m->state, 2);
+}
+
+/* Wakes one thread waiting on C, if any. */
+void
+cond_signal (struct condvar *c) 
+{
+  atomic_xadd (&c->seq, 1);
+  futex_wake (&c->seq, 1);
+}
+
+/* Wakes all threads waiting on C. */
+void
+cond_broadcast (struct condvar *c) 
+{
+  atomic_xadd (&c->seq, 1);
+  futex_wake (&c->seq, INT_MAX);
+}
@@ -0,0 +1,41 @@
+#ifndef __LIB_USER_SYNCH_H
+#define __LIB_USER_SYNCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* A mutex for user programs.  Locking and unlocking an
+   uncontended mutex take one atomic instruction each and never
+   enter the kernel; a thread that has to wait sleeps in
+   futex_wait(). */
+struct mutex
+  {
+    uint32_t state;             /* 0: unlocked, 1: locked,
+                                   2: locked, maybe with waiters. */
+  };
+
+#define MUTEX_INITIALIZER { 0 }
+
+void mutex_init (struct mutex *);
+void mutex_lock (struct mutex *);
+bool mutex_trylock (struct mutex *);
+void mutex_unlock (struct mutex *);
+
+/* A condition variable for user programs, used with a mutex.
+   Signaling a condition variable enters the kernel to wake
+   waiters.  As with most condition variables, cond_wait() may
+   return without a signal, so callers must recheck their
+   condition in a loop. */
+struct condvar
+  {
+    uint32_t seq;               /* Incremented by every signal. */
+  };
+
+#define CONDVAR_INITIALIZER { 0 }
+
+void cond_init (struct condvar *);
+void cond_wait (struct condvar *, struct mutex *);
+void cond_signal (struct condvar *);
+void cond_broadcast (struct condvar *);
+
+#endif /* lib/user/synch.h */
@@ -87,6 +87,12 @@ wait (pid_t pid)
   return syscall1 (SYS_WAIT, pid);
 }
 
+pid_t
+wait_any (int *status)
+{
+  return syscall1 (SYS_WAIT_ANY, status);
+}
+
 bool
 create (const char *file, unsigned initial_size)
 {
@@ -182,3 +188,57 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+int64_t
+clock_ns (void) 
+{
+  int64_t ns;
+
+  /* The 64-bit result comes back in EDX:EAX. */
+  asm volatile
+    ("pushl %[number]; int $0x30; addl $4, %%esp"
+     : "=A" (ns)
+     : [number] "i" (SYS_CLOCK_NS)
+     : "memory");
+  return ns;
+}
+
+int
+futex_wait (uint32_t *addr, uint32_t val) 
+{
+  return syscall2 (SYS_FUTEX_WAIT, addr, val);
+}
+
+int
+futex_wake (uint32_t *addr, int n) 
+{
+  return syscall2 (SYS_FUTEX_WAKE, addr, n);
+}
+
+/* Entry point for threads started by thread_create().  Runs
+   FUNC(AUX) and ends the thread when it returns. */
+static void
+thread_start (void (*func) (void *), void *aux) 
+{
+  func (aux);
+  thread_exit ();
+}
+
+tid_t
+thread_create (void (*func) (void *aux), void *aux) 
+{
+  return syscall3 (SYS_THREAD_CREATE, thread_start, func, aux);
+}
+
+int
+thread_join (tid_t tid) 
+{
+  return syscall1 (SYS_THREAD_JOIN, tid);
+}
+
+void
+thread_exit (void) 
+{
+  syscall0 (SYS_THREAD_EXIT);
+  NOT_REACHED ();
+}
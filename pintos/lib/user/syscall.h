@@ -2,12 +2,17 @@
 #define __LIB_USER_SYSCALL_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <debug.h>
 
 /* Process identifier. */
 typedef int pid_t;
 #define PID_ERROR ((pid_t) -1)
 
+/* Thread identifier. */
+typedef int tid_t;
+#define TID_ERROR ((tid_t) -1)
+
 /* Map region identifier. */
 typedef int mapid_t;
 #define MAP_FAILED ((mapid_t) -1)
@@ -45,4 +50,13 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Extensions. */
+int64_t clock_ns (void);
+pid_t wait_any (int *status);
+int futex_wait (uint32_t *addr, uint32_t val);
+int futex_wake (uint32_t *addr, int n);
+tid_t thread_create (void (*func) (void *aux), void *aux);
+int thread_join (tid_t);
+void thread_exit (void) NO_RETURN;
+
 #endif /* lib/user/syscall.h */
@@ -0,0 +1,64 @@
+/* Child process for par-read test.
+   Reads the shared test file and this child's private test file
+   REPEAT_CNT times each, alternating between them, and checks
+   that the contents are what they should be. */
+
+#include <random.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/filesys/base/par-read.h"
+
+static char shared_buf[BUF_SIZE];
+static char private_buf[BUF_SIZE];
+
+/* Reads all of the file open as FD, whose name is NAME, in
+   BLOCK_SIZE pieces and compares it against EXPECTED. */
+static void
+read_file (int fd, const char *name, const char *expected) 
+{
+  char block[BLOCK_SIZE];
+  size_t ofs;
+
+  seek (fd, 0);
+  for (ofs = 0; ofs < BUF_SIZE; ofs += BLOCK_SIZE) 
+    {
+      CHECK (read (fd, block, BLOCK_SIZE) == BLOCK_SIZE,
+             "read \"%s\"", name);
+      compare_bytes (block, expected + ofs, BLOCK_SIZE, ofs, name);
+    }
+}
+
+int
+main (int argc, const char *argv[]) 
+{
+  char private_name[16];
+  int shared_fd, private_fd;
+  int child_idx;
+  int i;
+
+  test_name = "child-par-read";
+  quiet = true;
+
+  CHECK (argc == 2, "argc must be 2, actually %d", argc);
+  child_idx = atoi (argv[1]);
+  snprintf (private_name, sizeof private_name, "private%d", child_idx);
+
+  random_init (par_read_seed (-1));
+  random_bytes (shared_buf, sizeof shared_buf);
+  random_init (par_read_seed (child_idx));
+  random_bytes (private_buf, sizeof private_buf);
+
+  CHECK ((shared_fd = open (shared_name)) > 1, "open \"%s\"", shared_name);
+  CHECK ((private_fd = open (private_name)) > 1, "open \"%s\"", private_name);
+  for (i = 0; i < REPEAT_CNT; i++) 
+    {
+      read_file (shared_fd, shared_name, shared_buf);
+      read_file (private_fd, private_name, private_buf);
+    }
+  close (shared_fd);
+  close (private_fd);
+
+  return child_idx;
+}
@@ -0,0 +1,52 @@
+/* Creates many files, keeps all of them open at once, and
+   measures how long open() takes while they are.  Each open()
+   looks the file's inode up among all the open ones. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 256            /* Number of files. */
+#define ROUNDS 8                /* Times each file is opened. */
+
+static int fds[FILE_CNT * ROUNDS];
+
+void
+test_main (void)
+{
+  char name[16];
+  int64_t start, elapsed;
+  int i, j;
+
+  msg ("creating %d files", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "file%d", i);
+      if (!create (name, 0))
+        fail ("create \"%s\"", name);
+    }
+
+  msg ("opening each file %d times", ROUNDS);
+  start = clock_ns ();
+  for (j = 0; j < ROUNDS; j++)
+    for (i = 0; i < FILE_CNT; i++)
+      {
+        int fd;
+
+        snprintf (name, sizeof name, "file%d", i);
+        fd = open (name);
+        if (fd < 2)
+          fail ("open \"%s\"", name);
+        fds[j * FILE_CNT + i] = fd;
+      }
+  elapsed = clock_ns () - start;
+
+  msg ("closing all files");
+  for (i = 0; i < FILE_CNT * ROUNDS; i++)
+    close (fds[i]);
+
+  msg ("%d opens: %d us per open", FILE_CNT * ROUNDS,
+       (int) (elapsed / (FILE_CNT * ROUNDS) / 1000));
+  msg ("PASS");
+}
@@ -0,0 +1,26 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+
+# With all 256 files open, a single list of open inodes would
+# take about 128 probes per open.  The hashed table should take
+# only a few.
+my ($opens, $probes) = map (/^Inodes: (\d+) opens, (\d+) open inodes probed$/,
+			    @output);
+fail "missing open inode statistics in output" unless defined $probes;
+fail "no inodes opened" if $opens == 0;
+my ($avg) = $probes / $opens;
+fail sprintf ("%.1f open inodes probed per open, expected fewer than 4", $avg)
+  if $avg >= 4;
+
+@output = get_core_output ("run", @output);
+fail "missing PASS in output"
+  unless grep ($_ eq '(open-bench) PASS', @output);
+
+pass;
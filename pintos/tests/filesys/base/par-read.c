@@ -0,0 +1,50 @@
+/* Multi-process read benchmark.  Creates one shared file and one
+   private file per child, then spawns CHILD_CNT child processes
+   that each read the shared file and their own private file
+   several times over, in block-sized pieces.  With per-inode
+   locking, readers of different files, and readers of the same
+   file, should proceed without serializing on each other; the
+   run time of this test measures how well they do. */
+
+#include <random.h>
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/filesys/base/par-read.h"
+
+static char buf[BUF_SIZE];
+
+/* Creates file NAME and fills it with random data generated from
+   SEED. */
+static void
+make_file (const char *name, unsigned long seed) 
+{
+  int fd;
+
+  CHECK (create (name, sizeof buf), "create \"%s\"", name);
+  CHECK ((fd = open (name)) > 1, "open \"%s\"", name);
+  random_init (seed);
+  random_bytes (buf, sizeof buf);
+  CHECK (write (fd, buf, sizeof buf) == sizeof buf, "write \"%s\"", name);
+  msg ("close \"%s\"", name);
+  close (fd);
+}
+
+void
+test_main (void) 
+{
+  pid_t children[CHILD_CNT];
+  int i;
+
+  make_file (shared_name, par_read_seed (-1));
+  for (i = 0; i < CHILD_CNT; i++) 
+    {
+      char name[16];
+      snprintf (name, sizeof name, "private%d", i);
+      make_file (name, par_read_seed (i));
+    }
+
+  exec_children ("child-par-read", children, CHILD_CNT);
+  wait_children (children, CHILD_CNT);
+}
@@ -0,0 +1,61 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(par-read) begin
+(par-read) create "shared"
+(par-read) open "shared"
+(par-read) write "shared"
+(par-read) close "shared"
+(par-read) create "private0"
+(par-read) open "private0"
+(par-read) write "private0"
+(par-read) close "private0"
+(par-read) create "private1"
+(par-read) open "private1"
+(par-read) write "private1"
+(par-read) close "private1"
+(par-read) create "private2"
+(par-read) open "private2"
+(par-read) write "private2"
+(par-read) close "private2"
+(par-read) create "private3"
+(par-read) open "private3"
+(par-read) write "private3"
+(par-read) close "private3"
+(par-read) create "private4"
+(par-read) open "private4"
+(par-read) write "private4"
+(par-read) close "private4"
+(par-read) create "private5"
+(par-read) open "private5"
+(par-read) write "private5"
+(par-read) close "private5"
+(par-read) create "private6"
+(par-read) open "private6"
+(par-read) write "private6"
+(par-read) close "private6"
+(par-read) create "private7"
+(par-read) open "private7"
+(par-read) write "private7"
+(par-read) close "private7"
+(par-read) exec child 1 of 8: "child-par-read 0"
+(par-read) exec child 2 of 8: "child-par-read 1"
+(par-read) exec child 3 of 8: "child-par-read 2"
+(par-read) exec child 4 of 8: "child-par-read 3"
+(par-read) exec child 5 of 8: "child-par-read 4"
+(par-read) exec child 6 of 8: "child-par-read 5"
+(par-read) exec child 7 of 8: "child-par-read 6"
+(par-read) exec child 8 of 8: "child-par-read 7"
+(par-read) wait for child 1 of 8 returned 0 (expected 0)
+(par-read) wait for child 2 of 8 returned 1 (expected 1)
+(par-read) wait for child 3 of 8 returned 2 (expected 2)
+(par-read) wait for child 4 of 8 returned 3 (expected 3)
+(par-read) wait for child 5 of 8 returned 4 (expected 4)
+(par-read) wait for child 6 of 8 returned 5 (expected 5)
+(par-read) wait for child 7 of 8 returned 6 (expected 6)
+(par-read) wait for child 8 of 8 returned 7 (expected 7)
+(par-read) end
+EOF
+pass;
@@ -0,0 +1,19 @@
+#ifndef TESTS_FILESYS_BASE_PAR_READ_H
+#define TESTS_FILESYS_BASE_PAR_READ_H
+
+#define CHILD_CNT 8
+#define BUF_SIZE 4096
+#define BLOCK_SIZE 512
+#define REPEAT_CNT 8
+
+static const char shared_name[] = "shared";
+
+/* Returns the random seed used to fill the file of child
+   CHILD_IDX, or of the shared file if CHILD_IDX is -1. */
+static inline unsigned long
+par_read_seed (int child_idx) 
+{
+  return child_idx + 1;
+}
+
+#endif /* tests/filesys/base/par-read.h */
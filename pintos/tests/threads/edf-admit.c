@@ -0,0 +1,79 @@
+/* Checks admission control for the EDF scheduling class: bad
+   parameters are refused, a thread can change its reservation,
+   and a reservation that would overcommit the CPU is refused
+   until an earlier one is given up. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+static thread_func admit_child;
+
+static struct semaphore child_try;
+static struct semaphore child_done;
+static bool child_admitted;
+
+void
+test_edf_admit (void) 
+{
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  sema_init (&child_try, 0);
+  sema_init (&child_done, 0);
+
+  if (thread_set_deadline (10, 0))
+    fail ("zero runtime admitted");
+  if (thread_set_deadline (10, 11))
+    fail ("runtime longer than period admitted");
+  msg ("bad parameters refused");
+
+  if (!thread_set_deadline (10, 5))
+    fail ("50%% reservation refused");
+  if (!thread_set_deadline (10, 9))
+    fail ("raising own reservation to 90%% refused");
+  if (thread_set_deadline (10, 10))
+    fail ("100%% reservation admitted");
+  msg ("own reservation changed within the limit");
+
+  thread_create ("edf-child", PRI_DEFAULT, admit_child, NULL);
+  sema_up (&child_try);
+  sema_down (&child_done);
+  if (child_admitted)
+    fail ("overcommitting reservation admitted");
+  msg ("second thread refused while CPU is reserved");
+
+  if (!thread_set_deadline (0, 0))
+    fail ("leaving EDF failed");
+  sema_up (&child_try);
+  sema_down (&child_done);
+  if (!child_admitted)
+    fail ("reservation refused after CPU was released");
+  msg ("second thread admitted after first left EDF");
+
+  if (thread_get_deadline_misses () != 0)
+    fail ("missed %u deadlines", thread_get_deadline_misses ());
+  sema_up (&child_try);
+  sema_down (&child_done);
+}
+
+/* Tries to reserve half of the CPU each time it is told to, then
+   leaves the EDF class again, until told the third time to
+   exit. */
+static void
+admit_child (void *aux UNUSED) 
+{
+  int i;
+
+  for (i = 0; i < 2; i++)
+    {
+      sema_down (&child_try);
+      child_admitted = thread_set_deadline (10, 5);
+      thread_set_deadline (0, 0);
+      sema_up (&child_done);
+    }
+  sema_down (&child_try);
+  sema_up (&child_done);
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(edf-admit) begin
+(edf-admit) bad parameters refused
+(edf-admit) own reservation changed within the limit
+(edf-admit) second thread refused while CPU is reserved
+(edf-admit) second thread admitted after first left EDF
+(edf-admit) end
+EOF
+pass;
@@ -0,0 +1,88 @@
+/* Runs an EDF thread that never stops to sleep alongside an
+   ordinary CPU-bound thread, and checks that budget enforcement
+   holds the EDF thread to its reservation: it must run out of
+   budget in nearly every period, and the ordinary thread must
+   get the rest of the CPU. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define PERIOD 10
+#define RUNTIME 3
+#define RUN_TICKS 200
+
+/* A thread that counts the timer ticks during which it ran. */
+struct spinner
+  {
+    bool edf;                   /* Join the EDF class? */
+    int ticks_seen;             /* # of distinct ticks seen. */
+    unsigned overruns;          /* EDF budget overruns. */
+    unsigned misses;            /* EDF deadlines missed. */
+  };
+
+static struct semaphore done;
+static int64_t end;
+
+static thread_func spin_thread;
+
+void
+test_edf_budget (void) 
+{
+  struct spinner greedy = {true, 0, 0, 0};
+  struct spinner hog = {false, 0, 0, 0};
+  int max_greedy = RUN_TICKS * RUNTIME / PERIOD + PERIOD;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  sema_init (&done, 0);
+  end = timer_ticks () + RUN_TICKS;
+  thread_create ("greedy", PRI_DEFAULT, spin_thread, &greedy);
+  thread_create ("hog", PRI_DEFAULT, spin_thread, &hog);
+  sema_down (&done);
+  sema_down (&done);
+
+  if (greedy.ticks_seen > max_greedy)
+    fail ("EDF thread ran for %d of %d ticks, reserved %d of every %d",
+          greedy.ticks_seen, RUN_TICKS, RUNTIME, PERIOD);
+  msg ("EDF thread was held to its reservation");
+  if (greedy.overruns < RUN_TICKS / PERIOD / 2)
+    fail ("EDF thread ran out of budget only %u times", greedy.overruns);
+  msg ("EDF thread ran out of budget in most periods");
+  if (greedy.misses != 0)
+    fail ("EDF thread missed %u deadlines", greedy.misses);
+  msg ("throttled EDF thread missed no deadlines");
+  if (hog.ticks_seen < RUN_TICKS / 2)
+    fail ("ordinary thread ran for only %d of %d ticks",
+          hog.ticks_seen, RUN_TICKS);
+  msg ("ordinary thread got the rest of the CPU");
+}
+
+/* Spins until END, counting the distinct timer ticks seen, in the
+   EDF class if S_->edf. */
+static void
+spin_thread (void *s_) 
+{
+  struct spinner *s = s_;
+  int64_t last = -1;
+  int64_t now;
+
+  if (s->edf && !thread_set_deadline (PERIOD, RUNTIME))
+    fail ("reservation refused");
+  while ((now = timer_ticks ()) < end)
+    if (now != last)
+      {
+        s->ticks_seen++;
+        last = now;
+      }
+  if (s->edf)
+    {
+      s->overruns = thread_current ()->edf_overruns;
+      s->misses = thread_get_deadline_misses ();
+    }
+  sema_up (&done);
+}
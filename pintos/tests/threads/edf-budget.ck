@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(edf-budget) begin
+(edf-budget) EDF thread was held to its reservation
+(edf-budget) EDF thread ran out of budget in most periods
+(edf-budget) throttled EDF thread missed no deadlines
+(edf-budget) ordinary thread got the rest of the CPU
+(edf-budget) end
+EOF
+pass;
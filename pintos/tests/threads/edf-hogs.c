@@ -0,0 +1,124 @@
+/* Runs two periodic EDF threads alongside CPU-bound ordinary
+   threads.  Each periodic thread does a little work at the start
+   of each of its periods and then sleeps until the next one.
+   Under round-robin scheduling the hogs would delay the periodic
+   threads by whole time slices, but EDF threads run ahead of
+   them, so no deadline may be missed. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define HOG_CNT 3
+#define JOB_CNT 20
+
+/* A periodic EDF thread. */
+struct periodic
+  {
+    int64_t period;             /* Ticks per period. */
+    int64_t runtime;            /* Reserved ticks per period. */
+    int64_t work;               /* Ticks to spin in each job. */
+    bool admitted;              /* Did thread_set_deadline() succeed? */
+    unsigned misses;            /* Deadlines missed. */
+  };
+
+static struct periodic periodics[] =
+  {
+    {10, 3, 1, false, 0},
+    {25, 8, 3, false, 0},
+  };
+#define PERIODIC_CNT ((int) (sizeof periodics / sizeof *periodics))
+
+static volatile bool stop;
+static long long hog_loops[HOG_CNT];
+static struct semaphore periodic_done;
+static struct semaphore hog_done;
+
+static thread_func periodic_thread;
+static thread_func hog_thread;
+
+void
+test_edf_hogs (void) 
+{
+  long long loops = 0;
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  sema_init (&periodic_done, 0);
+  sema_init (&hog_done, 0);
+
+  for (i = 0; i < HOG_CNT; i++)
+    {
+      char name[16];
+      snprintf (name, sizeof name, "hog %d", i);
+      thread_create (name, PRI_DEFAULT, hog_thread, &hog_loops[i]);
+    }
+  for (i = 0; i < PERIODIC_CNT; i++)
+    {
+      char name[16];
+      snprintf (name, sizeof name, "periodic %d", i);
+      thread_create (name, PRI_DEFAULT, periodic_thread, &periodics[i]);
+    }
+  msg ("started %d hogs and %d periodic threads", HOG_CNT, PERIODIC_CNT);
+
+  for (i = 0; i < PERIODIC_CNT; i++)
+    sema_down (&periodic_done);
+  stop = true;
+  for (i = 0; i < HOG_CNT; i++)
+    sema_down (&hog_done);
+
+  for (i = 0; i < PERIODIC_CNT; i++)
+    {
+      struct periodic *p = &periodics[i];
+      if (!p->admitted)
+        fail ("periodic thread %d was not admitted", i);
+      if (p->misses != 0)
+        fail ("periodic thread %d missed %u of %d deadlines",
+              i, p->misses, JOB_CNT);
+      msg ("periodic thread %d met all %d deadlines", i, JOB_CNT);
+    }
+  for (i = 0; i < HOG_CNT; i++)
+    loops += hog_loops[i];
+  if (loops == 0)
+    fail ("hogs never ran");
+  msg ("hogs ran in the remaining time");
+}
+
+/* Runs JOB_CNT jobs of the periodic thread P_, each spinning for
+   P->work ticks at the start of a period. */
+static void
+periodic_thread (void *p_) 
+{
+  struct periodic *p = p_;
+  int64_t release;
+  int i;
+
+  p->admitted = thread_set_deadline (p->period, p->runtime);
+  release = timer_ticks ();
+  for (i = 0; i < JOB_CNT; i++)
+    {
+      while (timer_elapsed (release) < p->work)
+        continue;
+      release += p->period;
+      timer_sleep (release - timer_ticks ());
+    }
+  p->misses = thread_get_deadline_misses ();
+  sema_up (&periodic_done);
+}
+
+/* Spins until told to stop, counting loop iterations in
+   *LOOPS_. */
+static void
+hog_thread (void *loops_) 
+{
+  long long *loops = loops_;
+
+  while (!stop)
+    (*loops)++;
+  sema_up (&hog_done);
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(edf-hogs) begin
+(edf-hogs) started 3 hogs and 2 periodic threads
+(edf-hogs) periodic thread 0 met all 20 deadlines
+(edf-hogs) periodic thread 1 met all 20 deadlines
+(edf-hogs) hogs ran in the remaining time
+(edf-hogs) end
+EOF
+pass;
@@ -38,6 +38,12 @@ static const struct test tests[] =
     {"mlfqs-nice-2", test_mlfqs_nice_2},
     {"mlfqs-nice-10", test_mlfqs_nice_10},
     {"mlfqs-block", test_mlfqs_block},
+    {"thread-churn", test_thread_churn},
+    {"workqueue", test_workqueue},
+    {"lock-bench", test_lock_bench},
+    {"edf-admit", test_edf_admit},
+    {"edf-hogs", test_edf_hogs},
+    {"edf-budget", test_edf_budget},
   };
 
 static const char *test_name;
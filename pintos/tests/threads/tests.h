@@ -32,6 +32,12 @@ extern test_func test_mlfqs_fair_20;
 extern test_func test_mlfqs_nice_2;
 extern test_func test_mlfqs_nice_10;
 extern test_func test_mlfqs_block;
+extern test_func test_thread_churn;
+extern test_func test_workqueue;
+extern test_func test_lock_bench;
+extern test_func test_edf_admit;
+extern test_func test_edf_hogs;
+extern test_func test_edf_budget;
 
 void msg (const char *, ...);
 void fail (const char *, ...);
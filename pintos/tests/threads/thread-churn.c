@@ -0,0 +1,57 @@
+/* Thread creation benchmark.
+
+   Repeatedly creates a batch of threads that exit immediately
+   and waits for all of them to finish, then reports how many
+   threads were created and destroyed per second.  With the
+   thread page cache, most creations reuse the page of a thread
+   that has already exited instead of going to the page
+   allocator. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define BATCH_SIZE 8
+#define BATCH_CNT 500
+
+static thread_func exit_thread;
+
+void
+test_thread_churn (void) 
+{
+  struct semaphore done;
+  int64_t start, elapsed;
+  int batch, i;
+
+  msg ("Creating %d batches of %d threads.", BATCH_CNT, BATCH_SIZE);
+
+  sema_init (&done, 0);
+  start = timer_ns ();
+  for (batch = 0; batch < BATCH_CNT; batch++) 
+    {
+      for (i = 0; i < BATCH_SIZE; i++)
+        if (thread_create ("churn", PRI_DEFAULT, exit_thread, &done)
+            == TID_ERROR)
+          fail ("thread_create failed in batch %d", batch);
+      for (i = 0; i < BATCH_SIZE; i++)
+        sema_down (&done);
+    }
+  elapsed = timer_ns () - start;
+
+  if (elapsed > 0)
+    msg ("%lld threads/s (%lld ns per create and exit).",
+         (long long) BATCH_CNT * BATCH_SIZE * 1000000000 / elapsed,
+         elapsed / (BATCH_CNT * BATCH_SIZE));
+  pass ();
+}
+
+/* Signals the test and exits. */
+static void
+exit_thread (void *done_) 
+{
+  struct semaphore *done = done_;
+  sema_up (done);
+}
@@ -0,0 +1,34 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+
+# The test creates 500 batches of 8 threads.  After the first
+# batches, nearly every thread should get the page of one that
+# has already exited from the thread page cache, whose counts the
+# kernel prints at shutdown.
+my ($reused) = map (/^Thread: (\d+) pages reused, \d+ allocated$/, @output);
+fail "missing thread page statistics in output\n" if !defined $reused;
+fail "only $reused thread pages reused for 4000 threads, "
+  . "expected at least 2000\n"
+  if $reused < 2000;
+
+@output = get_core_output ("run", @output);
+fail "missing PASS in output"
+  unless grep ($_ eq '(thread-churn) PASS', @output);
+
+# A create and exit that reuses a cached page and a recycled tid
+# takes a few thousand instructions; 1 ms allows for slow
+# emulators.
+my ($ns) = map (/^\(thread-churn\) \d+ threads\/s \((\d+) ns per create and exit\)\.$/,
+		@output);
+fail "missing thread creation rate in output\n" if !defined $ns;
+fail "create and exit took $ns ns, expected at most 1000000 ns\n"
+  if $ns > 1000000;
+
+pass;
@@ -0,0 +1,83 @@
+/* Queues work items on both system workqueues and checks that
+   each runs exactly once, in the order queued, and that an item
+   cannot be queued again while it is still pending. */
+
+#include <stdio.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/workqueue.h"
+
+#define NORMAL_CNT 8
+#define HIGH_CNT 4
+#define WORK_CNT (NORMAL_CNT + HIGH_CNT)
+
+static struct work works[WORK_CNT];
+static int order[WORK_PRI_CNT][WORK_CNT];
+static int order_cnt[WORK_PRI_CNT];
+static int run_cnt[WORK_CNT];
+static struct semaphore done;
+
+static work_func record_work;
+
+void
+test_workqueue (void)
+{
+  enum intr_level old_level;
+  bool requeued;
+  int i, j;
+
+  sema_init (&done, 0);
+  for (i = 0; i < WORK_CNT; i++)
+    work_init (&works[i], record_work, (void *) i);
+
+  /* Keep the workers from running until everything is queued. */
+  old_level = intr_disable ();
+  for (i = 0; i < NORMAL_CNT; i++)
+    work_queue (WORK_NORMAL, &works[i]);
+  for (; i < WORK_CNT; i++)
+    work_queue (WORK_HIGH, &works[i]);
+  requeued = work_queue (WORK_NORMAL, &works[0]);
+  intr_set_level (old_level);
+
+  msg ("queued %d normal and %d high-priority items",
+       NORMAL_CNT, HIGH_CNT);
+  if (requeued)
+    fail ("pending item queued twice");
+  msg ("requeueing a pending item is refused");
+
+  for (i = 0; i < WORK_CNT; i++)
+    sema_down (&done);
+
+  for (i = 0; i < WORK_CNT; i++)
+    if (run_cnt[i] != 1)
+      fail ("item %d ran %d times", i, run_cnt[i]);
+  if (order_cnt[WORK_NORMAL] != NORMAL_CNT
+      || order_cnt[WORK_HIGH] != HIGH_CNT)
+    fail ("items ran on the wrong workqueue");
+  for (j = 0; j < NORMAL_CNT; j++)
+    if (order[WORK_NORMAL][j] != j)
+      fail ("normal item %d ran in position %d", order[WORK_NORMAL][j], j);
+  msg ("normal items ran in order");
+  for (j = 0; j < HIGH_CNT; j++)
+    if (order[WORK_HIGH][j] != NORMAL_CNT + j)
+      fail ("high-priority item %d ran in position %d",
+            order[WORK_HIGH][j], j);
+  msg ("high-priority items ran in order");
+}
+
+/* Records that work item W ran, and on which workqueue's
+   worker thread. */
+static void
+record_work (struct work *w)
+{
+  int id = (int) w->aux;
+  enum work_priority pri = (!strcmp (thread_name (), "kworker-high")
+                            ? WORK_HIGH : WORK_NORMAL);
+
+  order[pri][order_cnt[pri]++] = id;
+  run_cnt[id]++;
+  sema_up (&done);
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(workqueue) begin
+(workqueue) queued 8 normal and 4 high-priority items
+(workqueue) requeueing a pending item is refused
+(workqueue) normal items ran in order
+(workqueue) high-priority items ran in order
+(workqueue) end
+EOF
+pass;
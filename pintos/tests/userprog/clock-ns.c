@@ -0,0 +1,37 @@
+/* Tests the clock_ns system call: the clock must never run
+   backward, must advance while the process computes, and must
+   resolve intervals much shorter than a 10 ms timer tick. */
+
+#include <stdint.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* The clock must be able to tell apart readings this far apart,
+   in nanoseconds. */
+#define RESOLUTION_NS 1000000
+
+void
+test_main (void) 
+{
+  int64_t start, prev, now, min_step;
+  int i;
+
+  start = prev = clock_ns ();
+  CHECK (start > 0, "clock_ns() is positive");
+
+  min_step = INT64_MAX;
+  for (i = 0; i < 100000; i++) 
+    {
+      now = clock_ns ();
+      if (now < prev)
+        fail ("clock ran backward from %lld to %lld", prev, now);
+      if (now > prev && now - prev < min_step)
+        min_step = now - prev;
+      prev = now;
+    }
+
+  CHECK (prev > start, "clock advanced");
+  CHECK (min_step < RESOLUTION_NS, "clock resolution under %d ns",
+         RESOLUTION_NS);
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(clock-ns) begin
+(clock-ns) clock_ns() is positive
+(clock-ns) clock advanced
+(clock-ns) clock resolution under 1000000 ns
+(clock-ns) end
+clock-ns: exit(0)
+EOF
+pass;
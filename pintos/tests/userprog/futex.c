@@ -0,0 +1,35 @@
+/* Tests the futex system calls and the user mutex and condition
+   variable built on them, from a single thread: futex_wait()
+   must return at once when the word does not hold the expected
+   value, futex_wake() must find no waiters, and an uncontended
+   mutex must lock and unlock without sleeping. */
+
+#include <stdint.h>
+#include <synch.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  static uint32_t word = 42;
+  struct mutex m = MUTEX_INITIALIZER;
+  struct condvar c;
+
+  CHECK (futex_wait (&word, 41) == -1,
+         "futex_wait with a stale value returns at once");
+  CHECK (futex_wake (&word, 1) == 0, "futex_wake finds no waiters");
+
+  mutex_lock (&m);
+  CHECK (!mutex_trylock (&m), "locked mutex cannot be taken again");
+  mutex_unlock (&m);
+  CHECK (mutex_trylock (&m), "unlocked mutex can be taken");
+  mutex_unlock (&m);
+  CHECK (m.state == 0, "uncontended unlock leaves mutex free");
+
+  cond_init (&c);
+  cond_signal (&c);
+  cond_broadcast (&c);
+  CHECK (c.seq == 2, "signals without waiters are not lost or blocked");
+}
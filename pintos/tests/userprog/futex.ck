@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(futex) begin
+(futex) futex_wait with a stale value returns at once
+(futex) futex_wake finds no waiters
+(futex) locked mutex cannot be taken again
+(futex) unlocked mutex can be taken
+(futex) uncontended unlock leaves mutex free
+(futex) signals without waiters are not lost or blocked
+(futex) end
+futex: exit(0)
+EOF
+pass;
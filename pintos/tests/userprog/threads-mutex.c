@@ -0,0 +1,52 @@
+/* Starts several threads in one process that each add to a
+   shared counter under a user mutex, then joins them and checks
+   that no increment was lost.  Also checks that a thread cannot
+   be joined twice and that a bogus tid cannot be joined. */
+
+#include <synch.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define THREAD_CNT 4
+#define ITER_CNT 20000
+
+static struct mutex m = MUTEX_INITIALIZER;
+static volatile int counter;
+
+static void
+add (void *aux UNUSED) 
+{
+  int i;
+
+  for (i = 0; i < ITER_CNT; i++)
+    {
+      mutex_lock (&m);
+      counter++;
+      mutex_unlock (&m);
+    }
+}
+
+void
+test_main (void) 
+{
+  tid_t tids[THREAD_CNT];
+  int i;
+
+  for (i = 0; i < THREAD_CNT; i++)
+    {
+      tids[i] = thread_create (add, NULL);
+      if (tids[i] == TID_ERROR)
+        fail ("thread_create failed");
+    }
+  msg ("started %d threads", THREAD_CNT);
+
+  for (i = 0; i < THREAD_CNT; i++)
+    if (thread_join (tids[i]) != 0)
+      fail ("thread_join of thread %d failed", i);
+  msg ("joined %d threads", THREAD_CNT);
+
+  CHECK (counter == THREAD_CNT * ITER_CNT, "counter is %d", counter);
+  CHECK (thread_join (tids[0]) == -1, "second join is refused");
+  CHECK (thread_join (TID_ERROR) == -1, "bogus join is refused");
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(threads-mutex) begin
+(threads-mutex) started 4 threads
+(threads-mutex) joined 4 threads
+(threads-mutex) counter is 80000
+(threads-mutex) second join is refused
+(threads-mutex) bogus join is refused
+(threads-mutex) end
+threads-mutex: exit(0)
+EOF
+pass;
@@ -0,0 +1,43 @@
+/* Starts several children and reaps them with wait_any(), which
+   must return each child exactly once, with its exit status, and
+   then return -1 once no child is left. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CHILD_CNT 3
+
+void
+test_main (void) 
+{
+  pid_t children[CHILD_CNT];
+  bool reaped[CHILD_CNT];
+  int status;
+  int i, j;
+
+  for (i = 0; i < CHILD_CNT; i++) 
+    {
+      children[i] = exec ("child-simple");
+      if (children[i] == -1)
+        fail ("exec \"child-simple\" failed");
+      reaped[i] = false;
+    }
+
+  for (i = 0; i < CHILD_CNT; i++) 
+    {
+      pid_t pid = wait_any (&status);
+      for (j = 0; j < CHILD_CNT; j++)
+        if (children[j] == pid && !reaped[j])
+          break;
+      if (j == CHILD_CNT)
+        fail ("wait_any() returned unexpected pid %d", pid);
+      if (status != 81)
+        fail ("child %d exited with status %d, not 81", pid, status);
+      reaped[j] = true;
+    }
+  msg ("wait_any() returned each child once");
+
+  CHECK (wait_any (&status) == -1, "wait_any() with no children left");
+  CHECK (wait (children[0]) == -1, "wait() for a child already reaped");
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(wait-any) begin
+(child-simple) run
+(child-simple) run
+(child-simple) run
+(wait-any) wait_any() returned each child once
+(wait-any) wait_any() with no children left
+(wait-any) wait() for a child already reaped
+(wait-any) end
+EOF
+pass;
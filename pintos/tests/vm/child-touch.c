@@ -0,0 +1,23 @@
+/* Child process of exec-wait-bench.
+   Touches every page of a 1 MB buffer, so that its parent has a
+   full address space to tear down when it exits. */
+
+#include <stddef.h>
+#include "tests/lib.h"
+
+#define SIZE (1024 * 1024)
+#define PAGE_SIZE 4096
+static char buf[SIZE];
+
+int
+main (void)
+{
+  size_t i;
+
+  test_name = "child-touch";
+  quiet = true;
+
+  for (i = 0; i < SIZE; i += PAGE_SIZE)
+    buf[i] = 1;
+  return 0x42;
+}
@@ -0,0 +1,32 @@
+/* Measures how long a parent waits to exec and reap a child that
+   has touched 1 MB of memory.  Compare a run with the "-sync-reap"
+   kernel option, which frees the child's address space before
+   wait() returns, to one without it. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ROUNDS 16
+
+void
+test_main (void)
+{
+  int64_t start, elapsed;
+  int i;
+
+  start = clock_ns ();
+  for (i = 0; i < ROUNDS; i++)
+    {
+      pid_t child = exec ("child-touch");
+      if (child == -1)
+        fail ("exec \"child-touch\" failed");
+      if (wait (child) != 0x42)
+        fail ("wait for child %d failed", i);
+    }
+  elapsed = clock_ns () - start;
+
+  msg ("%d rounds of exec and wait: %d us per round",
+       ROUNDS, (int) (elapsed / ROUNDS / 1000));
+  msg ("PASS");
+}
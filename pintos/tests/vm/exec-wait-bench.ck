@@ -0,0 +1,35 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+
+# With "-sync-reap" every child frees its own address space, so
+# the reaper must have nothing to do.  Otherwise the reaper frees
+# them all, except perhaps the last child's if the kernel powers
+# off before the reaper gets to it.
+my ($rounds) = 16;
+my ($sync) = grep (/^Kernel command line:.* -sync-reap\b/, @output);
+my ($reaped) = map (/^Reaper: (\d+) address spaces in \d+ batches$/,
+		    @output);
+fail "missing reaper statistics in output" unless defined $reaped;
+if ($sync) {
+    fail "reaper freed $reaped address spaces despite -sync-reap"
+      if $reaped != 0;
+} else {
+    fail "reaper freed only $reaped address spaces for $rounds children"
+      if $reaped < $rounds - 1;
+}
+
+@output = get_core_output ("run", @output);
+my ($exits) = scalar (grep ($_ eq 'child-touch: exit(66)', @output));
+fail "$exits children exited with status 66, expected $rounds"
+  if $exits != $rounds;
+fail "missing PASS in output"
+  unless grep ($_ eq '(exec-wait-bench) PASS', @output);
+
+pass;
@@ -0,0 +1,33 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+
+# If an IDE disk was found to support DMA, its data must actually
+# have moved by DMA.  With "-pio", none of it may have.
+my ($pio) = grep (/^Kernel command line:.* -pio\b/, @output);
+my ($dma_disk) = grep (/^hd[a-d]: .*, DMA$/, @output);
+my ($dma) = map (/^IDE: (\d+) sectors by DMA, \d+ sectors by PIO$/, @output);
+fail "missing IDE statistics in output" unless defined $dma;
+if ($pio) {
+    fail "$dma sectors moved by DMA despite -pio" if $dma != 0;
+} elsif ($dma_disk) {
+    fail "no sectors moved by DMA although a disk supports it"
+      if $dma == 0;
+}
+
+@output = get_core_output ("run", @output);
+foreach my $name ('file write', 'file read', 'swap') {
+    my ($rate) = map (/^\(io-bench\) \Q$name\E: (\d+) kB\/s$/, @output);
+    fail "missing $name throughput in output" unless defined $rate;
+    fail "$name throughput is 0 kB/s" if $rate == 0;
+}
+fail "missing PASS in output"
+  unless grep ($_ eq '(io-bench) PASS', @output);
+
+pass;
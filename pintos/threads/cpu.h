@@ -0,0 +1,51 @@
+#ifndef THREADS_CPU_H
+#define THREADS_CPU_H
+
+#include <list.h>
+#include <stddef.h>
+
+/* Maximum number of CPUs that the scheduler keeps run queues
+   for. */
+#define CPU_MAX 8
+
+/* Per-CPU scheduler state.
+
+   Each CPU has its own run queue, so that making a thread ready
+   on one CPU does not contend with scheduling decisions on
+   another.  A CPU whose run queue runs dry steals work from the
+   busiest queue before going idle (see next_thread_to_run() in
+   thread.c), and every CPU periodically pulls cache-cold threads
+   from the busiest queue to even out the load.
+
+   Pintos only brings up the boot processor, so cpu_cnt is 1 and
+   only cpus[0] is ever used.  The run queues are protected by
+   disabling interrupts, which suffices on one CPU; a kernel that
+   starts the application processors must add a spinlock to each
+   queue. */
+struct cpu
+  {
+    int id;                     /* CPU number, 0 for the boot CPU. */
+    struct list ready_list;     /* THREAD_READY threads queued here. */
+    size_t ready_cnt;           /* Number of threads in ready_list. */
+    struct thread *idle_thread; /* Runs when nothing else is ready. */
+
+    /* Earliest-deadline-first class (see thread_set_deadline()).
+       EDF threads stay on the CPU where they joined the class and
+       always run ahead of the threads in READY_LIST. */
+    struct list edf_ready;      /* READY EDF threads, by deadline. */
+    struct list edf_threads;    /* All EDF threads on this CPU. */
+    int edf_util;               /* Reserved CPU share, per mille. */
+
+    /* Statistics. */
+    long long switch_cnt;       /* # of context switches. */
+    long long steal_cnt;        /* # of threads stolen while idle. */
+    long long balance_cnt;      /* # of threads pulled by balancing. */
+    long long edf_miss_cnt;     /* # of EDF deadlines missed. */
+  };
+
+extern struct cpu cpus[CPU_MAX];
+extern int cpu_cnt;
+
+struct cpu *cpu_current (void);
+
+#endif /* threads/cpu.h */
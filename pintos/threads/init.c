@@ -10,6 +10,7 @@
 #include <string.h>
 #include "devices/kbd.h"
 #include "devices/input.h"
+#include "devices/pci.h"
 #include "devices/serial.h"
 #include "devices/shutdown.h"
 #include "devices/timer.h"
@@ -20,11 +21,15 @@
 #include "threads/loader.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/profile.h"
 #include "threads/pte.h"
+#include "threads/sched-trace.h"
 #include "threads/thread.h"
+#include "threads/workqueue.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
+#include "userprog/futex.h"
 #include "userprog/gdt.h"
 #include "userprog/syscall.h"
 #include "userprog/tss.h"
@@ -34,6 +39,7 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/virtio-blk.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
@@ -51,6 +57,14 @@ uint32_t *init_page_dir;
 /* -f: Format the file system? */
 static bool format_filesys;
 
+/* -f=extents: Layout of the files of a newly formatted file
+   system. */
+static enum inode_layout format_layout = INODE_INDEXED;
+
+/* -f=hashdirs: Format of the directories of a newly formatted
+   file system. */
+static enum dir_format format_dirs = DIR_LINEAR;
+
 /* -filesys, -scratch, -swap: Names of block devices to use,
    overriding the defaults. */
 static const char *filesys_bdev_name;
@@ -124,18 +138,27 @@ main (void)
 #ifdef USERPROG
   exception_init ();
   syscall_init ();
+  futex_init ();
 #endif
 
   /* Start thread scheduler and enable interrupts. */
+  sched_trace_init ();
+  profile_init ();
   thread_start ();
+  workqueue_init ();
+#ifdef USERPROG
+  process_init ();
+#endif
   serial_init_queue ();
   timer_calibrate ();
+  pci_init ();
 
 #ifdef FILESYS
   /* Initialize file system. */
   ide_init ();
+  virtio_blk_init ();
   locate_block_devices ();
-  filesys_init (format_filesys);
+  filesys_init (format_filesys, format_layout, format_dirs);
 #endif
 
 #ifdef VM
@@ -258,11 +281,28 @@ parse_options (char **argv)
         shutdown_configure (SHUTDOWN_REBOOT);
 #ifdef FILESYS
       else if (!strcmp (name, "-f"))
-        format_filesys = true;
+        {
+          char *opt, *opt_ptr;
+
+          format_filesys = true;
+          if (value != NULL)
+            for (opt = strtok_r (value, ",", &opt_ptr); opt != NULL;
+                 opt = strtok_r (NULL, ",", &opt_ptr))
+              {
+                if (!strcmp (opt, "extents"))
+                  format_layout = INODE_EXTENTS;
+                else if (!strcmp (opt, "hashdirs"))
+                  format_dirs = DIR_HASHED;
+                else
+                  PANIC ("unknown file system format option `%s'", opt);
+              }
+        }
       else if (!strcmp (name, "-filesys"))
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-pio"))
+        ide_pio_only = true;
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -272,9 +312,17 @@ parse_options (char **argv)
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-periodic"))
+        timer_tickless = false;
+      else if (!strcmp (name, "-sched-trace"))
+        sched_trace_enabled = true;
+      else if (!strcmp (name, "-profile"))
+        profile_interval = value != NULL ? atoi (value) : 1;
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+      else if (!strcmp (name, "-sync-reap"))
+        process_sync_reap = true;
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -386,17 +434,24 @@ usage (void)
           "  -q                 Power off VM after actions or on panic.\n"
           "  -r                 Reboot after actions.\n"
 #ifdef FILESYS
-          "  -f                 Format file system device during startup.\n"
+          "  -f[=OPT,...]       Format file system device during startup.\n"
+          "                     OPT \"extents\" gives files extent-based\n"
+          "                     layouts, \"hashdirs\" hashes directories.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -pio               Move IDE disk data by PIO even if DMA works.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -periodic          Keep the timer tick running while idle.\n"
+          "  -sched-trace       Trace the scheduler and print latencies at shutdown.\n"
+          "  -profile[=N]       Sample the kernel every N timer ticks (default 1).\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+          "  -sync-reap         Free address spaces in exit, not in the reaper.\n"
 #endif
           );
   shutdown_power_off ();
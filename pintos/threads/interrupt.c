@@ -8,7 +8,12 @@
 #include "threads/io.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "threads/workqueue.h"
 #include "devices/timer.h"
+#ifdef USERPROG
+#include "userprog/gdt.h"
+#include "userprog/process.h"
+#endif
 
 /* Programmable Interrupt Controller (PIC) registers.
    A PC has two PICs, called the master and slave PICs, with the
@@ -47,6 +52,26 @@ static unsigned int unexpected_cnt[INTR_CNT];
 static bool in_external_intr;   /* Are we processing an external interrupt? */
 static bool yield_on_return;    /* Should we yield on interrupt return? */
 
+/* Softirqs.  An external interrupt handler raises a softirq to
+   defer work until just before the interrupt returns, after it
+   has been acknowledged on the PIC, when the softirq's handler
+   runs with interrupts on.  Another interrupt may arrive while
+   softirq handlers run, but it does not run softirqs or yield
+   itself: it leaves both to the interrupt it interrupted.  Like
+   external interrupt handlers, softirq handlers may not sleep.
+
+   Softirqs raised again and again could starve threads, so after
+   SOFTIRQ_RESTART_MAX passes, any still pending are handed off
+   to the high-priority workqueue.  Until the worker takes them,
+   interrupts leave newly raised softirqs pending for it too,
+   rather than running them. */
+#define SOFTIRQ_RESTART_MAX 10
+static softirq_func *softirq_handlers[SOFTIRQ_CNT];
+static uint32_t softirq_pending; /* Bit N set if softirq N raised. */
+static uint32_t softirq_deferred; /* Bit N set if N handed off. */
+static bool in_softirq;         /* Running softirq handlers? */
+static struct work softirq_work; /* Runs softirqs handed off. */
+
 /* Programmable Interrupt Controller helpers. */
 static void pic_init (void);
 static void pic_end_of_interrupt (int irq);
@@ -56,6 +81,10 @@ static uint64_t make_intr_gate (void (*) (void), int dpl);
 static uint64_t make_trap_gate (void (*) (void), int dpl);
 static inline uint64_t make_idtr_operand (uint16_t limit, void *base);
 
+/* Softirq helpers. */
+static void run_softirqs (void);
+static void softirq_work_func (struct work *);
+
 /* Interrupt handlers. */
 void intr_handler (struct intr_frame *args);
 static void unexpected_interrupt (const struct intr_frame *);
@@ -155,6 +184,8 @@ intr_init (void)
   intr_names[17] = "#AC Alignment Check Exception";
   intr_names[18] = "#MC Machine-Check Exception";
   intr_names[19] = "#XF SIMD Floating-Point Exception";
+
+  work_init (&softirq_work, softirq_work_func, NULL);
 }
 
 /* Registers interrupt VEC_NO to invoke HANDLER with descriptor
@@ -221,9 +252,94 @@ intr_context (void)
 void
 intr_yield_on_return (void) 
 {
-  ASSERT (intr_context ());
+  ASSERT (intr_context () || in_softirq);
   yield_on_return = true;
 }
+
+/* Registers HANDLER to run whenever softirq NR has been raised.
+   HANDLER runs with interrupts on but must not sleep. */
+void
+intr_register_softirq (enum softirq nr, softirq_func *handler)
+{
+  ASSERT (nr < SOFTIRQ_CNT);
+  ASSERT (softirq_handlers[nr] == NULL);
+
+  softirq_handlers[nr] = handler;
+}
+
+/* Raises softirq NR, so that its handler runs before the
+   current external interrupt returns.  May be called only from
+   an external interrupt handler or a softirq handler. */
+void
+intr_raise_softirq (enum softirq nr)
+{
+  ASSERT (nr < SOFTIRQ_CNT);
+  ASSERT (softirq_handlers[nr] != NULL);
+  ASSERT (intr_context () || in_softirq);
+
+  softirq_pending |= 1u << nr;
+}
+
+/* Returns true while softirq handlers are running, false at all
+   other times. */
+bool
+intr_softirq_context (void)
+{
+  return in_softirq;
+}
+
+/* Runs the handlers for pending softirqs, including any raised
+   while they run, until none remain or SOFTIRQ_RESTART_MAX
+   passes have been made.  Must be called with interrupts off,
+   and returns with them off, but enables interrupts while the
+   handlers run. */
+static void
+run_softirqs (void)
+{
+  int pass;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (!in_softirq);
+
+  in_softirq = true;
+  for (pass = 0; softirq_pending != 0; pass++)
+    {
+      uint32_t pending;
+      int nr;
+
+      if (pass >= SOFTIRQ_RESTART_MAX)
+        {
+          softirq_deferred |= softirq_pending;
+          softirq_pending = 0;
+          work_queue (WORK_HIGH, &softirq_work);
+          break;
+        }
+
+      pending = softirq_pending;
+      softirq_pending = 0;
+      intr_enable ();
+      for (nr = 0; nr < SOFTIRQ_CNT; nr++)
+        if (pending & (1u << nr))
+          softirq_handlers[nr] ();
+      intr_disable ();
+    }
+  in_softirq = false;
+}
+
+/* Runs softirqs that run_softirqs() handed off to a worker
+   thread. */
+static void
+softirq_work_func (struct work *w UNUSED)
+{
+  intr_disable ();
+  yield_on_return = false;
+  softirq_pending |= softirq_deferred;
+  softirq_deferred = 0;
+  run_softirqs ();
+  intr_enable ();
+  if (yield_on_return)
+    thread_yield ();
+}
 
 /* 8259A Programmable Interrupt Controller. */
 
@@ -358,7 +474,8 @@ intr_handler (struct intr_frame *frame)
       ASSERT (!intr_context ());
 
       in_external_intr = true;
-      yield_on_return = false;
+      if (!in_softirq)
+        yield_on_return = false;
     }
 
   /* Invoke the interrupt's handler. */
@@ -383,9 +500,28 @@ intr_handler (struct intr_frame *frame)
       in_external_intr = false;
       pic_end_of_interrupt (frame->vec_no); 
 
-      if (yield_on_return) 
-        thread_yield (); 
+      /* An interrupt that arrived while softirq handlers were
+         running leaves softirqs and yielding to the interrupt
+         that they are running for.  Softirqs handed off to the
+         workqueue are left to it. */
+      if (!in_softirq)
+        {
+          if (softirq_pending != 0 && softirq_deferred == 0)
+            run_softirqs ();
+          if (yield_on_return) 
+            thread_yield (); 
+        }
+    }
+
+#ifdef USERPROG
+  /* A thread whose process is being terminated by another of its
+     threads exits instead of returning to user mode. */
+  if (frame->cs == SEL_UCSEG && process_exiting ())
+    {
+      intr_enable ();
+      thread_exit ();
     }
+#endif
 }
 
 /* Handles an unexpected interrupt with interrupt frame F.  An
@@ -64,6 +64,22 @@ void intr_register_int (uint8_t vec, int dpl, enum intr_level,
 bool intr_context (void);
 void intr_yield_on_return (void);
 
+/* Softirqs: work that an external interrupt handler defers to
+   just before the interrupt returns, when it runs with
+   interrupts on.  Listed in the order they run. */
+enum softirq
+  {
+    SOFTIRQ_TIMER,              /* Timer sleeper wakeups. */
+    SOFTIRQ_BLOCK,              /* Block device completions. */
+    SOFTIRQ_VIRTIO,             /* Virtio block completions. */
+    SOFTIRQ_CNT                 /* Number of softirqs. */
+  };
+
+typedef void softirq_func (void);
+void intr_register_softirq (enum softirq, softirq_func *);
+void intr_raise_softirq (enum softirq);
+bool intr_softirq_context (void);
+
 void intr_dump_frame (const struct intr_frame *);
 const char *intr_name (uint8_t vec);
 
@@ -0,0 +1,184 @@
+#include "threads/profile.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Sampling profiler.
+
+   Every PROFILE_INTERVAL timer ticks, profile_tick() records the
+   kernel code that the timer interrupted: the interrupted EIP
+   followed by up to MAX_DEPTH - 1 return addresses found by
+   following the saved frame pointers up the kernel stack.
+   Identical stacks are counted together in a fixed-size hash
+   table, so the profiler never allocates memory once it is
+   running.  Samples that land in user code are only counted.
+
+   At shutdown the table is printed one stack per line, for
+   `backtrace --profile' or `backtrace --folded' to turn into a
+   flat profile or folded stacks for a flame graph. */
+
+/* Maximum number of addresses in a sampled stack. */
+#define MAX_DEPTH 8
+
+/* Number of distinct stacks the table can hold. */
+#define TABLE_SIZE 1024
+
+/* One distinct stack and the number of times it was seen. */
+struct profile_entry
+  {
+    uint32_t cnt;               /* Number of samples, 0 if unused. */
+    uint32_t depth;             /* Number of elements in PC. */
+    uintptr_t pc[MAX_DEPTH];    /* Innermost address first. */
+  };
+
+unsigned profile_interval;
+
+static struct profile_entry *table;
+static bool table_frozen;       /* Set when sampling has stopped. */
+static unsigned tick_cnt;       /* Ticks since the last sample. */
+static long long sample_cnt;    /* Samples of kernel code. */
+static long long user_cnt;      /* Samples of user code. */
+static long long dropped_cnt;   /* Samples lost to a full table. */
+
+static int backtrace (const struct intr_frame *, uintptr_t pc[MAX_DEPTH]);
+static unsigned hash_stack (const uintptr_t *, int depth);
+
+/* Allocates the sample table, if the profiler is enabled.  Must
+   be called after the page allocator is initialized. */
+void
+profile_init (void) 
+{
+  if (profile_interval == 0)
+    return;
+  table = palloc_get_multiple (PAL_ASSERT | PAL_ZERO,
+                               DIV_ROUND_UP (TABLE_SIZE * sizeof *table,
+                                             PGSIZE));
+}
+
+/* Called by the timer interrupt handler with the interrupted
+   context F at each timer tick. */
+void
+profile_tick (const struct intr_frame *f) 
+{
+  uintptr_t pc[MAX_DEPTH];
+  unsigned h, i;
+  int depth;
+
+  ASSERT (intr_context ());
+
+  if (table == NULL || table_frozen || ++tick_cnt < profile_interval)
+    return;
+  tick_cnt = 0;
+
+  /* The low bits of CS give the privilege level of the
+     interrupted code; anything but 0 is a user program. */
+  if ((f->cs & 3) != 0) 
+    {
+      user_cnt++;
+      return;
+    }
+
+  depth = backtrace (f, pc);
+  h = hash_stack (pc, depth);
+  for (i = 0; i < TABLE_SIZE; i++) 
+    {
+      struct profile_entry *e = &table[(h + i) % TABLE_SIZE];
+
+      if (e->cnt == 0) 
+        {
+          e->depth = depth;
+          memcpy (e->pc, pc, depth * sizeof *pc);
+        }
+      else if (e->depth != (uint32_t) depth
+               || memcmp (e->pc, pc, depth * sizeof *pc))
+        continue;
+      e->cnt++;
+      sample_cnt++;
+      return;
+    }
+  dropped_cnt++;
+}
+
+/* Prints the profile. */
+void
+profile_print_stats (void) 
+{
+  unsigned interval = profile_interval;
+  int i, j;
+
+  if (table == NULL)
+    return;
+
+  /* Stop sampling, so that the table holds still. */
+  table_frozen = true;
+  barrier ();
+
+  printf ("Profile: %lld kernel samples, %lld user, %lld dropped, "
+          "every %u tick(s)\n",
+          sample_cnt, user_cnt, dropped_cnt, interval);
+  for (i = 0; i < TABLE_SIZE; i++) 
+    {
+      const struct profile_entry *e = &table[i];
+
+      if (e->cnt == 0)
+        continue;
+      printf ("Profile sample %"PRIu32":", e->cnt);
+      for (j = 0; j < (int) e->depth; j++)
+        printf (" %#"PRIxPTR, e->pc[j]);
+      printf ("\n");
+    }
+}
+
+/* Stores the interrupted EIP from F in PC[0] and the return
+   addresses of its callers, innermost first, in the following
+   elements of PC, and returns the number of elements stored.
+
+   Stops at the first frame pointer that does not point into the
+   interrupted thread's kernel stack, so a function that does not
+   maintain a frame pointer ends the backtrace early rather than
+   leading it astray. */
+static int
+backtrace (const struct intr_frame *f, uintptr_t pc[MAX_DEPTH]) 
+{
+  /* A kernel-mode interrupt runs on the interrupted thread's
+     stack, so that thread's frames lie above F in F's page. */
+  uintptr_t lo = (uintptr_t) (f + 1);
+  uintptr_t hi = (uintptr_t) pg_round_down (f) + PGSIZE;
+  uintptr_t fp = f->ebp;
+  int depth = 0;
+
+  pc[depth++] = (uintptr_t) f->eip;
+  while (depth < MAX_DEPTH
+         && fp >= lo && fp + 2 * sizeof (uintptr_t) <= hi
+         && fp % sizeof (uintptr_t) == 0) 
+    {
+      const uintptr_t *frame = (const uintptr_t *) fp;
+
+      if (!is_kernel_vaddr ((void *) frame[1]))
+        break;
+      pc[depth++] = frame[1];
+      if (frame[0] <= fp)
+        break;
+      fp = frame[0];
+    }
+  return depth;
+}
+
+/* Returns a hash of the DEPTH addresses in PC. */
+static unsigned
+hash_stack (const uintptr_t *pc, int depth) 
+{
+  unsigned h = 2166136261u;
+  int i;
+
+  for (i = 0; i < depth; i++)
+    h = (h ^ pc[i]) * 16777619u;
+  return h;
+}
@@ -0,0 +1,14 @@
+#ifndef THREADS_PROFILE_H
+#define THREADS_PROFILE_H
+
+struct intr_frame;
+
+/* Number of timer ticks between samples, or 0 if the profiler is
+   disabled.  Set by kernel command-line option "-profile". */
+extern unsigned profile_interval;
+
+void profile_init (void);
+void profile_tick (const struct intr_frame *);
+void profile_print_stats (void);
+
+#endif /* threads/profile.h */
@@ -0,0 +1,306 @@
+#include "threads/sched-trace.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/tsc.h"
+#include "threads/cpu.h"
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Scheduler tracing.
+
+   Each CPU has a ring buffer of scheduling events, stamped with
+   the TSC.  Only the CPU that owns a ring writes to it, always
+   with interrupts off, so writers need no lock: an event is
+   filled in and then published by advancing the ring's head.
+   When the ring is full the oldest events are overwritten.
+
+   Alongside the raw events, each traced thread accumulates two
+   log2 histograms: how long it sat runnable in a run queue
+   before it got the CPU, and, for the subset of those waits that
+   began with thread_unblock(), how long the wakeup took.  Both
+   are printed at shutdown, followed by the contents of the rings
+   in a format that utils/sched-timeline turns into a timeline.
+
+   Everything is allocated only when tracing is enabled, so a
+   kernel booted without "-sched-trace" pays just a flag test in
+   the scheduler. */
+
+/* Pages of trace events per CPU. */
+#define RING_PAGES 8
+
+/* Number of threads with their own histograms.  Later threads
+   share the last slot. */
+#define THREAD_SLOTS 64
+
+/* Number of histogram buckets.  Bucket I counts latencies of
+   2**I to 2**(I+1) - 1 nanoseconds; the last bucket is open. */
+#define BUCKET_CNT 32
+
+/* Types of trace event. */
+enum sched_event_type
+  {
+    SCHED_BLOCK,                /* TID blocked itself. */
+    SCHED_WAKEUP,               /* TID was unblocked by thread OTHER. */
+    SCHED_SWITCH                /* OTHER left the CPU and TID got it. */
+  };
+
+/* One trace event. */
+struct sched_event
+  {
+    uint64_t tsc;               /* Time-stamp counter. */
+    int tid;                    /* Subject thread. */
+    int other;                  /* Other thread involved, or 0. */
+    uint8_t type;               /* One of enum sched_event_type. */
+    uint8_t state;              /* For SCHED_SWITCH, OTHER's new status. */
+  };
+
+/* A per-CPU ring of events. */
+struct sched_ring
+  {
+    uint32_t head;              /* Number of events ever written. */
+    uint32_t size;              /* Capacity of EVENTS. */
+    struct sched_event events[];
+  };
+
+/* Latency histogram. */
+struct sched_hist
+  {
+    uint32_t cnt;               /* Number of samples. */
+    uint64_t sum;               /* Total of samples, in cycles. */
+    uint64_t max;               /* Largest sample, in cycles. */
+    uint32_t buckets[BUCKET_CNT];
+  };
+
+/* Statistics for one traced thread. */
+struct sched_thread_stats
+  {
+    int tid;                    /* Thread, or 0 if slot is unused. */
+    char name[16];              /* Thread's name when first seen. */
+    struct sched_hist wait;     /* Runnable to running. */
+    struct sched_hist wakeup;   /* Unblocked to running. */
+  };
+
+bool sched_trace_enabled;
+
+static struct sched_ring *rings[CPU_MAX];
+static struct sched_thread_stats *stats;
+static int stats_used;
+
+static void record (int type, int tid, int other, int state, uint64_t tsc);
+static struct sched_thread_stats *thread_stats (struct thread *);
+static void hist_add (struct sched_hist *, uint64_t cycles);
+static void hist_print (const char *what, const struct sched_hist *);
+static uint64_t cycles_to_ns (uint64_t cycles);
+
+/* Allocates the trace buffers, if tracing is enabled.  Must be
+   called after the page allocator is initialized and before the
+   scheduler starts. */
+void
+sched_trace_init (void) 
+{
+  size_t stats_pages;
+  int i;
+
+  if (!sched_trace_enabled)
+    return;
+
+  for (i = 0; i < cpu_cnt; i++) 
+    {
+      rings[i] = palloc_get_multiple (PAL_ASSERT | PAL_ZERO, RING_PAGES);
+      rings[i]->size = ((RING_PAGES * PGSIZE - sizeof *rings[i])
+                        / sizeof *rings[i]->events);
+    }
+
+  stats_pages = DIV_ROUND_UP (THREAD_SLOTS * sizeof *stats, PGSIZE);
+  stats = palloc_get_multiple (PAL_ASSERT | PAL_ZERO, stats_pages);
+}
+
+/* Records that thread T, which must be running, is about to
+   block. */
+void
+sched_trace_block (struct thread *t) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  record (SCHED_BLOCK, t->tid, 0, 0, tsc_read ());
+}
+
+/* Records that thread T has just been made ready by the running
+   thread. */
+void
+sched_trace_unblock (struct thread *t) 
+{
+  uint64_t now = tsc_read ();
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  t->trace_ready = now;
+  t->trace_woken = true;
+  record (SCHED_WAKEUP, t->tid, thread_current ()->tid, 0, now);
+}
+
+/* Records a context switch from PREV, whose status has already
+   been updated, to NEXT, and accounts NEXT's time spent waiting
+   to run. */
+void
+sched_trace_switch (struct thread *prev, struct thread *next) 
+{
+  uint64_t now = tsc_read ();
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  /* A thread that is preempted or yields starts waiting now. */
+  if (prev->status == THREAD_READY) 
+    {
+      prev->trace_ready = now;
+      prev->trace_woken = false;
+    }
+
+  if (next->trace_ready != 0) 
+    {
+      struct sched_thread_stats *s = thread_stats (next);
+      uint64_t delay = now - next->trace_ready;
+
+      hist_add (&s->wait, delay);
+      if (next->trace_woken)
+        hist_add (&s->wakeup, delay);
+      next->trace_ready = 0;
+    }
+
+  record (SCHED_SWITCH, next->tid, prev->tid, prev->status, now);
+}
+
+/* Stops tracing and prints the latency histograms and then the
+   trace. */
+void
+sched_trace_print_stats (void) 
+{
+  int i;
+
+  if (!sched_trace_enabled)
+    return;
+  sched_trace_enabled = false;
+
+  if (tsc_calibrated ())
+    printf ("Sched trace: %"PRIu64" TSC Hz, %d CPU(s)\n", tsc_hz (), cpu_cnt);
+  else
+    printf ("Sched trace: TSC not calibrated, times are in cycles\n");
+
+  for (i = 0; i < stats_used; i++) 
+    {
+      const struct sched_thread_stats *s = &stats[i];
+
+      if (i == THREAD_SLOTS - 1)
+        printf ("Sched thread %d+ (all others):\n", s->tid);
+      else
+        printf ("Sched thread %d \"%s\":\n", s->tid, s->name);
+      hist_print ("wait", &s->wait);
+      hist_print ("wakeup", &s->wakeup);
+    }
+
+  /* The timeline script merges the CPUs' events by timestamp. */
+  for (i = 0; i < cpu_cnt; i++) 
+    {
+      const struct sched_ring *r = rings[i];
+      uint32_t first = r->head > r->size ? r->head - r->size : 0;
+      uint32_t j;
+
+      printf ("Sched ring %d: %"PRIu32" events, %"PRIu32" overwritten\n",
+              i, r->head - first, first);
+      for (j = first; j != r->head; j++) 
+        {
+          const struct sched_event *e = &r->events[j % r->size];
+          printf ("sched-event %d %"PRIu64" %d %d %d %d\n",
+                  i, e->tsc, e->type, e->tid, e->other, e->state);
+        }
+    }
+}
+
+/* Appends an event to the running CPU's ring. */
+static void
+record (int type, int tid, int other, int state, uint64_t tsc) 
+{
+  struct sched_ring *r = rings[cpu_current ()->id];
+  struct sched_event *e;
+
+  if (r == NULL)
+    return;
+  e = &r->events[r->head % r->size];
+  e->tsc = tsc;
+  e->tid = tid;
+  e->other = other;
+  e->type = type;
+  e->state = state;
+  barrier ();
+  r->head++;
+}
+
+/* Returns the statistics slot for T, assigning one if T does
+   not have one yet. */
+static struct sched_thread_stats *
+thread_stats (struct thread *t) 
+{
+  if (t->trace_stats == NULL) 
+    {
+      struct sched_thread_stats *s;
+
+      if (stats_used < THREAD_SLOTS)
+        {
+          s = &stats[stats_used++];
+          s->tid = t->tid;
+          strlcpy (s->name, t->name, sizeof s->name);
+        }
+      else
+        s = &stats[THREAD_SLOTS - 1];
+      t->trace_stats = s;
+    }
+  return t->trace_stats;
+}
+
+/* Adds CYCLES to histogram H. */
+static void
+hist_add (struct sched_hist *h, uint64_t cycles) 
+{
+  uint64_t ns = cycles_to_ns (cycles);
+  int bucket = 0;
+
+  while (ns > 1 && bucket < BUCKET_CNT - 1) 
+    {
+      ns >>= 1;
+      bucket++;
+    }
+  h->buckets[bucket]++;
+  h->cnt++;
+  h->sum += cycles;
+  if (cycles > h->max)
+    h->max = cycles;
+}
+
+/* Prints histogram H, labeled WHAT, skipping empty buckets. */
+static void
+hist_print (const char *what, const struct sched_hist *h) 
+{
+  int i;
+
+  if (h->cnt == 0)
+    return;
+  printf ("  %s: %"PRIu32" samples, mean %"PRIu64" ns, max %"PRIu64" ns\n",
+          what, h->cnt, cycles_to_ns (h->sum / h->cnt), cycles_to_ns (h->max));
+  for (i = 0; i < BUCKET_CNT; i++)
+    if (h->buckets[i] != 0)
+      printf ("    >= %10"PRIu64" ns: %"PRIu32"\n",
+              i == 0 ? 0 : (uint64_t) 1 << i, h->buckets[i]);
+}
+
+/* Converts CYCLES to nanoseconds, if the TSC has been
+   calibrated. */
+static uint64_t
+cycles_to_ns (uint64_t cycles) 
+{
+  return tsc_calibrated () ? tsc_to_ns (cycles) : cycles;
+}
@@ -0,0 +1,19 @@
+#ifndef THREADS_SCHED_TRACE_H
+#define THREADS_SCHED_TRACE_H
+
+#include <stdbool.h>
+
+struct thread;
+
+/* If true (kernel command-line option "-sched-trace"), the
+   scheduler records its decisions in per-CPU trace buffers and
+   prints latency histograms and the trace at shutdown. */
+extern bool sched_trace_enabled;
+
+void sched_trace_init (void);
+void sched_trace_block (struct thread *);
+void sched_trace_unblock (struct thread *);
+void sched_trace_switch (struct thread *prev, struct thread *next);
+void sched_trace_print_stats (void);
+
+#endif /* threads/sched-trace.h */
@@ -27,10 +27,26 @@
 */
 
 #include "threads/synch.h"
+#include <atomic.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#ifdef LOCK_PROFILE
+#include "devices/tsc.h"
+
+static void profile_register (struct lock_profile *);
+static void profile_wait (struct lock_profile *, bool contended,
+                          uint64_t start);
+#endif
+
+/* Set in a semaphore's value while its waiters list is not
+   empty.  The rest of the value is the semaphore's count. */
+#define SEMA_WAITERS 0x80000000u
+
+static bool sema_down_fast (struct semaphore *);
+static void sema_set_waiters (struct semaphore *, bool);
 
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
@@ -40,14 +56,44 @@
      decrement it.
 
    - up or "V": increment the value (and wake up one waiting
-     thread, if any). */
+     thread, if any).
+
+   The value is only ever changed with atomic operations, and it
+   carries a SEMA_WAITERS flag that is set while any thread is
+   waiting.  A down that finds the count positive, or an up that
+   finds the flag clear, completes with a single compare-and-swap
+   and without disabling interrupts.  Only a down that must wait,
+   or an up that must wake a waiter, takes the slow path, which
+   manipulates the waiters list with interrupts off.  (That
+   suffices on a uniprocessor.  With more than one CPU, the slow
+   path would also need a spinlock around the waiters list.)
+
+   Neither path touches the semaphore after the operation that
+   lets a waiter proceed, so a thread may free a semaphore, or
+   return from the function whose stack holds it, as soon as its
+   down completes.
+
+   When the kernel is built with LOCK_PROFILE, sema_init() is a
+   macro that supplies PROFILE, shared by all the semaphores
+   initialized at the same place in the source. */
+#ifdef LOCK_PROFILE
+void
+sema_init_profiled (struct semaphore *sema, unsigned value,
+                    struct lock_profile *profile) 
+#else
 void
 sema_init (struct semaphore *sema, unsigned value) 
+#endif
 {
   ASSERT (sema != NULL);
+  ASSERT (value < SEMA_WAITERS);
 
   sema->value = value;
   list_init (&sema->waiters);
+#ifdef LOCK_PROFILE
+  sema->profile = profile;
+  profile_register (profile);
+#endif
 }
 
 /* Down or "P" operation on a semaphore.  Waits for SEMA's value
@@ -61,17 +107,34 @@ void
 sema_down (struct semaphore *sema) 
 {
   enum intr_level old_level;
+#ifdef LOCK_PROFILE
+  uint64_t start = tsc_read ();
+  bool contended = false;
+#endif
 
   ASSERT (sema != NULL);
   ASSERT (!intr_context ());
 
+  /* Profiled kernels always take the slow path, which does the
+     accounting. */
+#ifndef LOCK_PROFILE
+  if (sema_down_fast (sema))
+    return;
+#endif
+
   old_level = intr_disable ();
-  while (sema->value == 0) 
+  while (!sema_down_fast (sema)) 
     {
+#ifdef LOCK_PROFILE
+      contended = true;
+#endif
       list_push_back (&sema->waiters, &thread_current ()->elem);
+      sema_set_waiters (sema, true);
       thread_block ();
     }
-  sema->value--;
+#ifdef LOCK_PROFILE
+  profile_wait (sema->profile, contended, start);
+#endif
   intr_set_level (old_level);
 }
 
@@ -83,24 +146,40 @@ sema_down (struct semaphore *sema)
 bool
 sema_try_down (struct semaphore *sema) 
 {
-  enum intr_level old_level;
   bool success;
 
   ASSERT (sema != NULL);
 
-  old_level = intr_disable ();
-  if (sema->value > 0) 
+  success = sema_down_fast (sema);
+#ifdef LOCK_PROFILE
+  if (success && sema->profile != NULL)
     {
-      sema->value--;
-      success = true; 
+      enum intr_level old_level = intr_disable ();
+      sema->profile->acquire_cnt++;
+      intr_set_level (old_level);
     }
-  else
-    success = false;
-  intr_set_level (old_level);
+#endif
 
   return success;
 }
 
+/* Atomically decrements SEMA's count if it is positive.  Returns
+   true if successful, false if the count was 0. */
+static bool
+sema_down_fast (struct semaphore *sema) 
+{
+  uint32_t value = atomic_read (&sema->value);
+
+  while ((value & ~SEMA_WAITERS) > 0) 
+    {
+      uint32_t seen = atomic_cmpxchg (&sema->value, value, value - 1);
+      if (seen == value)
+        return true;
+      value = seen;
+    }
+  return false;
+}
+
 /* Up or "V" operation on a semaphore.  Increments SEMA's value
    and wakes up one thread of those waiting for SEMA, if any.
 
@@ -109,17 +188,53 @@ void
 sema_up (struct semaphore *sema) 
 {
   enum intr_level old_level;
+  uint32_t value;
 
   ASSERT (sema != NULL);
 
+  /* Fast path: no waiters.  A thread that starts waiting sets
+     SEMA_WAITERS first, which makes the compare-and-swap fail. */
+  value = atomic_read (&sema->value);
+  while (!(value & SEMA_WAITERS)) 
+    {
+      uint32_t seen = atomic_cmpxchg (&sema->value, value, value + 1);
+      if (seen == value)
+        return;
+      value = seen;
+    }
+
   old_level = intr_disable ();
   if (!list_empty (&sema->waiters)) 
     thread_unblock (list_entry (list_pop_front (&sema->waiters),
                                 struct thread, elem));
-  sema->value++;
+  sema_set_waiters (sema, !list_empty (&sema->waiters));
+  atomic_xadd (&sema->value, 1);
   intr_set_level (old_level);
 }
 
+/* Sets or clears SEMA_WAITERS in SEMA's value, according to
+   WAITERS.  Must be called with interrupts off. */
+static void
+sema_set_waiters (struct semaphore *sema, bool waiters) 
+{
+  uint32_t value = atomic_read (&sema->value);
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (;;) 
+    {
+      uint32_t new = waiters ? value | SEMA_WAITERS : value & ~SEMA_WAITERS;
+      uint32_t seen;
+
+      if (new == value)
+        break;
+      seen = atomic_cmpxchg (&sema->value, value, new);
+      if (seen == value)
+        break;
+      value = seen;
+    }
+}
+
 static void sema_test_helper (void *sema_);
 
 /* Self-test for semaphores that makes control "ping-pong"
@@ -171,7 +286,21 @@ sema_test_helper (void *sema_)
    another one "up" it, but with a lock the same thread must both
    acquire and release it.  When these restrictions prove
    onerous, it's a good sign that a semaphore should be used,
-   instead of a lock. */
+   instead of a lock.
+
+   When the kernel is built with LOCK_PROFILE, lock_init() is a
+   macro that supplies PROFILE, shared by all the locks
+   initialized at the same place in the source. */
+#ifdef LOCK_PROFILE
+void
+lock_init_profiled (struct lock *lock, struct lock_profile *profile)
+{
+  ASSERT (lock != NULL);
+
+  lock->holder = NULL;
+  sema_init_profiled (&lock->semaphore, 1, profile);
+}
+#else
 void
 lock_init (struct lock *lock)
 {
@@ -180,6 +309,7 @@ lock_init (struct lock *lock)
   lock->holder = NULL;
   sema_init (&lock->semaphore, 1);
 }
+#endif
 
 /* Acquires LOCK, sleeping until it becomes available if
    necessary.  The lock must not already be held by the current
@@ -198,6 +328,9 @@ lock_acquire (struct lock *lock)
 
   sema_down (&lock->semaphore);
   lock->holder = thread_current ();
+#ifdef LOCK_PROFILE
+  lock->acquired = tsc_read ();
+#endif
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -215,8 +348,13 @@ lock_try_acquire (struct lock *lock)
   ASSERT (!lock_held_by_current_thread (lock));
 
   success = sema_try_down (&lock->semaphore);
-  if (success)
-    lock->holder = thread_current ();
+  if (success) 
+    {
+      lock->holder = thread_current ();
+#ifdef LOCK_PROFILE
+      lock->acquired = tsc_read ();
+#endif
+    }
   return success;
 }
 
@@ -231,6 +369,21 @@ lock_release (struct lock *lock)
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
 
+#ifdef LOCK_PROFILE
+  {
+    struct lock_profile *p = lock->semaphore.profile;
+    uint64_t held = tsc_read () - lock->acquired;
+    enum intr_level old_level = intr_disable ();
+
+    if (p != NULL) 
+      {
+        p->hold_total += held;
+        if (held > p->hold_max)
+          p->hold_max = held;
+      }
+    intr_set_level (old_level);
+  }
+#endif
   lock->holder = NULL;
   sema_up (&lock->semaphore);
 }
@@ -336,3 +489,202 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   while (!list_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
+
+/* Initializes RW, a readers-writer lock.  Any number of readers
+   may hold RW at once, but a writer holds it exclusively.
+
+   The lock is writer-preferring: once a writer is waiting, new
+   readers wait behind it, even though the lock is currently held
+   only by readers.  This keeps a steady stream of readers from
+   starving writers. */
+void
+rwlock_init (struct rwlock *rw) 
+{
+  ASSERT (rw != NULL);
+
+  lock_init (&rw->lock);
+  cond_init (&rw->readers);
+  cond_init (&rw->writers);
+  rw->active_readers = 0;
+  rw->waiting_writers = 0;
+  rw->writer = NULL;
+}
+
+/* Acquires RW for reading, sleeping until no writer holds or is
+   waiting for RW.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_read (struct rwlock *rw) 
+{
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (rw->writer != thread_current ());
+
+  lock_acquire (&rw->lock);
+  while (rw->writer != NULL || rw->waiting_writers > 0)
+    cond_wait (&rw->readers, &rw->lock);
+  rw->active_readers++;
+  lock_release (&rw->lock);
+}
+
+/* Releases a read lock on RW that the current thread holds.
+   The last reader out lets in a waiting writer, if any. */
+void
+rwlock_release_read (struct rwlock *rw) 
+{
+  ASSERT (rw != NULL);
+
+  lock_acquire (&rw->lock);
+  ASSERT (rw->active_readers > 0);
+  if (--rw->active_readers == 0 && rw->waiting_writers > 0)
+    cond_signal (&rw->writers, &rw->lock);
+  lock_release (&rw->lock);
+}
+
+/* Acquires RW for writing, sleeping until no other thread holds
+   it for reading or writing.  RW must not already be held by the
+   current thread.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_write (struct rwlock *rw) 
+{
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (rw->writer != thread_current ());
+
+  lock_acquire (&rw->lock);
+  rw->waiting_writers++;
+  while (rw->writer != NULL || rw->active_readers > 0)
+    cond_wait (&rw->writers, &rw->lock);
+  rw->waiting_writers--;
+  rw->writer = thread_current ();
+  lock_release (&rw->lock);
+}
+
+/* Releases RW, which the current thread must hold for writing.
+   Hands RW to the next waiting writer if there is one, otherwise
+   lets in all waiting readers. */
+void
+rwlock_release_write (struct rwlock *rw) 
+{
+  ASSERT (rw != NULL);
+  ASSERT (rwlock_held_for_write (rw));
+
+  lock_acquire (&rw->lock);
+  rw->writer = NULL;
+  if (rw->waiting_writers > 0)
+    cond_signal (&rw->writers, &rw->lock);
+  else
+    cond_broadcast (&rw->readers, &rw->lock);
+  lock_release (&rw->lock);
+}
+
+/* Returns true if the current thread holds RW for writing, false
+   otherwise. */
+bool
+rwlock_held_for_write (const struct rwlock *rw) 
+{
+  ASSERT (rw != NULL);
+
+  return rw->writer == thread_current ();
+}
+
+#ifdef LOCK_PROFILE
+/* All lock profiles that have been used, most recently
+   registered first.  Protected by disabling interrupts. */
+static struct lock_profile *all_profiles;
+
+/* Adds PROFILE to the list of all profiles, if it is not
+   already there. */
+static void
+profile_register (struct lock_profile *profile) 
+{
+  enum intr_level old_level = intr_disable ();
+  if (!profile->registered) 
+    {
+      profile->registered = true;
+      profile->next = all_profiles;
+      all_profiles = profile;
+    }
+  intr_set_level (old_level);
+}
+
+/* Accounts a down on a semaphore with PROFILE that began at TSC
+   value START and had to wait if CONTENDED is true.  Interrupts
+   must be off. */
+static void
+profile_wait (struct lock_profile *profile, bool contended, uint64_t start) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (profile == NULL)
+    return;
+  profile->acquire_cnt++;
+  if (contended) 
+    {
+      uint64_t waited = tsc_read () - start;
+
+      profile->contended_cnt++;
+      profile->wait_total += waited;
+      if (waited > profile->wait_max)
+        profile->wait_max = waited;
+    }
+}
+
+/* Converts CYCLES to microseconds, or leaves it in cycles if the
+   TSC has not been calibrated. */
+static uint64_t
+cycles_to_us (uint64_t cycles) 
+{
+  return tsc_calibrated () ? tsc_to_ns (cycles) / 1000 : cycles;
+}
+
+/* Prints the lock profiles, most total wait time first. */
+void
+lock_print_stats (void) 
+{
+  struct lock_profile *sorted = NULL;
+  struct lock_profile *p, *next, **q;
+  enum intr_level old_level;
+
+  /* Insertion-sort the profiles into a new list.  Nothing can be
+     registered meanwhile, because interrupts are off. */
+  old_level = intr_disable ();
+  for (p = all_profiles; p != NULL; p = next) 
+    {
+      next = p->next;
+      for (q = &sorted; *q != NULL; q = &(*q)->next)
+        if ((*q)->wait_total < p->wait_total)
+          break;
+      p->next = *q;
+      *q = p;
+    }
+  all_profiles = sorted;
+  intr_set_level (old_level);
+
+  printf ("Lock contention (times in %s):\n",
+          tsc_calibrated () ? "us" : "TSC cycles");
+  printf ("%10s %10s %12s %10s %12s %10s  %s\n", "acquires", "contended",
+          "wait total", "wait max", "hold total", "hold max", "name");
+  for (p = all_profiles; p != NULL; p = p->next) 
+    {
+      const char *name = p->name[0] == '&' ? p->name + 1 : p->name;
+
+      if (p->acquire_cnt == 0)
+        continue;
+      printf ("%10llu %10llu %12"PRIu64" %10"PRIu64,
+              p->acquire_cnt, p->contended_cnt,
+              cycles_to_us (p->wait_total), cycles_to_us (p->wait_max));
+      if (p->is_lock)
+        printf (" %12"PRIu64" %10"PRIu64,
+                cycles_to_us (p->hold_total), cycles_to_us (p->hold_max));
+      else
+        printf (" %12s %10s", "-", "-");
+      printf ("  %s (%s:%d)\n", name, p->file, p->line);
+    }
+}
+#endif /* LOCK_PROFILE */
@@ -3,15 +3,58 @@
 
 #include <list.h>
 #include <stdbool.h>
+#include <stdint.h>
+
+#ifdef LOCK_PROFILE
+/* Contention statistics for the locks or semaphores initialized
+   at one place in the source code.  Built only when the kernel
+   is compiled with LOCK_PROFILE defined (run "make
+   LOCK_PROFILE=1"); otherwise locks and semaphores carry no
+   profiling state at all.  Times are in TSC cycles. */
+struct lock_profile
+  {
+    const char *name;           /* Argument to lock_init() or sema_init(). */
+    const char *file;           /* Source file of the initialization. */
+    int line;                   /* Source line of the initialization. */
+    bool is_lock;               /* Lock (true) or semaphore (false)? */
+    bool registered;            /* In the list of all profiles? */
+    struct lock_profile *next;  /* Next in the list of all profiles. */
+
+    unsigned long long acquire_cnt;   /* # of downs or acquires. */
+    unsigned long long contended_cnt; /* # of those that had to wait. */
+    uint64_t wait_total, wait_max;    /* Time spent waiting. */
+    uint64_t hold_total, hold_max;    /* Time locks were held. */
+  };
+
+#define LOCK_PROFILE_INITIALIZER(NAME, IS_LOCK)                 \
+        { .name = (NAME), .file = __FILE__, .line = __LINE__,   \
+          .is_lock = (IS_LOCK) }
+#endif
 
 /* A counting semaphore. */
 struct semaphore 
   {
-    unsigned value;             /* Current value. */
+    unsigned value;             /* Current value, plus a waiters flag. */
     struct list waiters;        /* List of waiting threads. */
+#ifdef LOCK_PROFILE
+    struct lock_profile *profile; /* Contention statistics. */
+#endif
   };
 
+#ifdef LOCK_PROFILE
+void sema_init_profiled (struct semaphore *, unsigned value,
+                         struct lock_profile *);
+#define sema_init(SEMA, VALUE)                                          \
+        do                                                              \
+          {                                                             \
+            static struct lock_profile profile_ =                       \
+              LOCK_PROFILE_INITIALIZER (#SEMA, false);                  \
+            sema_init_profiled ((SEMA), (VALUE), &profile_);            \
+          }                                                             \
+        while (0)
+#else
 void sema_init (struct semaphore *, unsigned value);
+#endif
 void sema_down (struct semaphore *);
 bool sema_try_down (struct semaphore *);
 void sema_up (struct semaphore *);
@@ -22,9 +65,25 @@ struct lock
   {
     struct thread *holder;      /* Thread holding lock (for debugging). */
     struct semaphore semaphore; /* Binary semaphore controlling access. */
+#ifdef LOCK_PROFILE
+    uint64_t acquired;          /* TSC when HOLDER acquired the lock. */
+#endif
   };
 
+#ifdef LOCK_PROFILE
+void lock_init_profiled (struct lock *, struct lock_profile *);
+#define lock_init(LOCK)                                                 \
+        do                                                              \
+          {                                                             \
+            static struct lock_profile profile_ =                       \
+              LOCK_PROFILE_INITIALIZER (#LOCK, true);                   \
+            lock_init_profiled ((LOCK), &profile_);                     \
+          }                                                             \
+        while (0)
+void lock_print_stats (void);
+#else
 void lock_init (struct lock *);
+#endif
 void lock_acquire (struct lock *);
 bool lock_try_acquire (struct lock *);
 void lock_release (struct lock *);
@@ -41,6 +100,24 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Readers-writer lock. */
+struct rwlock 
+  {
+    struct lock lock;           /* Protects the members below. */
+    struct condition readers;   /* Signaled when readers may enter. */
+    struct condition writers;   /* Signaled when a writer may enter. */
+    unsigned active_readers;    /* # of threads holding a read lock. */
+    unsigned waiting_writers;   /* # of threads waiting to write. */
+    struct thread *writer;      /* Thread holding the write lock. */
+  };
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+bool rwlock_held_for_write (const struct rwlock *);
+
 /* Optimization barrier.
 
    The compiler will not reorder operations across an
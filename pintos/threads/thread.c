@@ -6,10 +6,13 @@
 #include <stdint.h>
 #include <string.h>
 #include <filesys/file.h>
+#include "devices/timer.h"
+#include "threads/cpu.h"
 #include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
 #include "threads/palloc.h"
+#include "threads/sched-trace.h"
 #include "threads/switch.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -24,25 +27,53 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Per-CPU run queues.  Each CPU's ready_list holds the processes
+   in THREAD_READY state, that is, processes that are ready to run
+   on that CPU but not actually running.  See threads/cpu.h. */
+struct cpu cpus[CPU_MAX];
+
+/* Number of CPUs that are online. */
+int cpu_cnt;
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
 static struct list all_list;
 
-/* Idle thread. */
-static struct thread *idle_thread;
-
 /* Initial thread, the thread running init.c:main(). */
 static struct thread *initial_thread;
 
-/* Lock used by allocate_tid(). */
-static struct lock tid_lock;
+/* Thread identifiers.  Tids of threads that are completely gone
+   are queued in FREE_TIDS and handed out again, oldest first,
+   once more than TID_REUSE_DELAY are queued, so that a tid is not
+   reused right after it is released.  Protected by disabling
+   interrupts, because tids are released from
+   thread_schedule_tail(). */
+#define FREE_TID_CNT 256        /* Capacity of free_tids. */
+#define TID_REUSE_DELAY 64      /* Minimum # of queued tids to reuse. */
+static tid_t next_tid = 1;      /* Next never-used tid. */
+static tid_t free_tids[FREE_TID_CNT];
+static unsigned free_tid_head;  /* # of tids ever queued. */
+static unsigned free_tid_tail;  /* # of tids ever dequeued. */
+
+/* Pages of threads that have exited, kept for reuse so that
+   creating a thread usually needs neither the page allocator's
+   lock nor a zero-filled page.  Linked through their `elem'
+   members.  Protected by disabling interrupts, because pages are
+   added from thread_schedule_tail(). */
+#define THREAD_CACHE_MAX 16     /* Maximum number of cached pages. */
+static struct list thread_cache;
+static size_t thread_cache_cnt;
+static long long thread_cache_hits;   /* # of pages reused. */
+static long long thread_cache_misses; /* # of pages from palloc. */
 
-/* Lock used by file operations. */
-static struct lock file_lock;
+#ifdef USERPROG
+/* Process table.  Holds the child record of every thread that its
+   parent may still wait for, hashed by tid, so that waiting for a
+   child does not walk the parent's list of children.  Protected
+   by disabling interrupts, like the records themselves. */
+#define PROC_TABLE_SIZE 64      /* Number of buckets. */
+static struct list proc_table[PROC_TABLE_SIZE];
+#endif
 
 /* Stack frame for kernel_thread(). */
 struct kernel_thread_frame 
@@ -61,6 +92,21 @@ static long long user_ticks;    /* # of timer ticks in user programs. */
 #define TIME_SLICE 4            /* # of timer ticks to give each thread. */
 static unsigned thread_ticks;   /* # of timer ticks since last yield. */
 
+/* Load balancing. */
+#define BALANCE_INTERVAL 25     /* # of timer ticks between balancing. */
+#define CACHE_HOT_TICKS 2       /* A thread that ran this recently is
+                                   assumed to still have a warm cache. */
+
+/* Earliest-deadline-first class.  A thread that joins it with
+   thread_set_deadline() reserves RUNTIME ticks of CPU time in
+   every PERIOD ticks.  Admission control keeps the total of the
+   reservations on a CPU to EDF_UTIL_MAX per mille, which leaves
+   some time over for ordinary threads, including the workqueue
+   workers. */
+#define EDF_UTIL_MAX 900        /* Per mille of CPU time for EDF. */
+static unsigned edf_exited_jobs;    /* Jobs of threads that left EDF. */
+static unsigned edf_exited_misses;  /* Misses of threads that left EDF. */
+
 /* If false (default), use round-robin scheduler.
    If true, use multi-level feedback queue scheduler.
    Controlled by kernel command-line option "-o mlfqs". */
@@ -74,19 +120,44 @@ static struct thread *next_thread_to_run (void);
 static void init_thread (struct thread *, const char *name, int priority);
 static bool is_thread (struct thread *) UNUSED;
 static void *alloc_frame (struct thread *, size_t size);
+static tid_t create_thread (const char *name, int priority,
+                            thread_func *, void *aux, struct cpu *bind);
+static void cpu_init (struct cpu *, int id);
+static struct cpu *select_cpu (void);
+static struct cpu *busiest_cpu (const struct cpu *);
+static bool move_thread (struct cpu *from, struct cpu *to, bool allow_hot);
+static bool steal_thread (struct cpu *);
+static void balance_cpu (struct cpu *);
+static void enqueue_ready (struct cpu *, struct thread *);
+static bool edf_less (const struct list_elem *, const struct list_elem *,
+                      void *aux);
+static int edf_util (int64_t period, int64_t runtime);
+static void edf_release (struct thread *, int64_t now);
+static void edf_tick (struct cpu *);
+static bool edf_preempts (struct cpu *, struct thread *cur);
+static void edf_leave (struct thread *);
 static void schedule (void);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
-
-void acquire_file_lock(void){lock_acquire(&file_lock);}
-void release_file_lock(void){lock_release(&file_lock);}
+static void release_tid (tid_t);
+static struct thread *alloc_thread_page (void);
+static void free_thread_page (struct thread *);
+#ifdef USERPROG
+static struct child *alloc_child (tid_t);
+static void release_child (struct child *);
+static struct list *proc_table_bucket (tid_t);
+static struct thread *child_owner (void);
+static bool process_dying (const struct thread *);
+static void interrupt_wait (struct thread *, void *leader);
+#endif
 
 /* Initializes the threading system by transforming the code
    that's currently running into a thread.  This can't work in
    general and it is possible in this case only because loader.S
    was careful to put the bottom of the stack at a page boundary.
 
-   Also initializes the run queue and the tid lock.
+   Also initializes the per-CPU run queues and the thread page
+   cache.
 
    After calling this function, be sure to initialize the page
    allocator before trying to create any threads with
@@ -97,12 +168,19 @@ void release_file_lock(void){lock_release(&file_lock);}
 void
 thread_init (void) 
 {
+  int i;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
-  lock_init (&file_lock);
-  lock_init (&tid_lock);
-  list_init (&ready_list);
+  list_init (&thread_cache);
+  for (i = 0; i < CPU_MAX; i++)
+    cpu_init (&cpus[i], i);
+  cpu_cnt = 1;
   list_init (&all_list);
+#ifdef USERPROG
+  for (i = 0; i < PROC_TABLE_SIZE; i++)
+    list_init (&proc_table[i]);
+#endif
 
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread ();
@@ -112,20 +190,25 @@ thread_init (void)
 }
 
 /* Starts preemptive thread scheduling by enabling interrupts.
-   Also creates the idle thread. */
+   Also creates an idle thread for each online CPU. */
 void
 thread_start (void) 
 {
-  /* Create the idle thread. */
+  /* Create the idle threads. */
   struct semaphore idle_started;
+  int i;
+
   sema_init (&idle_started, 0);
-  thread_create ("idle", PRI_MIN, idle, &idle_started);
+  for (i = 0; i < cpu_cnt; i++)
+    create_thread ("idle", PRI_MIN, idle, &idle_started, &cpus[i]);
 
   /* Start preemptive thread scheduling. */
   intr_enable ();
 
-  /* Wait for the idle thread to initialize idle_thread. */
-  sema_down (&idle_started);
+  /* Wait for the idle threads to initialize their CPUs'
+     idle_thread. */
+  for (i = 0; i < cpu_cnt; i++)
+    sema_down (&idle_started);
 }
 
 /* Called by the timer interrupt handler at each timer tick.
@@ -134,9 +217,10 @@ void
 thread_tick (void) 
 {
   struct thread *t = thread_current ();
+  struct cpu *c = cpu_current ();
 
   /* Update statistics. */
-  if (t == idle_thread)
+  if (t == c->idle_thread)
     idle_ticks++;
 #ifdef USERPROG
   else if (t->pagedir != NULL)
@@ -145,17 +229,72 @@ thread_tick (void)
   else
     kernel_ticks++;
 
+  /* Even out the run queues now and then. */
+  if (timer_ticks () % BALANCE_INTERVAL == c->id % BALANCE_INTERVAL)
+    balance_cpu (c);
+
+  /* Charge an EDF thread for the tick, and take the CPU away
+     from it once its budget for this period is spent. */
+  if (t->edf_period != 0 && --t->edf_budget <= 0 && !t->edf_throttled)
+    {
+      t->edf_throttled = true;
+      t->edf_overruns++;
+      intr_yield_on_return ();
+    }
+
+  /* Start new EDF periods, and let an EDF thread with an earlier
+     deadline than the running thread's run at once. */
+  if (!list_empty (&c->edf_threads))
+    {
+      edf_tick (c);
+      if (edf_preempts (c, t))
+        intr_yield_on_return ();
+    }
+
   /* Enforce preemption. */
   if (++thread_ticks >= TIME_SLICE)
     intr_yield_on_return ();
 }
 
+/* Called by the timer when TICKS timer ticks passed without a
+   timer interrupt while the CPU was idle, to account for them as
+   if each had been seen by thread_tick(). */
+void
+thread_account_idle (int64_t ticks) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  idle_ticks += ticks;
+}
+
 /* Prints thread statistics. */
 void
 thread_print_stats (void) 
 {
+  int i;
+
   printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
           idle_ticks, kernel_ticks, user_ticks);
+  printf ("Thread: %lld pages reused, %lld allocated\n",
+          thread_cache_hits, thread_cache_misses);
+  for (i = 0; i < cpu_cnt; i++)
+    {
+      struct list_elem *e;
+
+      printf ("CPU %d: %lld switches, %lld steals, %lld balance moves\n",
+              cpus[i].id, cpus[i].switch_cnt, cpus[i].steal_cnt,
+              cpus[i].balance_cnt);
+      for (e = list_begin (&cpus[i].edf_threads);
+           e != list_end (&cpus[i].edf_threads); e = list_next (e))
+        {
+          struct thread *t = list_entry (e, struct thread, edf_elem);
+          printf ("EDF thread %s: %u jobs, %u deadlines missed, "
+                  "%u budget overruns\n",
+                  t->name, t->edf_jobs, t->edf_misses, t->edf_overruns);
+        }
+    }
+  if (edf_exited_jobs != 0)
+    printf ("EDF: %u jobs, %u deadlines missed in threads that left EDF\n",
+            edf_exited_jobs, edf_exited_misses);
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -176,32 +315,54 @@ thread_print_stats (void)
 tid_t
 thread_create (const char *name, int priority,
                thread_func *function, void *aux) 
+{
+  return create_thread (name, priority, function, aux, NULL);
+}
+
+/* Does the work of thread_create().  If BIND is non-null, the new
+   thread runs only on that CPU; otherwise, it starts out on the
+   least loaded CPU and may later migrate. */
+static tid_t
+create_thread (const char *name, int priority,
+               thread_func *function, void *aux, struct cpu *bind) 
 {
   struct thread *t;
   struct kernel_thread_frame *kf;
   struct switch_entry_frame *ef;
   struct switch_threads_frame *sf;
   tid_t tid;
+#ifdef USERPROG
+  struct thread *parent = child_owner ();
+  enum intr_level old_level;
+#endif
 
   ASSERT (function != NULL);
 
   /* Allocate thread. */
-  t = palloc_get_page (PAL_ZERO);
+  t = alloc_thread_page ();
   if (t == NULL)
     return TID_ERROR;
 
   /* Initialize thread. */
   init_thread (t, name, priority);
   tid = t->tid = allocate_tid ();
+  t->cpu = bind != NULL ? bind->id : select_cpu ()->id;
+  t->no_migrate = bind != NULL;
   
 #ifdef USERPROG
   // Teresa
-  t->child_info = malloc(sizeof(struct child));
-  t->child_info->tid = tid;
-  sema_init (&t->child_info->sema_wait, 0);
-  list_push_back (&thread_current()->children, &t->child_info->elem);
-  t->child_info->st_exit = UINT32_MAX;
-  t->child_info->succ = false;
+  t->child_info = alloc_child (tid);
+  if (t->child_info == NULL)
+    {
+      release_tid (tid);
+      free_thread_page (t);
+      return TID_ERROR;
+    }
+  t->child_info->parent = parent;
+  old_level = intr_disable ();
+  list_push_back (&parent->children, &t->child_info->elem);
+  list_push_back (proc_table_bucket (tid), &t->child_info->table_elem);
+  intr_set_level (old_level);
 #endif
 
   /* Stack frame for kernel_thread(). */
@@ -235,8 +396,11 @@ void
 thread_block (void) 
 {
   ASSERT (!intr_context ());
+  ASSERT (!intr_softirq_context ());
   ASSERT (intr_get_level () == INTR_OFF);
 
+  if (sched_trace_enabled)
+    sched_trace_block (thread_current ());
   thread_current ()->status = THREAD_BLOCKED;
   schedule ();
 }
@@ -253,13 +417,35 @@ void
 thread_unblock (struct thread *t) 
 {
   enum intr_level old_level;
+  struct cpu *c;
 
   ASSERT (is_thread (t));
 
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-  list_push_back (&ready_list, &t->elem);
+
+  /* An EDF thread that slept through its deadline finished its
+     last job on time and starts a new one now. */
+  if (t->edf_period != 0 && timer_ticks () >= t->edf_deadline)
+    {
+      t->edf_deadline = timer_ticks () + t->edf_period;
+      t->edf_budget = t->edf_runtime;
+      t->edf_jobs++;
+    }
+
+  /* Wake T up on the CPU it last ran on, whose cache is most
+     likely to still hold its working set. */
+  c = &cpus[t->cpu];
   t->status = THREAD_READY;
+  enqueue_ready (c, t);
+  if (sched_trace_enabled)
+    sched_trace_unblock (t);
+
+  /* An EDF thread woken by an interrupt preempts as soon as the
+     interrupt returns, if its deadline is the earliest. */
+  if ((intr_context () || intr_softirq_context ())
+      && c == cpu_current () && edf_preempts (c, running_thread ()))
+    intr_yield_on_return ();
   intr_set_level (old_level);
 }
 
@@ -309,9 +495,34 @@ thread_exit (void)
   intr_disable ();
 #ifdef USERPROG
 
-printf ("%s: exit(%d)\n",thread_name(), thread_current()->st_exit);
-thread_current ()->child_info->st_exit = thread_current()->st_exit;
-sema_up (&thread_current()->child_info->sema_wait);
+/* A process's other threads exit silently; its leader reports. */
+if (thread_current ()->leader == NULL
+    || thread_current ()->leader == thread_current ())
+  printf ("%s: exit(%d)\n",thread_name(), thread_current()->st_exit);
+if (thread_current ()->child_info != NULL)
+  {
+    struct child *self = thread_current ()->child_info;
+    self->st_exit = thread_current()->st_exit;
+    if (self->parent != NULL)
+      {
+        /* Queue ourselves for the parent's wait_any(). */
+        list_push_back (&self->parent->exited_children, &self->exited_elem);
+        self->exited = true;
+        sema_up (&self->parent->child_exited);
+      }
+    sema_up (&self->sema_wait);
+    release_child (self);
+  }
+
+  /* Give up our records of children we never waited for. */
+  struct list *children = &thread_current ()->children;
+  while (!list_empty (children))
+    {
+      struct child *c = list_entry (list_pop_front (children),
+                                    struct child, elem);
+      thread_disown_child (c);
+      release_child (c);
+    }
 
   /* Close the executing file in this thread. */
   if(thread_current()->exec_file != NULL)
@@ -327,13 +538,18 @@ sema_up (&thread_current()->child_info->sema_wait);
   while(!list_empty(files)){
     struct list_elem *e = list_pop_front(files);
     struct open_file *f = list_entry(e, struct open_file, elem);
-    acquire_file_lock();
     file_close(f->file);
-    release_file_lock();
     free(f);
   }
+
+  /* Now that our parent has our exit status, let the reaper free
+     our address space. */
+  process_reap ();
 #endif
 
+  if (thread_current ()->edf_period != 0)
+    edf_leave (thread_current ());
+
   /* Remove thread from all threads list, set our status to dying,
      and schedule another process.  That process will destroy us
      when it calls thread_schedule_tail(). */
@@ -349,14 +565,16 @@ void
 thread_yield (void) 
 {
   struct thread *cur = thread_current ();
+  struct cpu *c = cpu_current ();
   enum intr_level old_level;
   
   ASSERT (!intr_context ());
+  ASSERT (!intr_softirq_context ());
 
   old_level = intr_disable ();
-  if (cur != idle_thread) 
-    list_push_back (&ready_list, &cur->elem);
   cur->status = THREAD_READY;
+  if (cur != c->idle_thread) 
+    enqueue_ready (c, cur);
   schedule ();
   intr_set_level (old_level);
 }
@@ -392,6 +610,101 @@ thread_get_priority (void)
   return thread_current ()->priority;
 }
 
+/* Moves the current thread into the earliest-deadline-first
+   scheduling class, reserving RUNTIME timer ticks of CPU time in
+   every PERIOD ticks, starting with a period that begins now.
+   Each period is a job whose deadline is the period's end.
+   Ready EDF threads run before all other threads, the one with
+   the earliest deadline first.  A thread that uses up RUNTIME
+   ticks in a period does not run again until the next period
+   starts; one that is still ready with budget left at its
+   deadline has missed it.
+
+   Returns false, leaving the thread's class unchanged, if
+   RUNTIME is not between 1 and PERIOD or if the CPU cannot
+   guarantee the reservation alongside those already made.  A
+   PERIOD of 0 returns the thread to the ordinary scheduler and
+   always succeeds. */
+bool
+thread_set_deadline (int64_t period, int64_t runtime) 
+{
+  struct thread *cur = thread_current ();
+  struct cpu *c = cpu_current ();
+  enum intr_level old_level;
+  int util;
+
+  ASSERT (!intr_context ());
+  ASSERT (period >= 0);
+
+  old_level = intr_disable ();
+  if (period == 0)
+    {
+      if (cur->edf_period != 0)
+        edf_leave (cur);
+      intr_set_level (old_level);
+      return true;
+    }
+  if (runtime <= 0 || runtime > period)
+    {
+      intr_set_level (old_level);
+      return false;
+    }
+
+  util = edf_util (period, runtime);
+  if (cur->edf_period != 0)
+    util -= edf_util (cur->edf_period, cur->edf_runtime);
+  if (c->edf_util + util > EDF_UTIL_MAX)
+    {
+      intr_set_level (old_level);
+      return false;
+    }
+  c->edf_util += util;
+  if (cur->edf_period == 0)
+    list_push_back (&c->edf_threads, &cur->edf_elem);
+
+  cur->edf_period = period;
+  cur->edf_runtime = runtime;
+  cur->edf_deadline = timer_ticks () + period;
+  cur->edf_budget = runtime;
+  cur->edf_throttled = false;
+  cur->edf_jobs++;
+  if (edf_preempts (c, cur))
+    thread_yield ();
+  intr_set_level (old_level);
+  return true;
+}
+
+/* Returns the number of EDF deadlines that the current thread
+   has missed. */
+unsigned
+thread_get_deadline_misses (void) 
+{
+  return thread_current ()->edf_misses;
+}
+
+/* Returns the timer tick at which the first EDF thread on the
+   current CPU that has used up its budget gets a new one, or
+   INT64_MAX if there is none.  An idle CPU must take a timer
+   interrupt by then. */
+int64_t
+thread_next_release (void) 
+{
+  struct cpu *c = cpu_current ();
+  int64_t next = INT64_MAX;
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (e = list_begin (&c->edf_threads); e != list_end (&c->edf_threads);
+       e = list_next (e))
+    {
+      struct thread *t = list_entry (e, struct thread, edf_elem);
+      if (t->edf_throttled && t->edf_deadline < next)
+        next = t->edf_deadline;
+    }
+  return next;
+}
+
 /* Sets the current thread's nice value to NICE. */
 void
 thread_set_nice (int nice UNUSED) 
@@ -425,26 +738,32 @@ thread_get_recent_cpu (void)
 
 /* Idle thread.  Executes when no other thread is ready to run.
 
-   The idle thread is initially put on the ready list by
-   thread_start().  It will be scheduled once initially, at which
-   point it initializes idle_thread, "up"s the semaphore passed
-   to it to enable thread_start() to continue, and immediately
-   blocks.  After that, the idle thread never appears in the
-   ready list.  It is returned by next_thread_to_run() as a
-   special case when the ready list is empty. */
+   Each CPU's idle thread is initially put on that CPU's ready
+   list by thread_start().  It will be scheduled once initially,
+   at which point it initializes its CPU's idle_thread, "up"s the
+   semaphore passed to it to enable thread_start() to continue,
+   and immediately blocks.  After that, the idle thread never
+   appears in a ready list.  It is returned by
+   next_thread_to_run() as a special case when the CPU's ready
+   list is empty and there is no work to steal from other CPUs. */
 static void
 idle (void *idle_started_ UNUSED) 
 {
   struct semaphore *idle_started = idle_started_;
-  idle_thread = thread_current ();
+  cpu_current ()->idle_thread = thread_current ();
   sema_up (idle_started);
 
   for (;;) 
     {
       /* Let someone else run. */
       intr_disable ();
+      timer_idle_exit ();
       thread_block ();
 
+      /* Nothing is ready, so stop the periodic timer tick until
+         it is needed again. */
+      timer_idle_enter ();
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
@@ -516,6 +835,8 @@ init_thread (struct thread *t, const char *name, int priority)
   if(t == initial_thread) t->parent = NULL;
   else t->parent = thread_current();
   list_init(&t->children);
+  list_init(&t->exited_children);
+  sema_init(&t->child_exited, 0);
   sema_init(&t->sema_wait, 0);
   t->st_exit = UINT32_MAX;
   t->child_loaded = true;
@@ -524,6 +845,14 @@ init_thread (struct thread *t, const char *name, int priority)
   t->file_fd = 2; // fd 0 (STDIN_FILENO) is standard input, fd 1 (STDOUT_FILENO) is standard output. 
   list_init(&t->files);
 
+  t->leader = NULL;
+  t->stack_slot = -1;
+  t->wait_sema = NULL;
+  lock_init (&t->proc_lock);
+  list_init (&t->user_threads);
+  t->thread_cnt = 1;
+  cond_init (&t->thread_exited);
+
 #ifdef VM
   /* 初始化補充頁表為 NULL */
   t->spt = NULL;
@@ -550,17 +879,263 @@ alloc_frame (struct thread *t, size_t size)
 }
 
 /* Chooses and returns the next thread to be scheduled.  Should
-   return a thread from the run queue, unless the run queue is
-   empty.  (If the running thread can continue running, then it
-   will be in the run queue.)  If the run queue is empty, return
-   idle_thread. */
+   return a thread from this CPU's run queue, unless the run queue
+   is empty.  (If the running thread can continue running, then
+   it will be in the run queue.)  Ready EDF threads come first,
+   earliest deadline first.  If the run queue is empty, tries to
+   steal a thread from the busiest other CPU, and failing that
+   returns this CPU's idle thread. */
 static struct thread *
 next_thread_to_run (void) 
 {
-  if (list_empty (&ready_list))
-    return idle_thread;
-  else
-    return list_entry (list_pop_front (&ready_list), struct thread, elem);
+  struct cpu *c = cpu_current ();
+
+  if (!list_empty (&c->edf_ready))
+    return list_entry (list_pop_front (&c->edf_ready), struct thread, elem);
+  if (list_empty (&c->ready_list) && !steal_thread (c))
+    return c->idle_thread;
+
+  c->ready_cnt--;
+  return list_entry (list_pop_front (&c->ready_list), struct thread, elem);
+}
+
+/* Returns the CPU that the running code is executing on. */
+struct cpu *
+cpu_current (void) 
+{
+  /* Only the boot processor is brought up.  Once application
+     processors run, this must read the local APIC ID. */
+  return &cpus[0];
+}
+
+/* Initializes C as CPU number ID with an empty run queue. */
+static void
+cpu_init (struct cpu *c, int id) 
+{
+  memset (c, 0, sizeof *c);
+  c->id = id;
+  list_init (&c->ready_list);
+  list_init (&c->edf_ready);
+  list_init (&c->edf_threads);
+}
+
+/* Returns the online CPU with the shortest run queue, which is
+   where a newly created thread should start out. */
+static struct cpu *
+select_cpu (void) 
+{
+  struct cpu *best = cpu_current ();
+  int i;
+
+  for (i = 0; i < cpu_cnt; i++)
+    if (cpus[i].ready_cnt < best->ready_cnt)
+      best = &cpus[i];
+  return best;
+}
+
+/* Returns the online CPU other than C with the longest run queue,
+   or a null pointer if every other run queue is empty. */
+static struct cpu *
+busiest_cpu (const struct cpu *c) 
+{
+  struct cpu *busiest = NULL;
+  int i;
+
+  for (i = 0; i < cpu_cnt; i++)
+    if (&cpus[i] != c && cpus[i].ready_cnt > 0
+        && (busiest == NULL || cpus[i].ready_cnt > busiest->ready_cnt))
+      busiest = &cpus[i];
+  return busiest;
+}
+
+/* Moves one ready thread from FROM's run queue to the back of
+   TO's run queue.  Threads that last ran longest ago, which are
+   at the front of the queue, are preferred.  Threads that ran
+   within the last CACHE_HOT_TICKS ticks are moved only if
+   ALLOW_HOT is true.  Returns true if a thread was moved. */
+static bool
+move_thread (struct cpu *from, struct cpu *to, bool allow_hot) 
+{
+  int64_t now = timer_ticks ();
+  struct thread *hot = NULL;
+  struct thread *t = NULL;
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (e = list_begin (&from->ready_list); e != list_end (&from->ready_list);
+       e = list_next (e))
+    {
+      struct thread *cand = list_entry (e, struct thread, elem);
+      if (cand->no_migrate)
+        continue;
+      if (now - cand->last_run >= CACHE_HOT_TICKS)
+        {
+          t = cand;
+          break;
+        }
+      if (hot == NULL)
+        hot = cand;
+    }
+  if (t == NULL && allow_hot)
+    t = hot;
+  if (t == NULL)
+    return false;
+
+  list_remove (&t->elem);
+  from->ready_cnt--;
+  list_push_back (&to->ready_list, &t->elem);
+  to->ready_cnt++;
+  t->cpu = to->id;
+  t->migrate_cnt++;
+  return true;
+}
+
+/* Called when C's run queue is empty.  Steals a thread from the
+   busiest other CPU so that C does not sit idle while work is
+   waiting elsewhere.  Returns true if a thread was stolen. */
+static bool
+steal_thread (struct cpu *c) 
+{
+  struct cpu *busiest = busiest_cpu (c);
+
+  if (busiest == NULL || !move_thread (busiest, c, true))
+    return false;
+  c->steal_cnt++;
+  return true;
+}
+
+/* Periodic load balancing for C.  Pulls cache-cold threads from
+   the busiest CPU until the two run queues differ in length by
+   at most one.  Threads whose caches are still warm stay put,
+   since migrating them would cost more than a short wait. */
+static void
+balance_cpu (struct cpu *c) 
+{
+  struct cpu *busiest = busiest_cpu (c);
+
+  if (busiest == NULL)
+    return;
+  while (busiest->ready_cnt > c->ready_cnt + 1
+         && move_thread (busiest, c, false))
+    c->balance_cnt++;
+}
+
+/* Queues T, which is in THREAD_READY state, on C's run queue for
+   its class.  An EDF thread that is out of budget is queued
+   nowhere until edf_tick() starts its next period. */
+static void
+enqueue_ready (struct cpu *c, struct thread *t) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (t->status == THREAD_READY);
+
+  if (t->edf_period == 0)
+    {
+      list_push_back (&c->ready_list, &t->elem);
+      c->ready_cnt++;
+    }
+  else if (!t->edf_throttled)
+    list_insert_ordered (&c->edf_ready, &t->elem, edf_less, NULL);
+}
+
+/* Returns true if the EDF thread containing A_ has an earlier
+   deadline than the one containing B_. */
+static bool
+edf_less (const struct list_elem *a_, const struct list_elem *b_,
+          void *aux UNUSED) 
+{
+  const struct thread *a = list_entry (a_, struct thread, elem);
+  const struct thread *b = list_entry (b_, struct thread, elem);
+
+  return a->edf_deadline < b->edf_deadline;
+}
+
+/* Returns the CPU share, per mille, rounded up, that RUNTIME
+   ticks in every PERIOD ticks takes. */
+static int
+edf_util (int64_t period, int64_t runtime) 
+{
+  return (runtime * 1000 + period - 1) / period;
+}
+
+/* Starts the first period of EDF thread T that ends after NOW,
+   with a full budget. */
+static void
+edf_release (struct thread *t, int64_t now) 
+{
+  while (t->edf_deadline <= now)
+    t->edf_deadline += t->edf_period;
+  t->edf_budget = t->edf_runtime;
+  t->edf_throttled = false;
+  t->edf_jobs++;
+}
+
+/* Called by thread_tick() for CPU C.  For each EDF thread on C
+   whose deadline has come, counts a miss if it still wanted to
+   run, and starts its next period.  Threads that ran out of
+   budget are queued again.  Blocked threads are left to
+   thread_unblock(). */
+static void
+edf_tick (struct cpu *c) 
+{
+  int64_t now = timer_ticks ();
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (e = list_begin (&c->edf_threads); e != list_end (&c->edf_threads);
+       e = list_next (e))
+    {
+      struct thread *t = list_entry (e, struct thread, edf_elem);
+      bool was_throttled = t->edf_throttled;
+
+      if (now < t->edf_deadline || t->status == THREAD_BLOCKED)
+        continue;
+
+      if (!was_throttled)
+        {
+          t->edf_misses++;
+          c->edf_miss_cnt++;
+          if (t->status == THREAD_READY)
+            list_remove (&t->elem);
+        }
+      edf_release (t, now);
+      if (t->status == THREAD_READY)
+        enqueue_ready (c, t);
+    }
+}
+
+/* Returns true if a ready EDF thread on C should run instead of
+   CUR, the thread running on C. */
+static bool
+edf_preempts (struct cpu *c, struct thread *cur) 
+{
+  struct thread *next;
+
+  if (list_empty (&c->edf_ready))
+    return false;
+  next = list_entry (list_front (&c->edf_ready), struct thread, elem);
+  return (cur->edf_period == 0 || cur->edf_throttled
+          || next->edf_deadline < cur->edf_deadline);
+}
+
+/* Returns T, which is in the EDF class and is either running or
+   about to exit, to the ordinary scheduler. */
+static void
+edf_leave (struct thread *t) 
+{
+  struct cpu *c = &cpus[t->cpu];
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (t->edf_period != 0);
+
+  c->edf_util -= edf_util (t->edf_period, t->edf_runtime);
+  list_remove (&t->edf_elem);
+  edf_exited_jobs += t->edf_jobs;
+  edf_exited_misses += t->edf_misses;
+  t->edf_period = 0;
+  t->edf_throttled = false;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -583,11 +1158,13 @@ void
 thread_schedule_tail (struct thread *prev)
 {
   struct thread *cur = running_thread ();
+  struct cpu *c = cpu_current ();
   
   ASSERT (intr_get_level () == INTR_OFF);
 
   /* Mark us as running. */
   cur->status = THREAD_RUNNING;
+  cur->cpu = c->id;
 
   /* Start new time slice. */
   thread_ticks = 0;
@@ -605,7 +1182,10 @@ thread_schedule_tail (struct thread *prev)
   if (prev != NULL && prev->status == THREAD_DYING && prev != initial_thread) 
     {
       ASSERT (prev != cur);
-      palloc_free_page (prev);
+#ifndef USERPROG
+      release_tid (prev->tid);
+#endif
+      free_thread_page (prev);
     }
 }
 
@@ -627,8 +1207,14 @@ schedule (void)
   ASSERT (cur->status != THREAD_RUNNING);
   ASSERT (is_thread (next));
 
+  cur->last_run = timer_ticks ();
+  if (sched_trace_enabled)
+    sched_trace_switch (cur, next);
   if (cur != next)
-    prev = switch_threads (cur, next);
+    {
+      cpu_current ()->switch_cnt++;
+      prev = switch_threads (cur, next);
+    }
   thread_schedule_tail (prev);
 }
 
@@ -636,15 +1222,305 @@ schedule (void)
 static tid_t
 allocate_tid (void) 
 {
-  static tid_t next_tid = 1;
+  enum intr_level old_level;
   tid_t tid;
 
-  lock_acquire (&tid_lock);
-  tid = next_tid++;
-  lock_release (&tid_lock);
+  old_level = intr_disable ();
+  if (free_tid_head - free_tid_tail > TID_REUSE_DELAY)
+    tid = free_tids[free_tid_tail++ % FREE_TID_CNT];
+  else
+    tid = next_tid++;
+  intr_set_level (old_level);
 
   return tid;
 }
+
+/* Makes TID available for reuse.  Nothing may refer to TID any
+   longer: with user programs, that means that the tid's child
+   record is gone, otherwise that its thread is.  If the queue of
+   free tids is full, TID is simply never reused. */
+static void
+release_tid (tid_t tid) 
+{
+  enum intr_level old_level;
+
+  ASSERT (tid > 0 && tid < next_tid);
+
+  old_level = intr_disable ();
+  if (free_tid_head - free_tid_tail < FREE_TID_CNT)
+    free_tids[free_tid_head++ % FREE_TID_CNT] = tid;
+  intr_set_level (old_level);
+}
+
+/* Returns a page for a new thread, from the cache of exited
+   threads' pages if possible.  The page's contents are
+   arbitrary; init_thread() resets the struct thread at its
+   base, and the rest is stack.  Returns a null pointer if no
+   page is available. */
+static struct thread *
+alloc_thread_page (void) 
+{
+  struct thread *t = NULL;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if (!list_empty (&thread_cache)) 
+    {
+      t = list_entry (list_pop_front (&thread_cache), struct thread, elem);
+      thread_cache_cnt--;
+      thread_cache_hits++;
+    }
+  else
+    thread_cache_misses++;
+  intr_set_level (old_level);
+
+  if (t == NULL)
+    t = palloc_get_page (0);
+  return t;
+}
+
+/* Frees the page of thread T, which must not be running, or
+   keeps it for a later alloc_thread_page(). */
+static void
+free_thread_page (struct thread *t) 
+{
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if (thread_cache_cnt < THREAD_CACHE_MAX) 
+    {
+      list_push_front (&thread_cache, &t->elem);
+      thread_cache_cnt++;
+      t = NULL;
+    }
+  intr_set_level (old_level);
+
+  if (t != NULL)
+    palloc_free_page (t);
+}
+
+#ifdef USERPROG
+/* Exited child records, kept for reuse by alloc_child().
+   Linked through their `elem' members and protected by disabling
+   interrupts. */
+static struct list child_cache = LIST_INITIALIZER (child_cache);
+
+/* Returns a new child record for the thread TID, with one
+   reference for the child and one for its parent, or a null
+   pointer if memory is exhausted. */
+static struct child *
+alloc_child (tid_t tid) 
+{
+  struct child *c = NULL;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if (!list_empty (&child_cache))
+    c = list_entry (list_pop_front (&child_cache), struct child, elem);
+  intr_set_level (old_level);
+
+  if (c == NULL) 
+    {
+      c = malloc (sizeof *c);
+      if (c == NULL)
+        return NULL;
+    }
+  c->tid = tid;
+  c->st_exit = UINT32_MAX;
+  c->succ = false;
+  c->ref_cnt = 2;
+  sema_init (&c->sema_wait, 0);
+  c->parent = NULL;
+  c->exited = false;
+  return c;
+}
+
+/* Returns the process table bucket that holds the child record
+   for TID. */
+static struct list *
+proc_table_bucket (tid_t tid) 
+{
+  return &proc_table[(unsigned) tid % PROC_TABLE_SIZE];
+}
+
+/* Drops one reference to child record C, which must not be in a
+   parent's list of children.  When both the child and its parent
+   are done with C, it is recycled along with its tid. */
+static void
+release_child (struct child *c) 
+{
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  ASSERT (c->ref_cnt > 0);
+  if (--c->ref_cnt == 0) 
+    {
+      release_tid (c->tid);
+      list_push_front (&child_cache, &c->elem);
+    }
+  intr_set_level (old_level);
+}
+
+/* Returns the thread that owns the children of the running
+   thread.  A user process's children belong to the process, so
+   that any of its threads can wait for them, and are recorded in
+   its leader.  Other threads own their children themselves. */
+static struct thread *
+child_owner (void) 
+{
+  struct thread *cur = thread_current ();
+
+  return cur->leader != NULL ? cur->leader : cur;
+}
+
+/* Returns the child record of the calling process's child TID,
+   if the process may still wait for it, or a null pointer. */
+struct child *
+thread_find_child (tid_t tid) 
+{
+  struct thread *cur = child_owner ();
+  struct list *bucket = proc_table_bucket (tid);
+  struct child *found = NULL;
+  enum intr_level old_level;
+  struct list_elem *e;
+
+  old_level = intr_disable ();
+  for (e = list_begin (bucket); e != list_end (bucket); e = list_next (e)) 
+    {
+      struct child *c = list_entry (e, struct child, table_elem);
+      if (c->tid == tid && c->parent == cur) 
+        {
+          found = c;
+          break;
+        }
+    }
+  intr_set_level (old_level);
+  return found;
+}
+
+/* Waits for any child of the calling process to exit, and
+   returns its child record, which the caller must release with
+   thread_release_child().  Children exit into a queue, so this
+   takes constant time once one has exited.  Returns a null
+   pointer at once if the process has no children to wait for,
+   or as soon as it is being terminated. */
+struct child *
+thread_wait_any_child (void) 
+{
+  struct thread *cur = child_owner ();
+  enum intr_level old_level;
+  struct child *c;
+
+  old_level = intr_disable ();
+  if (list_empty (&cur->children)
+      || !thread_sema_down_interruptible (&cur->child_exited))
+    {
+      intr_set_level (old_level);
+      return NULL;
+    }
+  c = list_entry (list_pop_front (&cur->exited_children),
+                  struct child, exited_elem);
+  c->exited = false;
+  intr_set_level (old_level);
+  return c;
+}
+
+/* Removes child record C from the process table and from its
+   parent's queue of exited children, so that its parent can no
+   longer wait for it. */
+void
+thread_disown_child (struct child *c) 
+{
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if (c->parent != NULL) 
+    {
+      list_remove (&c->table_elem);
+      if (c->exited) 
+        {
+          list_remove (&c->exited_elem);
+          c->exited = false;
+          sema_try_down (&c->parent->child_exited);
+        }
+      c->parent = NULL;
+    }
+  intr_set_level (old_level);
+}
+
+/* Drops the calling process's reference to child record C,
+   after removing it from the process's list of children.  For
+   use by process_wait(). */
+void
+thread_release_child (struct child *c) 
+{
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  list_remove (&c->elem);
+  intr_set_level (old_level);
+  thread_disown_child (c);
+  release_child (c);
+}
+
+/* Returns true if T belongs to a process that is being
+   terminated. */
+static bool
+process_dying (const struct thread *t) 
+{
+  return t->leader != NULL && t->leader->exiting;
+}
+
+/* Downs SEMA, like sema_down(), and returns true.  If the
+   running thread's process is being terminated, though, returns
+   false instead, without waiting or as soon as
+   thread_interrupt_process() wakes the thread.  For sleeps that
+   could otherwise keep a dying process from ever exiting. */
+bool
+thread_sema_down_interruptible (struct semaphore *sema) 
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  bool downed = false;
+
+  old_level = intr_disable ();
+  if (!process_dying (cur)) 
+    {
+      cur->wait_sema = sema;
+      sema_down (sema);
+      cur->wait_sema = NULL;
+      downed = !process_dying (cur);
+    }
+  intr_set_level (old_level);
+  return downed;
+}
+
+/* Wakes every thread of the process led by LEADER that sleeps in
+   thread_sema_down_interruptible().  The process must already be
+   marked as exiting. */
+void
+thread_interrupt_process (struct thread *leader) 
+{
+  enum intr_level old_level;
+
+  ASSERT (leader->exiting);
+
+  old_level = intr_disable ();
+  thread_foreach (interrupt_wait, leader);
+  intr_set_level (old_level);
+}
+
+/* Thread action function for thread_interrupt_process(). */
+static void
+interrupt_wait (struct thread *t, void *leader) 
+{
+  if (t->leader == leader && t->wait_sema != NULL) 
+    {
+      sema_up (t->wait_sema);
+      t->wait_sema = NULL;
+    }
+}
+#endif
 
 /* Offset of `stack' member within `struct thread'.
    Used by switch.S, which can't figure it out on its own. */
@@ -88,14 +88,21 @@ typedef int tid_t;
    tid_t tid;
    int st_exit;
    bool succ;
+   int ref_cnt;                  /* Held by the child and its parent. */
    struct semaphore sema_wait;   /* Semaphore for control waiting. */
    struct list_elem elem;        /* element in `parent->child` */
+   struct thread *parent;        /* Thread that may wait, or null. */
+   struct list_elem table_elem;  /* Element in the process table. */
+   struct list_elem exited_elem; /* Element in `parent->exited_children`. */
+   bool exited;                  /* In `parent->exited_children`? */
 };
 
 struct open_file
 {
    int fd;                       /* File descriptor number. */
    struct file* file;            /* pointor to actual file. */
+   int refs;                     /* Fd table's reference plus users'. */
+   struct lock pos_lock;         /* Serializes uses of the position. */
    struct list_elem elem;        /* Elements for thread's open-file list. */
 };
 struct thread
@@ -108,15 +115,42 @@ struct thread
     int priority;                       /* Priority. */
     struct list_elem allelem;           /* List element for all threads list. */
 
+    /* Owned by thread.c, for the per-CPU run queues. */
+    int cpu;                            /* CPU whose run queue we use. */
+    bool no_migrate;                    /* Never move to another CPU? */
+    int64_t last_run;                   /* Tick we last left the CPU. */
+    unsigned migrate_cnt;               /* # of times moved between CPUs. */
+
+    /* Owned by thread.c, for the EDF scheduling class. */
+    int64_t edf_period;                 /* Ticks per period, 0 if not EDF. */
+    int64_t edf_runtime;                /* Ticks of CPU time per period. */
+    int64_t edf_deadline;               /* Tick when current job is due. */
+    int64_t edf_budget;                 /* Ticks left for current job. */
+    bool edf_throttled;                 /* Out of budget until deadline? */
+    unsigned edf_jobs;                  /* # of periods started. */
+    unsigned edf_misses;                /* # of deadlines missed. */
+    unsigned edf_overruns;              /* # of times budget ran out. */
+    struct list_elem edf_elem;          /* Element in cpu's edf_threads. */
+
     /* Shared between thread.c and synch.c. */
     struct list_elem elem;              /* List element. */
 
+    /* Owned by devices/timer.c. */
+    int64_t wakeup_tick;                /* Tick to wake up from sleep. */
+
+    /* Owned by threads/sched-trace.c. */
+    uint64_t trace_ready;               /* TSC when made ready, or 0. */
+    bool trace_woken;                   /* Made ready by thread_unblock()? */
+    struct sched_thread_stats *trace_stats; /* Latency histograms. */
+
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
    // Teresa
     struct thread *parent;
     struct list children;               /* List of child processes created by this thread. */
+    struct list exited_children;        /* Children that exited, not yet waited for. */
+    struct semaphore child_exited;      /* Counts EXITED_CHILDREN. */
     struct child *child_info;           /* Point to the structure of this thread in parent's child list.*/
 
     int st_exit;
@@ -126,6 +160,22 @@ struct thread
     struct list files;
     struct file *exec_file;              /* The executable file this thread is running. */
     int file_fd;
+
+    /* User threads.  All the threads of a process share the
+       address space and file descriptors of its first thread, its
+       "leader", which outlives the others.  The members from
+       PROC_LOCK on are used only in the leader. */
+    struct thread *leader;              /* Process's leader, or null. */
+    int stack_slot;                     /* User thread's stack, or -1. */
+    struct semaphore *wait_sema;        /* Interruptible sleep, or null. */
+    struct lock proc_lock;              /* Protects the members below. */
+    struct list user_threads;           /* Child records of user threads. */
+    int thread_cnt;                     /* Live threads, counting leader. */
+    struct condition thread_exited;     /* Signaled when THREAD_CNT drops. */
+    uint32_t stack_slots;               /* Bit N set if stack N in use. */
+    uint32_t stack_mapped;              /* Bit N set if stack N mapped. */
+    bool exiting;                       /* Killing the whole process? */
+    struct dead_space *dead_space;      /* Address space to reap. */
     
 #ifdef VM
     /* 虛擬記憶體支援 */
@@ -148,10 +198,8 @@ extern bool thread_mlfqs;
 void thread_init (void);
 void thread_start (void);
 
-void acquire_file_lock(void);
-void release_file_lock(void);
-
 void thread_tick (void);
+void thread_account_idle (int64_t ticks);
 void thread_print_stats (void);
 
 typedef void thread_func (void *aux);
@@ -166,6 +214,14 @@ const char *thread_name (void);
 
 void thread_exit (void) NO_RETURN;
 void thread_yield (void);
+#ifdef USERPROG
+struct child *thread_find_child (tid_t);
+struct child *thread_wait_any_child (void);
+void thread_disown_child (struct child *);
+void thread_release_child (struct child *);
+bool thread_sema_down_interruptible (struct semaphore *);
+void thread_interrupt_process (struct thread *leader);
+#endif
 
 /* Performs some operation on thread t, given auxiliary data AUX. */
 typedef void thread_action_func (struct thread *t, void *aux);
@@ -174,6 +230,10 @@ void thread_foreach (thread_action_func *, void *);
 int thread_get_priority (void);
 void thread_set_priority (int);
 
+bool thread_set_deadline (int64_t period, int64_t runtime);
+unsigned thread_get_deadline_misses (void);
+int64_t thread_next_release (void);
+
 int thread_get_nice (void);
 void thread_set_nice (int);
 int thread_get_recent_cpu (void);
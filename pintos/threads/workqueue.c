@@ -0,0 +1,134 @@
+#include "threads/workqueue.h"
+#include <debug.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/thread.h"
+
+/* A workqueue. */
+struct workqueue
+  {
+    const char *name;           /* Worker thread name. */
+    int priority;               /* Worker thread priority. */
+    struct list items;          /* Queued `struct work's, in order. */
+    struct thread *worker;      /* Worker thread, once started. */
+    bool waiting;               /* Worker blocked waiting for work? */
+    unsigned run_cnt;           /* # of items run. */
+    unsigned max_depth;         /* Most items ever queued at once. */
+    size_t depth;               /* Items queued now. */
+  };
+
+/* The system workqueues.  Their lists are initialized statically
+   so that work can be queued, for example by a softirq, before
+   workqueue_init() starts the workers. */
+static struct workqueue queues[WORK_PRI_CNT] =
+  {
+    {"kworker-high", PRI_MAX, LIST_INITIALIZER (queues[WORK_HIGH].items),
+     NULL, false, 0, 0, 0},
+    {"kworker", PRI_DEFAULT, LIST_INITIALIZER (queues[WORK_NORMAL].items),
+     NULL, false, 0, 0, 0},
+  };
+
+static thread_func worker;
+
+/* Starts a worker thread for each workqueue.  Must be called
+   after thread_start(). */
+void
+workqueue_init (void)
+{
+  int i;
+
+  for (i = 0; i < WORK_PRI_CNT; i++)
+    if (thread_create (queues[i].name, queues[i].priority,
+                       worker, &queues[i]) == TID_ERROR)
+      PANIC ("workqueue_init: cannot start %s", queues[i].name);
+}
+
+/* Prints workqueue statistics. */
+void
+workqueue_print_stats (void)
+{
+  int i;
+
+  for (i = 0; i < WORK_PRI_CNT; i++)
+    printf ("Workqueue %s: %u items run, at most %u queued\n",
+            queues[i].name, queues[i].run_cnt, queues[i].max_depth);
+}
+
+/* Initializes W to call FUNC, which can find AUX in W->aux. */
+void
+work_init (struct work *w, work_func *func, void *aux)
+{
+  ASSERT (w != NULL);
+  ASSERT (func != NULL);
+
+  w->func = func;
+  w->aux = aux;
+  w->pending = false;
+}
+
+/* Queues W on workqueue PRI, unless it is already queued and has
+   not yet started running.  Returns true if W was queued, false
+   if it was already pending.
+
+   W may be queued again as soon as its function starts, and its
+   function may free W.  May be called from an interrupt
+   handler.  Work queued on WORK_HIGH from an interrupt handler
+   runs as soon as the interrupt returns. */
+bool
+work_queue (enum work_priority pri, struct work *w)
+{
+  struct workqueue *wq;
+  enum intr_level old_level;
+  bool queued = false;
+
+  ASSERT (pri < WORK_PRI_CNT);
+  ASSERT (w != NULL);
+
+  wq = &queues[pri];
+  old_level = intr_disable ();
+  if (!w->pending)
+    {
+      w->pending = true;
+      list_push_back (&wq->items, &w->elem);
+      if (++wq->depth > wq->max_depth)
+        wq->max_depth = wq->depth;
+      if (wq->waiting)
+        {
+          wq->waiting = false;
+          thread_unblock (wq->worker);
+          if (pri == WORK_HIGH && intr_context ())
+            intr_yield_on_return ();
+        }
+      queued = true;
+    }
+  intr_set_level (old_level);
+
+  return queued;
+}
+
+/* Worker thread for workqueue WQ_. */
+static void
+worker (void *wq_)
+{
+  struct workqueue *wq = wq_;
+
+  wq->worker = thread_current ();
+  for (;;)
+    {
+      struct work *w;
+
+      intr_disable ();
+      while (list_empty (&wq->items))
+        {
+          wq->waiting = true;
+          thread_block ();
+        }
+      w = list_entry (list_pop_front (&wq->items), struct work, elem);
+      w->pending = false;
+      wq->depth--;
+      wq->run_cnt++;
+      intr_enable ();
+
+      w->func (w);
+    }
+}
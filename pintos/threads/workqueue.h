@@ -0,0 +1,46 @@
+#ifndef THREADS_WORKQUEUE_H
+#define THREADS_WORKQUEUE_H
+
+#include <list.h>
+#include <stdbool.h>
+
+/* Deferred work.
+
+   Interrupt handlers run with interrupts off and may not sleep,
+   so anything slow or blocking that an interrupt needs done is
+   packaged as a `struct work' and queued on one of the system
+   workqueues.  Each workqueue has its own kernel thread, which
+   runs the queued items in order with interrupts on, and may
+   sleep.
+
+   Work too urgent to wait for a worker thread but still too slow
+   for a hard interrupt handler belongs in a softirq instead (see
+   intr_raise_softirq()). */
+
+/* Workqueues, one worker thread each. */
+enum work_priority
+  {
+    WORK_HIGH,                  /* Runs as soon as the interrupt returns. */
+    WORK_NORMAL,                /* Runs when the worker is next scheduled. */
+    WORK_PRI_CNT                /* Number of workqueues. */
+  };
+
+struct work;
+typedef void work_func (struct work *);
+
+/* A work item. */
+struct work
+  {
+    struct list_elem elem;      /* Element in a workqueue. */
+    work_func *func;            /* Function to run. */
+    void *aux;                  /* For use by FUNC. */
+    bool pending;               /* Queued but not yet started? */
+  };
+
+void workqueue_init (void);
+void workqueue_print_stats (void);
+
+void work_init (struct work *, work_func *, void *aux);
+bool work_queue (enum work_priority, struct work *);
+
+#endif /* threads/workqueue.h */
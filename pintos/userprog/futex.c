@@ -0,0 +1,249 @@
+#include "userprog/futex.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "userprog/process.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
+
+/* Futexes ("fast user-space mutexes").
+
+   A futex is any aligned 32-bit word in user memory.  User code
+   manipulates the word with atomic instructions and enters the
+   kernel only to sleep until the word changes (futex_wait()) or
+   to wake threads sleeping on it (futex_wake()).
+
+   Waiters are kept in a hash table keyed by the physical address
+   of the word, so threads that reach the same word through
+   different virtual addresses still find each other.  Each
+   bucket has its own lock, which futex_wait() holds while it
+   checks the word's value and adds itself to the bucket, so a
+   wakeup cannot slip in between the check and the sleep.
+
+   A process that is being terminated wakes all of its threads
+   that are waiting, so that they can exit.
+
+   With virtual memory, each waiter pins the page that holds its
+   word, so that the page keeps its physical address until the
+   last of them wakes up.  Frame pins are counted, so these do not
+   disturb pins that the system call layer holds on the same
+   page, nor the other way around. */
+
+/* Number of hash buckets. */
+#define BUCKET_CNT 64
+
+/* A hash bucket. */
+struct futex_bucket
+  {
+    struct lock lock;           /* Protects WAITERS. */
+    struct list waiters;        /* List of struct futex_waiter. */
+  };
+
+static struct futex_bucket buckets[BUCKET_CNT];
+
+/* A thread waiting on a futex. */
+struct futex_waiter
+  {
+    uintptr_t key;              /* Physical address of the word. */
+    struct thread *leader;      /* Leader of the waiter's process. */
+    struct semaphore sema;      /* Up'd by futex_wake(). */
+    struct list_elem elem;      /* Element in bucket's waiters list. */
+  };
+
+static struct futex_bucket *bucket_for (uintptr_t key);
+static uint32_t *user_to_kernel (const uint32_t *uaddr);
+static uint32_t *pin_word (uint32_t *uaddr);
+static void unpin_word (uint32_t *uaddr, uint32_t *kaddr);
+
+/* Initializes the futex wait table. */
+void
+futex_init (void)
+{
+  struct futex_bucket *b;
+
+  for (b = buckets; b < buckets + BUCKET_CNT; b++)
+    {
+      lock_init (&b->lock);
+      list_init (&b->waiters);
+    }
+}
+
+/* If the word at user address UADDR in the current process holds
+   VAL, sleeps until futex_wake() is called on the same word and
+   returns 0.  Otherwise, or if the current process is being
+   terminated, returns FUTEX_AGAIN at once.  Returns
+   FUTEX_FAULT if UADDR is not a valid, aligned user address. */
+int
+futex_wait (uint32_t *uaddr, uint32_t val)
+{
+  struct futex_waiter w;
+  struct futex_bucket *b;
+  uint32_t *kaddr;
+  int result = FUTEX_AGAIN;
+
+  kaddr = pin_word (uaddr);
+  if (kaddr == NULL)
+    return FUTEX_FAULT;
+
+  w.key = vtop (kaddr);
+  w.leader = thread_current ()->leader;
+  b = bucket_for (w.key);
+  lock_acquire (&b->lock);
+  if (*(volatile uint32_t *) kaddr == val && !process_exiting ())
+    {
+      sema_init (&w.sema, 0);
+      list_push_back (&b->waiters, &w.elem);
+      result = 0;
+    }
+  lock_release (&b->lock);
+
+  if (result == 0)
+    sema_down (&w.sema);
+  unpin_word (uaddr, kaddr);
+  return result;
+}
+
+/* Wakes up to N threads waiting on the word at user address
+   UADDR in the current process, in the order they began
+   waiting.  Returns the number woken, or FUTEX_FAULT if UADDR is
+   not a valid, aligned user address. */
+int
+futex_wake (uint32_t *uaddr, int n)
+{
+  struct futex_bucket *b;
+  struct list_elem *e;
+  uint32_t *kaddr;
+  uintptr_t key;
+  int woken = 0;
+
+  kaddr = user_to_kernel (uaddr);
+  if (kaddr == NULL)
+    {
+#ifdef VM
+      /* A page that is not in memory cannot have waiters. */
+      if (is_user_vaddr (uaddr) && (uintptr_t) uaddr % sizeof *uaddr == 0
+          && spt_find_page (thread_current ()->spt,
+                            pg_round_down (uaddr)) != NULL)
+        return 0;
+#endif
+      return FUTEX_FAULT;
+    }
+
+  key = vtop (kaddr);
+  b = bucket_for (key);
+  lock_acquire (&b->lock);
+  for (e = list_begin (&b->waiters);
+       e != list_end (&b->waiters) && woken < n; )
+    {
+      struct futex_waiter *w = list_entry (e, struct futex_waiter, elem);
+      if (w->key == key)
+        {
+          e = list_remove (e);
+          sema_up (&w->sema);
+          woken++;
+        }
+      else
+        e = list_next (e);
+    }
+  lock_release (&b->lock);
+
+  return woken;
+}
+
+/* Wakes every thread of the process led by LEADER that is
+   waiting on any futex.  The process must already be marked as
+   exiting, so that no thread of it starts waiting afterward. */
+void
+futex_wake_process (struct thread *leader)
+{
+  struct futex_bucket *b;
+
+  for (b = buckets; b < buckets + BUCKET_CNT; b++)
+    {
+      struct list_elem *e;
+
+      lock_acquire (&b->lock);
+      for (e = list_begin (&b->waiters); e != list_end (&b->waiters); )
+        {
+          struct futex_waiter *w = list_entry (e, struct futex_waiter, elem);
+          if (w->leader == leader)
+            {
+              e = list_remove (e);
+              sema_up (&w->sema);
+            }
+          else
+            e = list_next (e);
+        }
+      lock_release (&b->lock);
+    }
+}
+
+/* Returns the hash bucket for physical address KEY. */
+static struct futex_bucket *
+bucket_for (uintptr_t key)
+{
+  return &buckets[hash_int (key / sizeof (uint32_t)) % BUCKET_CNT];
+}
+
+/* Returns the kernel virtual address of the word at user address
+   UADDR in the current process, or a null pointer if UADDR is
+   misaligned, is not a user address, or is not mapped. */
+static uint32_t *
+user_to_kernel (const uint32_t *uaddr)
+{
+  uint8_t *kpage;
+
+  if (!is_user_vaddr (uaddr) || (uintptr_t) uaddr % sizeof *uaddr != 0)
+    return NULL;
+  kpage = pagedir_get_page (thread_current ()->pagedir, uaddr);
+  return kpage != NULL ? (uint32_t *) (kpage + pg_ofs (uaddr)) : NULL;
+}
+
+/* Returns the kernel virtual address of the word at user address
+   UADDR in the current process, as user_to_kernel(), first
+   bringing its page into memory and pinning it there if the
+   kernel has virtual memory.  Each successful call must be
+   balanced by a call to unpin_word(). */
+static uint32_t *
+pin_word (uint32_t *uaddr)
+{
+#ifdef VM
+  struct thread *t = thread_current ();
+  void *upage = pg_round_down (uaddr);
+  uint32_t *kaddr;
+
+  if (!is_user_vaddr (uaddr) || (uintptr_t) uaddr % sizeof *uaddr != 0)
+    return NULL;
+
+  /* The page may be evicted between loading and pinning it, in
+     which case the pin did not take hold; drop it and retry. */
+  for (;;)
+    {
+      if (pagedir_get_page (t->pagedir, upage) == NULL
+          && !vm_load_page (t->spt, t->pagedir, upage))
+        return NULL;
+      vm_pin_page (t->spt, upage);
+      kaddr = user_to_kernel (uaddr);
+      if (kaddr != NULL)
+        return kaddr;
+      vm_unpin_page (t->spt, upage);
+    }
+#else
+  return user_to_kernel (uaddr);
+#endif
+}
+
+/* Releases the pin that pin_word() took on the page of the word
+   at user address UADDR, whose kernel address is KADDR. */
+static void
+unpin_word (uint32_t *uaddr UNUSED, uint32_t *kaddr UNUSED)
+{
+#ifdef VM
+  vm_unpin_page (thread_current ()->spt, pg_round_down (uaddr));
+#endif
+}
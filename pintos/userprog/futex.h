@@ -0,0 +1,18 @@
+#ifndef USERPROG_FUTEX_H
+#define USERPROG_FUTEX_H
+
+#include <stdint.h>
+
+struct thread;
+
+/* Return values for futex_wait() and futex_wake(), besides 0
+   and counts of threads woken. */
+#define FUTEX_AGAIN (-1)        /* Word did not hold the expected value. */
+#define FUTEX_FAULT (-2)        /* Bad user address. */
+
+void futex_init (void);
+int futex_wait (uint32_t *uaddr, uint32_t val);
+int futex_wake (uint32_t *uaddr, int n);
+void futex_wake_process (struct thread *leader);
+
+#endif /* userprog/futex.h */
@@ -18,11 +18,87 @@
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "threads/malloc.h"
+#include "devices/input.h"
+#include "userprog/futex.h"
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/swap.h"
+#endif
+
+/* User thread stacks.  Each thread after the first in a process
+   gets a fixed-size stack in one of MAX_USER_THREADS slots,
+   which lie just below the region reserved for the first
+   thread's growable stack. */
+#define MAX_USER_THREADS 32
+#define USER_STACK_MAX 0x800000         /* First thread's stack limit. */
+#define THREAD_STACK_PAGES 16           /* 64 kB per thread. */
+#define THREAD_STACK_SIZE (THREAD_STACK_PAGES * PGSIZE)
+#define THREAD_STACK_TOP(SLOT) \
+        ((uint8_t *) PHYS_BASE - USER_STACK_MAX - (SLOT) * THREAD_STACK_SIZE)
+
+/* Start-up information for a new user thread. */
+struct thread_start
+  {
+    struct thread *leader;      /* Leader of the process to join. */
+    int slot;                   /* Stack slot. */
+    void (*entry) (void);       /* User entry point. */
+    void *func, *aux;           /* Arguments for ENTRY. */
+  };
+
+/* The address space of an exited process, waiting to be torn
+   down by the reaper thread.  Exiting detaches the address space
+   from the thread, and the reaper frees it after the thread has
+   posted its exit status, so that a parent waiting for the
+   process does not wait for the teardown too. */
+struct dead_space
+  {
+    struct list_elem elem;      /* Element in dead_spaces. */
+    uint32_t *pagedir;          /* Page directory. */
+#ifdef VM
+    struct supplemental_page_table *spt; /* Supplemental page table. */
+    struct list frames;         /* Frames, already out of frame table. */
+#endif
+  };
+
+/* Address spaces waiting for the reaper.  Protected by disabling
+   interrupts, because thread_exit() queues them with interrupts
+   off. */
+static struct list dead_spaces;
+static struct thread *reaper;   /* The reaper thread. */
+static bool reaper_waiting;     /* Reaper blocked waiting for work? */
+static long long reap_cnt;      /* # of address spaces reaped. */
+static long long reap_batches;  /* # of times the reaper woke. */
+
+/* See process.h. */
+bool process_sync_reap;
 
 static thread_func start_process NO_RETURN;
+static thread_func reap_thread NO_RETURN;
+static void destroy_space (struct dead_space *);
+static thread_func start_user_thread NO_RETURN;
+static bool map_thread_stack (int slot);
+static void wait_for_threads (struct thread *leader);
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
 static void push_argument(void **esp, char *cmdline);
 
+/* Starts the reaper thread.  Must be called after
+   thread_start(). */
+void
+process_init (void)
+{
+  list_init (&dead_spaces);
+  if (thread_create ("reaper", PRI_DEFAULT, reap_thread, NULL) == TID_ERROR)
+    PANIC ("process_init: cannot start reaper");
+}
+
+/* Prints reaper statistics. */
+void
+process_print_stats (void)
+{
+  printf ("Reaper: %lld address spaces in %lld batches\n",
+          reap_cnt, reap_batches);
+}
+
 /* Starts a new thread running a user program loaded from
    FILENAME.  The new thread may be scheduled (and may even exit)
    before process_execute() returns.  Returns the new process's
@@ -60,6 +136,8 @@ process_execute(const char *file_name)
     sema_down(&thread_current()->sema_wait);
     if (!thread_current()->child_loaded) {
         free(fn_copy);
+        /* Reap it, so that wait_any() never returns it. */
+        process_wait(tid);
         return TID_ERROR;
     }
 
@@ -112,6 +190,8 @@ start_process (void *file_name_)
   struct intr_frame if_;
   bool success;
 
+  thread_current ()->leader = thread_current ();
+
   /* 初始化中斷frame */
   memset (&if_, 0, sizeof if_);
   if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
@@ -166,71 +246,202 @@ start_process (void *file_name_)
 
    This function will be implemented in problem 2-2.  For now, it
    does nothing. */
-   static struct child *find_child(struct thread *parent, tid_t child_tid)
-   {
-     struct list_elem *e;
-     for(e = list_begin(&parent->children); e != list_end(&parent->children); e = list_next(e)){
-       struct child *c = list_entry(e, struct child, elem);
-       if(c->tid == child_tid) return c;
-     }
-     return NULL;
-   }
-   
    int process_wait (tid_t child_tid UNUSED) 
    {
-     struct child *c = find_child(thread_current(), child_tid);
+     struct child *c = thread_find_child(child_tid);
+     enum intr_level old_level;
+     bool claimed;
    
      if(!c){
        // printf("[DEBUG] Parent %d cannot find child %d\n", thread_current()->tid, child_tid);
        return -1;
      } 
-     if(c->succ){
+
+     /* Any thread of the process may wait, so claim C atomically. */
+     old_level = intr_disable ();
+     claimed = !c->succ;
+     c->succ = true;
+     intr_set_level (old_level);
+     if(!claimed){
        // printf("[DEBUG] Parent %d already waited for child %d\n", thread_current()->tid, child_tid);
        return -1;
      } 
    
-     c->succ = true;
-     sema_down(&c->sema_wait);
+     /* A process being terminated stops waiting; its leader gives
+        up C when it exits. */
+     if (!thread_sema_down_interruptible (&c->sema_wait))
+       return -1;
    
      int status = c->st_exit;
-     list_remove(&c->elem);
-     free(c);
+     thread_release_child(c);
    
      return status;
    }
 
-/* Free the current process's resources. */
+/* Waits for whichever child of the calling process exits first,
+   stores its exit status in *STATUS, and returns its tid.  Each
+   child can be waited for only once, whether by process_wait()
+   or by this function.  Returns -1 at once if there is no child
+   left to wait for, or if the process is being terminated. */
+tid_t
+process_wait_any (int *status)
+{
+  struct child *c = thread_wait_any_child ();
+  tid_t tid;
+
+  if (c == NULL)
+    return -1;
+  tid = c->tid;
+  *status = c->st_exit;
+  thread_release_child (c);
+  return tid;
+}
+
+/* Free the current process's resources.  A thread other than the
+   leader only detaches itself from the process.  The leader first
+   waits for the process's other threads to exit, then tears down
+   the address space they shared. */
 void
 process_exit (void)
 {
   struct thread *cur = thread_current ();
+  struct thread *leader = cur->leader;
+  struct dead_space local, *space;
   uint32_t *pd;
 
+  if (leader != NULL && leader != cur)
+    {
+      /* Stop using the address space before the leader can free
+         it. */
+      cur->pagedir = NULL;
 #ifdef VM
-  /* 銷毀補充頁表及其所有page、frame和swap空間 */
-  if (cur->spt != NULL) {
-    supplemental_page_table_destroy(cur->spt);
-    free(cur->spt);
-    cur->spt = NULL;
-  }
+      cur->spt = NULL;
 #endif
+      pagedir_activate (NULL);
+
+      lock_acquire (&leader->proc_lock);
+      leader->stack_slots &= ~(1u << cur->stack_slot);
+      leader->thread_cnt--;
+      cond_signal (&leader->thread_exited, &leader->proc_lock);
+      lock_release (&leader->proc_lock);
+      return;
+    }
+  if (leader != NULL)
+    wait_for_threads (leader);
 
-  /* Destroy the current process's page directory and switch back
+  /* Detach the current process's address space and switch back
      to the kernel-only page directory. */
   pd = cur->pagedir;
-  if (pd != NULL) 
+  if (pd == NULL)
+    return;
+
+  /* Queue the address space for the reaper, or tear it down
+     here if we may not or cannot. */
+  space = process_sync_reap || reaper == NULL ? NULL : malloc (sizeof *space);
+  if (space == NULL)
+    space = &local;
+  space->pagedir = pd;
+#ifdef VM
+  space->spt = cur->spt;
+  list_init (&space->frames);
+  /* Our frames must leave the frame table while cur->pagedir is
+     still set, since eviction looks up a frame's page directory
+     through its owner thread. */
+  if (space->spt != NULL)
+    vm_frame_detach_all (space->spt, &space->frames);
+  cur->spt = NULL;
+#endif
+
+  /* Correct ordering here is crucial.  We must set cur->pagedir
+     to NULL before switching page directories, so that a timer
+     interrupt can't switch back to the process page directory.
+     We must activate the base page directory before destroying
+     the process's page directory, or our active page directory
+     will be one that's been freed (and cleared). */
+  cur->pagedir = NULL;
+  pagedir_activate (NULL);
+
+  if (space == &local)
+    destroy_space (space);
+  else
+    cur->dead_space = space;
+}
+
+/* Hands the address space that process_exit() detached from the
+   current thread, if any, to the reaper thread.  Called by
+   thread_exit() after the thread has posted its exit status.
+   May be called with interrupts off. */
+void
+process_reap (void)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  if (cur->dead_space == NULL)
+    return;
+
+  old_level = intr_disable ();
+  list_push_back (&dead_spaces, &cur->dead_space->elem);
+  cur->dead_space = NULL;
+  if (reaper_waiting)
     {
-      /* Correct ordering here is crucial.  We must set
-         cur->pagedir to NULL before switching page directories,
-         so that a timer interrupt can't switch back to the
-         process page directory.  We must activate the base page
-         directory before destroying the process's page
-         directory, or our active page directory will be one
-         that's been freed (and cleared). */
-      cur->pagedir = NULL;
-      pagedir_activate (NULL);
-      pagedir_destroy (pd);
+      reaper_waiting = false;
+      thread_unblock (reaper);
     }
+  intr_set_level (old_level);
+}
+
+/* The reaper thread.  Tears down the address spaces that exited
+   processes queue with process_reap(), all that are waiting each
+   time it wakes up. */
+static void
+reap_thread (void *aux UNUSED)
+{
+  struct list batch;
+
+  reaper = thread_current ();
+  list_init (&batch);
+  for (;;)
+    {
+      enum intr_level old_level = intr_disable ();
+      while (list_empty (&dead_spaces))
+        {
+          reaper_waiting = true;
+          thread_block ();
+        }
+      while (!list_empty (&dead_spaces))
+        list_push_back (&batch, list_pop_front (&dead_spaces));
+      intr_set_level (old_level);
+
+      reap_batches++;
+      while (!list_empty (&batch))
+        {
+          struct dead_space *space
+            = list_entry (list_pop_front (&batch), struct dead_space, elem);
+          destroy_space (space);
+          free (space);
+          reap_cnt++;
+        }
+    }
+}
+
+/* Frees the memory, swap slots, and page tables of SPACE, an
+   address space that process_exit() detached from its thread. */
+static void
+destroy_space (struct dead_space *space)
+{
+#ifdef VM
+  /* Free the frames first, unmapping them, so that
+     pagedir_destroy() does not free them again. */
+  vm_frame_free_detached (&space->frames, space->pagedir);
+  if (space->spt != NULL)
+    {
+      vm_swap_release_all (space->spt);
+      supplemental_page_table_destroy (space->spt);
+      free (space->spt);
+    }
+#endif
+  pagedir_destroy (space->pagedir);
 }
 
 /* Sets up the CPU for running user code in the current
@@ -355,7 +566,6 @@ load (const char *file_name, void (**eip) (void), void **esp)
   process_activate ();
 
   /* Open executable file. */
-  acquire_file_lock();
   file = filesys_open (exec_name);
   if (file == NULL) 
     {
@@ -455,7 +665,6 @@ load (const char *file_name, void (**eip) (void), void **esp)
 
  done:
   /* We arrive here whether the load is successful or not. */
-  release_file_lock();
   free(fn_copy);
   return success;
 }
@@ -636,4 +845,275 @@ install_page (void *upage, void *kpage, bool writable)
      address, then map our page there. */
   return (pagedir_get_page (t->pagedir, upage) == NULL
           && pagedir_set_page (t->pagedir, upage, kpage, writable));
-}
\ No newline at end of file
+}
+/* User threads. */
+
+/* Starts a new thread in the current process, which begins
+   running user code at ENTRY, with FUNC and AUX as its two
+   arguments, on a stack of its own.  The new thread shares the
+   process's address space and file descriptors.  Returns the new
+   thread's tid, or TID_ERROR if the process already has
+   MAX_USER_THREADS extra threads, if memory is exhausted, or if
+   the process is exiting. */
+tid_t
+process_thread_create (void (*entry) (void), void *func, void *aux)
+{
+  struct thread *cur = thread_current ();
+  struct thread *leader = cur->leader;
+  struct thread_start *start;
+  enum intr_level old_level;
+  struct child *c;
+  tid_t tid;
+  int slot;
+
+  start = malloc (sizeof *start);
+  if (start == NULL)
+    return TID_ERROR;
+
+  /* Claim a stack. */
+  lock_acquire (&leader->proc_lock);
+  for (slot = 0; slot < MAX_USER_THREADS; slot++)
+    if (!(leader->stack_slots & (1u << slot)))
+      break;
+  if (leader->exiting || slot >= MAX_USER_THREADS
+      || !map_thread_stack (slot))
+    {
+      lock_release (&leader->proc_lock);
+      free (start);
+      return TID_ERROR;
+    }
+  leader->stack_slots |= 1u << slot;
+  leader->thread_cnt++;
+  lock_release (&leader->proc_lock);
+
+  start->leader = leader;
+  start->slot = slot;
+  start->entry = entry;
+  start->func = func;
+  start->aux = aux;
+  tid = thread_create (leader->name, PRI_DEFAULT, start_user_thread, start);
+  if (tid == TID_ERROR)
+    {
+      lock_acquire (&leader->proc_lock);
+      leader->stack_slots &= ~(1u << slot);
+      leader->thread_cnt--;
+      cond_signal (&leader->thread_exited, &leader->proc_lock);
+      lock_release (&leader->proc_lock);
+      free (start);
+      return TID_ERROR;
+    }
+
+  /* thread_create() recorded the new thread as our child.  Move
+     the record to the process's list of threads, where any of
+     its threads can join it. */
+  c = thread_find_child (tid);
+  thread_disown_child (c);
+  lock_acquire (&leader->proc_lock);
+  old_level = intr_disable ();
+  list_remove (&c->elem);
+  intr_set_level (old_level);
+  list_push_back (&leader->user_threads, &c->elem);
+  lock_release (&leader->proc_lock);
+
+  return tid;
+}
+
+/* Waits for thread TID of the current process to exit.  Returns
+   0 if successful, or -1 if TID is not a thread of this process
+   started by process_thread_create(), is the calling thread, or
+   has already been joined. */
+int
+process_thread_join (tid_t tid)
+{
+  struct thread *leader = thread_current ()->leader;
+  struct child *c = NULL;
+  struct list_elem *e;
+
+  if (tid == thread_tid ())
+    return -1;
+
+  lock_acquire (&leader->proc_lock);
+  for (e = list_begin (&leader->user_threads);
+       e != list_end (&leader->user_threads); e = list_next (e))
+    if (list_entry (e, struct child, elem)->tid == tid)
+      {
+        c = list_entry (e, struct child, elem);
+        break;
+      }
+  if (c == NULL || c->succ)
+    {
+      lock_release (&leader->proc_lock);
+      return -1;
+    }
+  c->succ = true;
+  lock_release (&leader->proc_lock);
+
+  sema_down (&c->sema_wait);
+
+  lock_acquire (&leader->proc_lock);
+  thread_release_child (c);
+  lock_release (&leader->proc_lock);
+  return 0;
+}
+
+/* Ends the calling thread, but not the rest of its process.  If
+   the caller is the process's leader, the process exits, with
+   status 0, once its other threads have all exited. */
+void
+process_thread_exit (void)
+{
+  if (!process_exiting ())
+    thread_current ()->st_exit = 0;
+  thread_exit ();
+}
+
+/* Terminates the current process with exit code STATUS.  The
+   calling thread exits at once.  The process's other threads
+   exit the next time they enter or leave the kernel.  Threads
+   sleeping in futex_wait(), process_wait(), process_wait_any(),
+   or for console input are woken so that they do so.  If several
+   threads terminate the process, the first STATUS counts. */
+void
+process_terminate (int status)
+{
+  struct thread *cur = thread_current ();
+  struct thread *leader = cur->leader;
+
+  if (leader != NULL)
+    {
+      lock_acquire (&leader->proc_lock);
+      if (!leader->exiting)
+        {
+          leader->exiting = true;
+          leader->st_exit = status;
+        }
+      lock_release (&leader->proc_lock);
+      futex_wake_process (leader);
+      thread_interrupt_process (leader);
+      input_kick ();
+    }
+  if (leader != cur)
+    cur->st_exit = status;
+  thread_exit ();
+}
+
+/* Returns true if the current thread belongs to a process that
+   is being terminated, false otherwise. */
+bool
+process_exiting (void)
+{
+  struct thread *leader = thread_current ()->leader;
+
+  return leader != NULL && leader->exiting;
+}
+
+/* A thread function that runs a new user thread, given the
+   struct thread_start that process_thread_create() allocated. */
+static void
+start_user_thread (void *start_)
+{
+  struct thread_start *start = start_;
+  struct thread *cur = thread_current ();
+  struct thread *leader = start->leader;
+  uint8_t *top = THREAD_STACK_TOP (start->slot);
+  uint8_t *upage = top - PGSIZE;
+  struct intr_frame if_;
+  uint32_t *frame;
+  uint8_t *kpage;
+
+  cur->leader = leader;
+  cur->stack_slot = start->slot;
+  cur->pagedir = leader->pagedir;
+#ifdef VM
+  cur->spt = leader->spt;
+#endif
+  process_activate ();
+
+  /* Build ENTRY's stack frame, with a null return address, through
+     the kernel mapping of the stack's top page.  That page must
+     stay put while we do. */
+#ifdef VM
+  if (pagedir_get_page (cur->pagedir, upage) == NULL)
+    vm_load_page (cur->spt, cur->pagedir, upage);
+  vm_pin_page (cur->spt, upage);
+#endif
+  kpage = pagedir_get_page (cur->pagedir, upage);
+  if (kpage == NULL)
+    {
+#ifdef VM
+      vm_unpin_page (cur->spt, upage);
+#endif
+      free (start);
+      process_thread_exit ();
+    }
+  frame = (uint32_t *) (kpage + PGSIZE) - 3;
+  frame[0] = 0;
+  frame[1] = (uint32_t) start->func;
+  frame[2] = (uint32_t) start->aux;
+#ifdef VM
+  vm_unpin_page (cur->spt, upage);
+#endif
+
+  memset (&if_, 0, sizeof if_);
+  if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
+  if_.cs = SEL_UCSEG;
+  if_.eflags = FLAG_IF | FLAG_MBS;
+  if_.eip = start->entry;
+  if_.esp = top - 3 * sizeof (uint32_t);
+  free (start);
+
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
+/* Maps the pages of user thread stack SLOT into the current
+   process, unless an earlier thread that used the slot already
+   did.  Must be called with the leader's PROC_LOCK held. */
+static bool
+map_thread_stack (int slot)
+{
+  struct thread *cur = thread_current ();
+  struct thread *leader = cur->leader;
+  uint8_t *upage;
+
+  if (leader->stack_mapped & (1u << slot))
+    return true;
+
+  for (upage = THREAD_STACK_TOP (slot) - THREAD_STACK_SIZE;
+       upage < THREAD_STACK_TOP (slot); upage += PGSIZE)
+    {
+#ifdef VM
+      if (spt_find_page (cur->spt, upage) == NULL
+          && !vm_alloc_page (VM_ANON, upage, true))
+        return false;
+#else
+      if (pagedir_get_page (cur->pagedir, upage) == NULL)
+        {
+          uint8_t *kpage = palloc_get_page (PAL_USER | PAL_ZERO);
+          if (kpage == NULL)
+            return false;
+          if (!install_page (upage, kpage, true))
+            {
+              palloc_free_page (kpage);
+              return false;
+            }
+        }
+#endif
+    }
+  leader->stack_mapped |= 1u << slot;
+  return true;
+}
+
+/* Waits until the process led by LEADER has no threads but
+   LEADER itself, then gives up LEADER's records of them. */
+static void
+wait_for_threads (struct thread *leader)
+{
+  lock_acquire (&leader->proc_lock);
+  while (leader->thread_cnt > 1)
+    cond_wait (&leader->thread_exited, &leader->proc_lock);
+  while (!list_empty (&leader->user_threads))
+    thread_release_child (list_entry (list_front (&leader->user_threads),
+                                      struct child, elem));
+  lock_release (&leader->proc_lock);
+}
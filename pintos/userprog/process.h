@@ -3,9 +3,24 @@
 
 #include "threads/thread.h"
 
+/* Tear down exited processes' address spaces synchronously,
+   instead of in the reaper thread?  Controlled by kernel
+   command-line option "-sync-reap". */
+extern bool process_sync_reap;
+
+void process_init (void);
 tid_t process_execute (const char *file_name);
 int process_wait (tid_t);
+tid_t process_wait_any (int *status);
 void process_exit (void);
+void process_reap (void);
+void process_print_stats (void);
 void process_activate (void);
 
+tid_t process_thread_create (void (*entry) (void), void *func, void *aux);
+int process_thread_join (tid_t);
+void process_thread_exit (void) NO_RETURN;
+void process_terminate (int status) NO_RETURN;
+bool process_exiting (void);
+
 #endif /* userprog/process.h */
@@ -13,10 +13,12 @@
 #include <threads/palloc.h>
 #include "process.h"
 #include "pagedir.h"
+#include "futex.h"
 #include <threads/vaddr.h>
 #include <filesys/filesys.h>
+#include <devices/timer.h>
 
-#define MAX_SYSCALL 20
+#define MAX_SYSCALL 27
 
 // lab01 Hint - Here are the system calls you need to implement.
 
@@ -26,6 +28,7 @@ void sys_halt(void);
 void sys_exit(int status);
 void sys_exec(struct intr_frame* f);
 void sys_wait(struct intr_frame* f);
+void sys_wait_any(struct intr_frame* f);
 
 /* System call for file. */
 void sys_create(struct intr_frame* f);
@@ -38,6 +41,16 @@ void sys_seek(struct intr_frame* f);
 void sys_tell(struct intr_frame* f);
 void sys_close(struct intr_frame* f);
 
+/* System call for time. */
+void sys_clock_ns(struct intr_frame* f);
+
+/* System call for synchronization. */
+void sys_futex_wait(struct intr_frame* f);
+void sys_futex_wake(struct intr_frame* f);
+void sys_thread_create(struct intr_frame* f);
+void sys_thread_join(struct intr_frame* f);
+void sys_thread_exit(struct intr_frame* f);
+
 #ifdef VM
 /* 預加載並pin住[addr, addr+size)跨越的所有page */
 void
@@ -83,13 +96,23 @@ static void (*syscalls[MAX_SYSCALL])(struct intr_frame *) = {
   [SYS_WRITE] = sys_write,
   [SYS_SEEK] = sys_seek,
   [SYS_TELL] = sys_tell,
-  [SYS_CLOSE] = sys_close
+  [SYS_CLOSE] = sys_close,
+  [SYS_CLOCK_NS] = sys_clock_ns,
+  [SYS_FUTEX_WAIT] = sys_futex_wait,
+  [SYS_FUTEX_WAKE] = sys_futex_wake,
+  [SYS_THREAD_CREATE] = sys_thread_create,
+  [SYS_THREAD_JOIN] = sys_thread_join,
+  [SYS_THREAD_EXIT] = sys_thread_exit,
+  [SYS_WAIT_ANY] = sys_wait_any
 };
 
 static void syscall_handler (struct intr_frame *);
 static void *check_ptr(const void *vaddr);
+static void *check_writable_ptr(const void *vaddr);
 static int get_user(const uint8_t *uaddr);
 static struct open_file *find_file(int fd);
+static struct open_file *find_and_remove_file(int fd);
+static void put_file(struct open_file *);
 void invalid_access (void);
 
 void syscall_init (void) 
@@ -115,21 +138,85 @@ static void *check_ptr(const void *vaddr)
     return (void *)vaddr;
 }
 
-static struct open_file *find_file(int fd)
+/* Like check_ptr(), but also requires VADDR to be writable by
+   the process, for output buffers that the kernel fills in. */
+static void *check_writable_ptr(const void *vaddr)
+{
+    check_ptr(vaddr);
+    if (!pagedir_is_writable(thread_current()->pagedir, vaddr))
+        invalid_access();
+    return (void *)vaddr;
+}
+
+/* Returns the entry for FD in the open-file table of
+   LEADER, or NULL.  LEADER's proc_lock must be held. */
+static struct open_file *lookup_file(struct thread *leader, int fd)
 {
-  struct list *files = &thread_current()->files;
+  struct list *files = &leader->files;
+
   for (struct list_elem *e = list_begin(files); e != list_end(files); e = list_next(e)) {
       struct open_file *f = list_entry(e, struct open_file, elem);
-      if (f->fd == fd) {
+      if (f->fd == fd)
           return f;
-      }
   }
   return NULL;
 }
 
+/* Open files belong to the process, so all of its threads use
+   the table in its leader, and hold the entry's pos_lock while
+   they use or move the file's position.  Returns the entry for
+   FD with a reference taken, so that a close() in another thread
+   cannot free it while the caller uses it, or NULL.  The caller
+   must drop the reference with put_file(). */
+static struct open_file *find_file(int fd)
+{
+  struct thread *leader = thread_current()->leader;
+  struct open_file *found;
+
+  lock_acquire(&leader->proc_lock);
+  found = lookup_file(leader, fd);
+  if (found)
+      found->refs++;
+  lock_release(&leader->proc_lock);
+  return found;
+}
+
+/* Removes the entry for FD from the open-file table and returns
+   it, carrying the table's reference, or returns NULL.  Lookup
+   and removal happen under one hold of proc_lock, so only one of
+   several threads closing FD gets the entry. */
+static struct open_file *find_and_remove_file(int fd)
+{
+  struct thread *leader = thread_current()->leader;
+  struct open_file *found;
+
+  lock_acquire(&leader->proc_lock);
+  found = lookup_file(leader, fd);
+  if (found)
+      list_remove(&found->elem);
+  lock_release(&leader->proc_lock);
+  return found;
+}
+
+/* Drops a reference to F.  The last reference closes the file
+   and frees F. */
+static void put_file(struct open_file *f)
+{
+  struct thread *leader = thread_current()->leader;
+  bool last;
+
+  lock_acquire(&leader->proc_lock);
+  last = --f->refs == 0;
+  lock_release(&leader->proc_lock);
+  if (last) {
+      file_close(f->file);
+      free(f);
+  }
+}
+
+/* Exiting ends every thread of the process, not just the caller. */
 void sys_exit(int status) {
-    thread_current()->st_exit = status;
-    thread_exit();
+    process_terminate(status);
 }
 
 void sys_exec(struct intr_frame *f) {
@@ -147,6 +234,37 @@ void sys_wait(struct intr_frame *f) {
     f->eax = process_wait(pid);
 }
 
+/* System Call: pid_t wait_any (int *status)
+    Waits for whichever child process exits first, stores its exit
+    status in *STATUS unless STATUS is null, and returns its pid.
+    Returns -1 if there is no child left to wait for.  Like POSIX
+    waitpid(-1, status, 0).
+*/
+void sys_wait_any(struct intr_frame *f) {
+    uint32_t *args = f->esp;
+    check_ptr(args + 1);
+    int *status = (int *)args[1];
+    int st;
+
+    if (status != NULL) {
+        check_ptr(status);
+        check_ptr((char *)status + sizeof *status - 1);
+#ifdef VM
+        /* Keep *STATUS in memory, and writable, until it is set. */
+        preload_and_pin_pages(status, sizeof *status);
+#endif
+        check_writable_ptr(status);
+        check_writable_ptr((char *)status + sizeof *status - 1);
+    }
+    f->eax = process_wait_any(&st);
+    if (status != NULL && (int)f->eax != -1)
+        *status = st;
+#ifdef VM
+    if (status != NULL)
+        unpin_preloaded_pages(status, sizeof *status);
+#endif
+}
+
 void sys_write(struct intr_frame *f) {
     uint32_t *args = f->esp;
     check_ptr(args + 1);
@@ -171,9 +289,10 @@ void sys_write(struct intr_frame *f) {
     } else {
         struct open_file *tmp = find_file(fd);
         if (tmp) {
-            acquire_file_lock();
+            lock_acquire(&tmp->pos_lock);
             f->eax = file_write(tmp->file, buffer, size);
-            release_file_lock();
+            lock_release(&tmp->pos_lock);
+            put_file(tmp);
         } else {
             f->eax = 0;
         }
@@ -194,9 +313,7 @@ void sys_create(struct intr_frame *f) {
     
     check_ptr(file);
 
-    acquire_file_lock();
     f->eax = filesys_create(file, initial_size);
-    release_file_lock();
 }
 
 void sys_remove(struct intr_frame *f) {
@@ -206,9 +323,7 @@ void sys_remove(struct intr_frame *f) {
     const char *file = (const char *)args[1];
     check_ptr(file);
 
-    acquire_file_lock();
     f->eax = filesys_remove(file);
-    release_file_lock();
 }
 
 void sys_open(struct intr_frame *f) {
@@ -218,16 +333,18 @@ void sys_open(struct intr_frame *f) {
     const char *file = (const char *)args[1];
     check_ptr(file);
 
-    acquire_file_lock();
     struct file *opened = filesys_open(file);
-    release_file_lock();
 
     if (opened) {
-        struct thread *t = thread_current();
+        struct thread *t = thread_current()->leader;
         struct open_file *tmp = malloc(sizeof(struct open_file));
-        tmp->fd = t->file_fd++;
         tmp->file = opened;
+        tmp->refs = 1;
+        lock_init(&tmp->pos_lock);
+        lock_acquire(&t->proc_lock);
+        tmp->fd = t->file_fd++;
         list_push_back(&t->files, &tmp->elem);
+        lock_release(&t->proc_lock);
         f->eax = tmp->fd;
     } else {
         f->eax = -1;
@@ -242,9 +359,8 @@ void sys_filesize(struct intr_frame *f) {
 
     struct open_file *tmp = find_file(fd);
     if (tmp) {
-        acquire_file_lock();
         f->eax = file_length(tmp->file);
-        release_file_lock();
+        put_file(tmp);
     } else {
         f->eax = -1;
     }
@@ -271,15 +387,20 @@ void sys_read(struct intr_frame *f) {
     if (fd == 0) {  // STDIN
         unsigned i;
         for (i = 0; i < size; i++) {
-            buffer[i] = input_getc();
+            /* Give up if another thread terminates the process. */
+            int key = input_getc_unless(process_exiting);
+            if (key < 0)
+                break;
+            buffer[i] = key;
         }
-        f->eax = size;
+        f->eax = i;
     } else {
         struct open_file *tmp = find_file(fd);
         if (tmp) {
-            acquire_file_lock();
+            lock_acquire(&tmp->pos_lock);
             f->eax = file_read(tmp->file, buffer, size);
-            release_file_lock();
+            lock_release(&tmp->pos_lock);
+            put_file(tmp);
         } else {
             f->eax = -1;
         }
@@ -300,9 +421,10 @@ void sys_seek(struct intr_frame *f) {
 
     struct open_file *tmp = find_file(fd);
     if (tmp) {
-        acquire_file_lock();
+        lock_acquire(&tmp->pos_lock);
         file_seek(tmp->file, position);
-        release_file_lock();
+        lock_release(&tmp->pos_lock);
+        put_file(tmp);
     }
 }
 
@@ -313,9 +435,10 @@ void sys_tell(struct intr_frame *f) {
     int fd = args[1];
     struct open_file *tmp = find_file(fd);
     if (tmp) {
-        acquire_file_lock();
+        lock_acquire(&tmp->pos_lock);
         f->eax = file_tell(tmp->file);
-        release_file_lock();
+        lock_release(&tmp->pos_lock);
+        put_file(tmp);
     } else {
         f->eax = -1;
     }
@@ -326,15 +449,84 @@ void sys_close(struct intr_frame *f) {
     check_ptr(args + 1);
     
     int fd = args[1];
-    struct open_file *tmp = find_file(fd);
-    if (tmp) {
-        acquire_file_lock();
-        file_close(tmp->file);
-        release_file_lock();
+    struct open_file *tmp = find_and_remove_file(fd);
+    if (tmp)
+        put_file(tmp);
+}
 
-        list_remove(&tmp->elem);
-        free(tmp);
-    }
+/* System Call: int64_t clock_ns (void)
+    Returns the nanoseconds since boot from timer_ns(), in EDX:EAX.
+*/
+void sys_clock_ns(struct intr_frame *f) {
+    uint64_t ns = timer_ns();
+    f->eax = (uint32_t) ns;
+    f->edx = (uint32_t) (ns >> 32);
+}
+
+/* System Call: int futex_wait (uint32_t *addr, uint32_t val)
+    Sleeps until futex_wake() on ADDR if *ADDR == VAL, returning 0;
+    otherwise returns -1 at once.  A bad ADDR kills the process.
+*/
+void sys_futex_wait(struct intr_frame *f) {
+    uint32_t *args = f->esp;
+    check_ptr(args + 1);
+    check_ptr(args + 2);
+
+    int result = futex_wait((uint32_t *)args[1], args[2]);
+    if (result == FUTEX_FAULT)
+        invalid_access();
+    f->eax = result;
+}
+
+/* System Call: int futex_wake (uint32_t *addr, int n)
+    Wakes up to N threads sleeping in futex_wait() on ADDR and
+    returns how many were woken.  A bad ADDR kills the process.
+*/
+void sys_futex_wake(struct intr_frame *f) {
+    uint32_t *args = f->esp;
+    check_ptr(args + 1);
+    check_ptr(args + 2);
+
+    int result = futex_wake((uint32_t *)args[1], (int)args[2]);
+    if (result == FUTEX_FAULT)
+        invalid_access();
+    f->eax = result;
+}
+
+/* System Call: tid_t thread_create (void (*entry) (void), void *func, void *aux)
+    Starts a thread in this process that runs ENTRY, as if called
+    as ENTRY (FUNC, AUX), on a stack of its own.  Returns its tid,
+    or -1 if it cannot be started.
+*/
+void sys_thread_create(struct intr_frame *f) {
+    uint32_t *args = f->esp;
+    check_ptr(args + 1);
+    check_ptr(args + 2);
+    check_ptr(args + 3);
+
+    void (*entry)(void) = (void (*)(void))args[1];
+    if (!is_user_vaddr(entry))
+        invalid_access();
+    f->eax = process_thread_create(entry, (void *)args[2], (void *)args[3]);
+}
+
+/* System Call: int thread_join (tid_t tid)
+    Waits for thread TID of this process to exit.  Returns 0, or
+    -1 if TID is not a joinable thread of this process.
+*/
+void sys_thread_join(struct intr_frame *f) {
+    uint32_t *args = f->esp;
+    check_ptr(args + 1);
+
+    f->eax = process_thread_join((tid_t)args[1]);
+}
+
+/* System Call: void thread_exit (void)
+    Ends the calling thread.  The process exits, with status 0,
+    once its last thread does.
+*/
+void sys_thread_exit(struct intr_frame *f UNUSED) {
+    process_thread_exit();
 }
 
 /* System Call: void halt (void)
@@ -347,8 +539,7 @@ void sys_halt(void)
 
 void invalid_access (void)
 {
-  thread_current()->st_exit = -1;
-  thread_exit();
+  process_terminate(-1);
 }
 
 static void syscall_handler (struct intr_frame *f) 
@@ -359,8 +550,7 @@ static void syscall_handler (struct intr_frame *f)
   syscall_num = *(int *)f->esp;
   
   if (syscall_num < 0 || syscall_num >= MAX_SYSCALL) {
-    thread_current()->st_exit = -1;
-    thread_exit();
+    invalid_access();
     return;
   }
 
@@ -379,7 +569,6 @@ static void syscall_handler (struct intr_frame *f)
   if (syscalls[syscall_num] != NULL) {
     syscalls[syscall_num](f);
   } else {
-    thread_current()->st_exit = -1;
-    thread_exit();
+    invalid_access();
   }
 }
\ No newline at end of file
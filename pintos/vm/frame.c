@@ -17,6 +17,7 @@
 static struct list frame_table;       /* 雙向循環 list — 保存所有 frame */
 static struct lock frame_lock;        /* 保護 frame_table + clock_hand */
 static struct list_elem *clock_hand;  /* 指向下一個要檢查的 frame     */
+static struct condition eviction_done; /* Signaled when an eviction ends. */
 
 
 /* 將 list_elem 轉回 struct frame* */
@@ -44,7 +45,9 @@ select_victim (void)
         struct frame *fr = elem_to_frame (clock_hand);
         clock_hand = list_next (clock_hand);        /* hand 往前移 */
 
-        if (fr->pinned)        /* 被pin住 => 跳過 */
+        if (fr->pin_cnt > 0 || fr->evicting)  /* 被pin住 => 跳過 */
+            continue;
+        if (fr->owner->pagedir == NULL)  /* Owner is exiting. */
             continue;
 
         /* accessed? 若被 access 就清 bit, 給第二次機會 */
@@ -68,12 +71,21 @@ evict_frame (struct frame *victim)
     ASSERT (victim && victim->page);
 
     struct suppPage *page = victim->page;
-    struct thread   *owner = victim->owner;
+    /* Read the owner's page directory under frame_lock: its owner
+       cannot detach the frame, and so cannot clear the pointer,
+       until the eviction ends. */
+    uint32_t        *pd = victim->owner->pagedir;
+
+    ASSERT (pd != NULL);
 
     /* 先在 pagedir 斷開映射，避免 race */
-    pagedir_clear_page (owner->pagedir, page->va);
+    pagedir_clear_page (pd, page->va);
 
-    /* 臨時釋放鎖，以便執行可能會休眠的操作 */
+    /* 臨時釋放鎖，以便執行可能會休眠的操作。
+       VICTIM stays in frame_table and PAGE still points to it
+       meanwhile, so mark it, to keep an exiting owner from
+       detaching and freeing either under us. */
+    victim->evicting = true;
     lock_release (&frame_lock);
 
     bool ok = false;
@@ -86,7 +98,7 @@ evict_frame (struct frame *victim)
 
       case VM_FILE:
         /* 若是 dirty 且可寫 -> write-back；這裡先偷懶忽略 write-back */
-        if (pagedir_is_dirty (owner->pagedir, page->va) && page->writable)
+        if (pagedir_is_dirty (pd, page->va) && page->writable)
             ; /* TODO: file write-back (mmap write) */
         page->in_swap = false;
         ok = true;
@@ -101,6 +113,8 @@ evict_frame (struct frame *victim)
     
     if (ok)
         page->frame = NULL;            /* 斷聯繫，頁狀態已更新 */
+    victim->evicting = false;
+    cond_broadcast (&eviction_done, &frame_lock);
 
     return ok;
 }
@@ -115,6 +129,7 @@ vm_frame_init (void)
 {
     list_init (&frame_table);
     lock_init (&frame_lock);
+    cond_init (&eviction_done);
     clock_hand = list_end (&frame_table);
 }
 
@@ -167,8 +182,12 @@ vm_frame_allocate (enum palloc_flags flags, void *upage)
 
     fr->kva   = kva;
     fr->page  = NULL;         /* 在 page.c 中設置 */
-    fr->owner = thread_current ();
-    fr->pinned = false;
+    /* The process's leader owns the frame, since it outlives the
+       process's other threads and keeps the page directory. */
+    fr->owner = (thread_current ()->leader != NULL
+                 ? thread_current ()->leader : thread_current ());
+    fr->pin_cnt = 0;
+    fr->evicting = false;
 
     list_push_back (&frame_table, &fr->elem);
 
@@ -229,7 +248,7 @@ vm_frame_pin (void *kva)
         struct frame *fr = elem_to_frame (e);
         if (fr->kva == kva) 
         {
-            fr->pinned = true;
+            fr->pin_cnt++;
             break;
         }
     }
@@ -257,11 +276,78 @@ vm_frame_unpin (void *kva)
         struct frame *fr = elem_to_frame (e);
         if (fr->kva == kva) 
         {
-            fr->pinned = false;
+            /* Pins are counted, so that one holder's unpin leaves
+               the others' in place.  A page pinned while it was
+               out of memory has no pin here to drop. */
+            if (fr->pin_cnt > 0)
+                fr->pin_cnt--;
             break;
         }
     }
     
     if (!already_holding_lock)
         lock_release (&frame_lock);
-}
\ No newline at end of file
+}
+
+/* Removes every frame that holds a page of SPT from the frame
+   table and moves it to FRAMES, under a single acquisition of
+   the frame table lock.  SPT must belong to a process that has
+   exited, so that its frames are no longer candidates for
+   eviction, whose owner thread is about to go away.  First waits
+   for any eviction of one of those frames to finish, since the
+   evictor still uses the frame and its page.  The frames keep
+   their memory until vm_frame_free_detached(). */
+void
+vm_frame_detach_all (struct supplemental_page_table *spt, struct list *frames)
+{
+    struct hash_iterator i;
+
+    lock_acquire (&frame_lock);
+  restart:
+    hash_first (&i, &spt->page_map);
+    while (hash_next (&i))
+    {
+        struct suppPage *page = hash_entry (hash_cur (&i), struct suppPage,
+                                            hash_elem);
+        if (page->frame != NULL && page->frame->evicting)
+        {
+            cond_wait (&eviction_done, &frame_lock);
+            goto restart;
+        }
+    }
+
+    hash_first (&i, &spt->page_map);
+    while (hash_next (&i))
+    {
+        struct suppPage *page = hash_entry (hash_cur (&i), struct suppPage,
+                                            hash_elem);
+        struct frame *fr = page->frame;
+        if (fr == NULL)
+            continue;
+
+        if (clock_hand == &fr->elem)
+            clock_hand = list_next (clock_hand);
+        list_remove (&fr->elem);
+        list_push_back (frames, &fr->elem);
+    }
+    lock_release (&frame_lock);
+}
+
+/* Frees the frames on FRAMES, which vm_frame_detach_all() took
+   out of the frame table, along with their memory.  Each frame's
+   mapping in PAGEDIR is cleared, so that pagedir_destroy() does
+   not free its memory a second time.  Needs no lock, since no
+   other thread can reach these frames any longer. */
+void
+vm_frame_free_detached (struct list *frames, uint32_t *pagedir)
+{
+    while (!list_empty (frames))
+    {
+        struct frame *fr = elem_to_frame (list_pop_front (frames));
+
+        pagedir_clear_page (pagedir, fr->page->va);
+        fr->page->frame = NULL;
+        palloc_free_page (fr->kva);
+        free (fr);
+    }
+}
@@ -11,6 +11,7 @@
 
 /* Forward declarations ------------- */
 struct suppPage;
+struct supplemental_page_table;
 
 //The frame table entry that contains a user page
 struct frame {
@@ -18,7 +19,8 @@ struct frame {
     struct suppPage *page;     /* 若已映射，指向對應 suppPage     */
     struct thread *owner;      /* 擁有該 pagedir 的執行緒         */
     struct list_elem elem;     /* 串到全域 frame_table            */
-    bool pinned;               /* true ⇒ 不得被驅逐               */
+    int pin_cnt;               /* Pins held; > 0 ⇒ 不得被驅逐     */
+    bool evicting;             /* Being evicted, frame_lock dropped. */
 };
 
 /* 初始化 → 在 vm_init() 早期呼叫 */
@@ -32,4 +34,8 @@ void          frame_free     (struct frame *fr);
 void frame_pin   (struct frame *fr);
 void frame_unpin (struct frame *fr);
 
+/* Tearing down an exited process's frames in bulk. */
+void vm_frame_detach_all (struct supplemental_page_table *, struct list *);
+void vm_frame_free_detached (struct list *, uint32_t *pagedir);
+
 #endif /* vm/frame.h */
\ No newline at end of file
@@ -44,7 +44,7 @@ void supplemental_page_table_init(struct supplemental_page_table *spt) {
 static void page_destroy(struct hash_elem *e, void *aux UNUSED) {
     struct suppPage *page = hash_entry(e, struct suppPage, hash_elem);
     if (page->frame) {
-        vm_frame_free(page->frame);
+        vm_frame_free(page->frame->kva);
     }
     free(page);
 }
@@ -139,7 +139,8 @@ vm_do_claim_page (struct suppPage *page)
     // 設置page和frame的關聯，但不立即設置 pinned 標誌
     page->frame = frame;
     frame->page = page;
-    frame->owner = thread_current();
+    frame->owner = thread_current()->leader != NULL
+                   ? thread_current()->leader : thread_current();
     
     // 使用 vm_frame_pin 來確保frame被正確pin住
     vm_frame_pin(kva);
@@ -534,7 +535,7 @@ vm_supt_mm_unmap(
     
     // 取消page映射
     pagedir_clear_page(pagedir, p->va);
-    vm_frame_free(p->frame);
+    vm_frame_free(p->frame->kva);
   } 
   else if (p->in_swap) {
     // 如果在swap區中，釋放swap槽
@@ -121,10 +121,8 @@ swap_out (struct suppPage *page)
         if (old_level == INTR_OFF)
             intr_set_level(INTR_ON);
             
-        for (size_t i = 0; i < SECTORS_PER_PAGE; i++)
-            block_write (swap_block,
-                         slot * SECTORS_PER_PAGE + i,
-                         kva + i * BLOCK_SECTOR_SIZE);
+        block_write_multiple (swap_block, slot * SECTORS_PER_PAGE,
+                              SECTORS_PER_PAGE, kva);
     }
 
     // 恢復中斷級別
@@ -184,10 +182,8 @@ swap_in (struct suppPage *page, void *kva)
         if (old_level == INTR_OFF)
             intr_set_level(INTR_ON);
             
-        for (size_t i = 0; i < SECTORS_PER_PAGE; i++)
-            block_read (swap_block,
-                        slot * SECTORS_PER_PAGE + i,
-                        kva + i * BLOCK_SECTOR_SIZE);
+        block_read_multiple (swap_block, slot * SECTORS_PER_PAGE,
+                             SECTORS_PER_PAGE, kva);
     }
 
     // 恢復中斷級別
@@ -226,4 +222,33 @@ vm_swap_free (swap_index_t swap_index)
     
     bitmap_set (swap_available, swap_index, true);
     lock_release (&swap_lock);
-}
\ No newline at end of file
+}
+
+/* Frees the swap slots of all the pages in SPT that are swapped
+   out, under a single acquisition of the swap lock.  SPT must
+   belong to a process that has exited.  Slots are freed the way
+   swap_in() frees them. */
+void
+vm_swap_release_all (struct supplemental_page_table *spt)
+{
+    struct hash_iterator i;
+
+    lock_acquire (&swap_lock);
+    hash_first (&i, &spt->page_map);
+    while (hash_next (&i))
+    {
+        struct suppPage *page = hash_entry (hash_cur (&i), struct suppPage,
+                                            hash_elem);
+        if (!page->in_swap || page->swap_slot >= swap_size)
+            continue;
+
+        if (using_memory_swap && swap_memory_map[page->swap_slot] != NULL)
+        {
+            free (swap_memory_map[page->swap_slot]);
+            swap_memory_map[page->swap_slot] = NULL;
+        }
+        bitmap_reset (swap_available, page->swap_slot);
+        page->in_swap = false;
+    }
+    lock_release (&swap_lock);
+}
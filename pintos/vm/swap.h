@@ -26,4 +26,8 @@ bool swap_in  (struct suppPage *page, void *kva);
 /* 釋放尚未 swap_in 的 slot */
 void vm_swap_free (swap_index_t swap_index);
 
+/* Frees every swap slot that holds a page of an exited process. */
+struct supplemental_page_table;
+void vm_swap_release_all (struct supplemental_page_table *);
+
 #endif /* VM_SWAP_H */
\ No newline at end of file